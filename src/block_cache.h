@@ -0,0 +1,101 @@
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <functional>
+#include <unordered_map>
+
+// sharded thread-safe LRU cache of decompressed blocks, keyed by (file, block index)
+class BlockCache {
+ public:
+  using Block = std::shared_ptr<const std::vector<uint8_t>>;
+  // the owner keeps the file identity alive while any of its blocks is cached,
+  // so the address cannot be reused by another file
+  using FileKey = std::shared_ptr<const void>;
+
+  struct Stats {
+    uint64_t hits, misses;
+    double HitRate() const {
+      return hits + misses ? (double)hits / (hits + misses) : 0.0;
+    }
+  };
+ private:
+  using Key = std::pair<const void*, size_t>;
+  struct KeyHash {
+    size_t operator()(const Key& key) const {
+      return std::hash<const void*>()(key.first) ^ (key.second * 0x9e3779b97f4a7c15ULL);
+    }
+  };
+  struct Entry {
+    Key key;
+    FileKey file;
+    Block block;
+  };
+  struct Shard {
+    std::mutex mtx;
+    std::list<Entry> lru; // most recently used first
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> map;
+    size_t bytes = 0;
+  };
+
+  std::vector<Shard> shards;
+  size_t shard_capacity;
+  std::atomic<uint64_t> hits, misses;
+
+  Shard& GetShard(const Key& key) {
+    return shards[KeyHash()(key) % shards.size()];
+  }
+
+  void Evict(Shard& shard) {
+    while (shard.bytes > shard_capacity && shard.lru.size()) {
+      auto& entry = shard.lru.back();
+      shard.bytes -= entry.block->size();
+      shard.map.erase(entry.key);
+      shard.lru.pop_back();
+    }
+  }
+ public:
+  BlockCache(size_t capacity_bytes, size_t num_shards = 16) :
+      shards(num_shards), shard_capacity(capacity_bytes / num_shards), hits(0), misses(0) {}
+  BlockCache(const BlockCache&) = delete;
+
+  // load() is called without holding any lock; concurrent misses on the same block may both load it
+  template <class Func>
+  Block Get(const FileKey& file, size_t block_idx, Func&& load) {
+    Key key{file.get(), block_idx};
+    Shard& shard = GetShard(key);
+    {
+      std::lock_guard lck(shard.mtx);
+      auto it = shard.map.find(key);
+      if (it != shard.map.end()) {
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+        hits.fetch_add(1, std::memory_order_relaxed);
+        return it->second->block;
+      }
+    }
+    misses.fetch_add(1, std::memory_order_relaxed);
+    Block block = std::make_shared<const std::vector<uint8_t>>(load());
+    if (block->size() > shard_capacity) return block;
+    std::lock_guard lck(shard.mtx);
+    auto it = shard.map.find(key);
+    if (it != shard.map.end()) return it->second->block;
+    shard.lru.push_front({key, file, block});
+    shard.map.emplace(key, shard.lru.begin());
+    shard.bytes += block->size();
+    Evict(shard);
+    return block;
+  }
+
+  Stats GetStats() const {
+    return {hits.load(std::memory_order_relaxed), misses.load(std::memory_order_relaxed)};
+  }
+  void ResetStats() {
+    hits.store(0, std::memory_order_relaxed);
+    misses.store(0, std::memory_order_relaxed);
+  }
+};
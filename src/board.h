@@ -3,6 +3,7 @@
 #include <cstdint>
 #include <cstring>
 #include <bit>
+#include <algorithm>
 #include <array>
 #include <string>
 #include <vector>
@@ -21,6 +22,7 @@ constexpr Board operator&(const Board& x, const Board& y);
 constexpr int kBoardBytes = 25;
 struct CompactBoard : public SimpleIOArray<uint8_t, kBoardBytes> {
   using SimpleIOArray<uint8_t, kBoardBytes>::SimpleIOArray;
+  static constexpr uint32_t kRecordTypeId = kRecordCompactBoard;
   constexpr int Count() const {
     uint64_t x[4] = {BytesToInt<uint64_t>(data()),
                      BytesToInt<uint64_t>(data() + 8),
@@ -686,6 +688,79 @@ constexpr Board operator&(const Board& x, const Board& y) {
   return {x.b1 & y.b1, x.b2 & y.b2, x.b3 & y.b3, x.b4 & y.b4};
 }
 
+// the 19 fixed tetrominoes as rows of filled cells (top row first, bit i = column i)
+struct TetrominoRows {
+  int height, width;
+  uint32_t rows[4];
+};
+inline constexpr TetrominoRows kTetrominoRows[] = {
+    {1, 4, {0xf}}, {4, 1, {1, 1, 1, 1}},                                      // I
+    {2, 2, {3, 3}},                                                           // O
+    {2, 3, {7, 2}}, {2, 3, {2, 7}}, {3, 2, {1, 3, 1}}, {3, 2, {2, 3, 2}},     // T
+    {2, 3, {6, 3}}, {3, 2, {1, 3, 2}}, {2, 3, {3, 6}}, {3, 2, {2, 3, 1}},     // S, Z
+    {2, 3, {1, 7}}, {3, 2, {3, 1, 1}}, {2, 3, {7, 4}}, {3, 2, {2, 2, 3}},     // J
+    {2, 3, {4, 7}}, {3, 2, {1, 1, 3}}, {2, 3, {7, 1}}, {3, 2, {3, 2, 2}}};    // L
+
+// calls func(prev) for every board prev such that placing a tetromino on prev (possibly partly above
+// the top) and clearing the completed lines gives board
+// only cells are checked, so the placement may not be reachable; the same board may be reported twice
+template <class Func>
+void ForEachPredecessor(const Board& board, Func&& func) {
+  constexpr uint32_t kRowMask = 0x3ff;
+  std::array<uint32_t, 20> filled;
+  for (int i = 0; i < 20; i++) filled[i] = ~board.Row(i) & kRowMask;
+  auto ToBoard = [](const std::array<uint32_t, 20>& rows) {
+    Board ret = Board::Zeros;
+    for (int row = 0; row < 20; row++) {
+      for (int col = 0; col < 10; col++) {
+        if (rows[row] >> col & 1) continue;
+        uint64_t bit = 1ull << (col % 3 * 22 + row);
+        switch (col / 3) {
+          case 0: ret.b1 |= bit; break;
+          case 1: ret.b2 |= bit; break;
+          case 2: ret.b3 |= bit; break;
+          default: ret.b4 |= 1ull << row;
+        }
+      }
+    }
+    return ret;
+  };
+  std::array<uint32_t, 20> prev;
+  // lines: number of cleared lines; they were inserted back at the rows in `cleared` (bits over the piece rows)
+  for (int lines = 0; lines <= 4; lines++) {
+    if (lines && filled[lines - 1]) break; // clearing leaves empty rows at the top
+    for (auto& shape : kTetrominoRows) {
+      for (int top = 1 - shape.height; top + shape.height <= 20; top++) {
+        for (uint32_t cleared = 0; cleared < (1u << shape.height); cleared++) {
+          if (popcount(cleared) != lines) continue;
+          // rows above the board cannot be cleared
+          if (top < 0 && (cleared & ((1u << -top) - 1))) continue;
+          // row of board that row top+i of the board before clearing ended up in, or -1 if cleared
+          auto SourceRow = [&](int i) {
+            if (cleared >> i & 1) return -1;
+            return lines + top + i - popcount(cleared & ((1u << i) - 1));
+          };
+          for (int col = 0; col + shape.width <= 10; col++) {
+            bool ok = true;
+            for (int i = std::max(0, -top); i < shape.height && ok; i++) {
+              int src = SourceRow(i);
+              if (src >= 0 && (shape.rows[i] << col & ~filled[src])) ok = false;
+            }
+            if (!ok) continue;
+            for (int row = 0; row < std::max(0, top); row++) prev[row] = filled[lines + row];
+            for (int i = std::max(0, -top); i < shape.height; i++) {
+              int src = SourceRow(i);
+              prev[top + i] = (src >= 0 ? filled[src] : kRowMask) & ~(shape.rows[i] << col);
+            }
+            for (int row = top + shape.height; row < 20; row++) prev[row] = filled[row];
+            func(ToBoard(prev));
+          }
+        }
+      }
+    }
+  }
+}
+
 namespace std {
 
 template<>
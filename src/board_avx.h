@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <immintrin.h>
+
+#include "board.h"
+
+// Board held in one AVX2 register (lanes b1, b2, b3, b4), for the bit-parallel checks of the move search
+class BoardAVX {
+  __m256i v;
+
+ public:
+  BoardAVX() : v(_mm256_setzero_si256()) {}
+  explicit BoardAVX(__m256i v) : v(v) {}
+  explicit BoardAVX(const Board& b) : v(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(&b))) {
+    static_assert(sizeof(Board) == sizeof(__m256i));
+  }
+
+  Board ToBoard() const {
+    alignas(32) uint64_t x[4];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(x), v);
+    return Board(x[0], x[1], x[2], x[3]);
+  }
+
+  BoardAVX operator&(const BoardAVX& x) const { return BoardAVX(_mm256_and_si256(v, x.v)); }
+  BoardAVX operator|(const BoardAVX& x) const { return BoardAVX(_mm256_or_si256(v, x.v)); }
+  bool operator==(const BoardAVX& x) const {
+    __m256i diff = _mm256_xor_si256(v, x.v);
+    return _mm256_testz_si256(diff, diff);
+  }
+
+  // every bit set in mask is also set here, i.e. (*this & mask) == mask
+  bool Contains(const BoardAVX& mask) const { return _mm256_testc_si256(v, mask.v); }
+};
+
+template <int R>
+bool Contains(const std::array<BoardAVX, R>& board, const std::array<Board, 4>& mask) {
+  bool ret = true;
+  for (int i = 0; i < R; i++) ret &= board[i].Contains(BoardAVX(mask[i]));
+  return ret;
+}
+
+/*
+ * Frame masks (one uint64_t per column) of 4 adjacent columns in one AVX2 register.
+ * Per-column arrays are stored with kPad zero guard columns on each side, so that the neighbouring
+ * columns of any 4 columns are read by an unaligned load at an offset (see Load) and the columns
+ * outside the board read as no frames.
+ */
+class FramesAVX {
+  __m256i v;
+
+ public:
+  static constexpr int kPad = 2;
+  // guard columns, columns 0-9, then guards up to a multiple of the vector width
+  static constexpr int kCols = 16;
+  // vectors covering columns 0-9 (and the guard columns 10 and 11)
+  static constexpr int kVectors = 3;
+  static constexpr int kWidth = 4;
+
+  // array index of a column
+  static constexpr int Index(int col) { return col + kPad; }
+
+  FramesAVX() : v(_mm256_setzero_si256()) {}
+  explicit FramesAVX(__m256i v) : v(v) {}
+
+  // columns vec*4+delta .. vec*4+delta+3 of a padded array; -kPad <= delta <= kPad
+  static FramesAVX Load(const uint64_t cols[kCols], int vec, int delta = 0) {
+    return FramesAVX(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(cols + Index(vec * kWidth + delta))));
+  }
+  void Store(uint64_t cols[kCols], int vec, int delta = 0) const {
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(cols + Index(vec * kWidth + delta)), v);
+  }
+
+  FramesAVX operator&(const FramesAVX& x) const { return FramesAVX(_mm256_and_si256(v, x.v)); }
+  FramesAVX operator|(const FramesAVX& x) const { return FramesAVX(_mm256_or_si256(v, x.v)); }
+  FramesAVX& operator|=(const FramesAVX& x) { return *this = *this | x; }
+  // lane-wise frame shifts; >> n moves every frame n frames earlier
+  FramesAVX operator>>(int n) const { return FramesAVX(_mm256_srli_epi64(v, n)); }
+  FramesAVX operator<<(int n) const { return FramesAVX(_mm256_slli_epi64(v, n)); }
+};
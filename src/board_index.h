@@ -0,0 +1,131 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <optional>
+#include <algorithm>
+#include <filesystem>
+
+#include "io.h"
+#include "board.h"
+#include "files.h"
+
+/*
+ * Lookup of board ids directly in the sorted board file of a group (sorted by (cell count, bytes)).
+ * Every kStride-th board is kept in RAM in Eytzinger order (~0.25 bytes per board); a lookup walks
+ * it and then binary searches the <4 KiB run of boards between two samples in the mapped file.
+ * The samples are loaded from BoardSamplePath (written by board-map) or rebuilt from the board file.
+ * The sample file records the board file it was taken from, so samples of an older board file are not used.
+ */
+class SortedBoardIndex {
+ public:
+  static constexpr size_t kStride = 4096 / kBoardBytes;
+
+ private:
+  // (cell count, bytes) packed big-endian, so that comparing the words compares the boards
+  using SortKey = std::array<uint64_t, 4>;
+  static SortKey MakeKey(const uint8_t* board) {
+    uint8_t buf[32] = {};
+    buf[0] = CompactBoard(board, kBoardBytes).Count();
+    memcpy(buf + 1, board, kBoardBytes);
+    SortKey ret;
+    for (size_t i = 0; i < 4; i++) {
+      ret[i] = 0;
+      for (size_t j = 0; j < 8; j++) ret[i] = ret[i] << 8 | buf[i * 8 + j];
+    }
+    return ret;
+  }
+
+  io_internal::MappedFile file;
+  size_t data_offset, num_boards;
+  // 1-based Eytzinger order; tree_rank[k] is the sample index of tree[k]
+  std::vector<SortKey> tree;
+  std::vector<size_t> tree_rank;
+
+  const uint8_t* BoardData(size_t id) const {
+    return file.data() + data_offset + id * kBoardBytes;
+  }
+
+  void BuildTree(const std::vector<SortKey>& samples) {
+    tree.resize(samples.size() + 1);
+    tree_rank.resize(samples.size() + 1);
+    size_t i = 0;
+    auto Fill = [&](auto&& self, size_t k) -> void {
+      if (k > samples.size()) return;
+      self(self, k * 2);
+      tree[k] = samples[i];
+      tree_rank[k] = i++;
+      self(self, k * 2 + 1);
+    };
+    Fill(Fill, 1);
+  }
+
+  static bool SamplesMatch(const std::filesystem::path& board_path, const std::filesystem::path& sample_path) {
+    auto header = ReadFileHeader(sample_path);
+    FileHeader cur;
+    return header && header->HasSource() && io_internal::SetFileSource(cur, board_path, board_path) &&
+        cur.SameSource(*header);
+  }
+
+  std::vector<SortKey> LoadSamples(const std::filesystem::path& board_path,
+                                   const std::filesystem::path& sample_path) const {
+    size_t num_samples = (num_boards + kStride - 1) / kStride;
+    std::vector<SortKey> ret;
+    ret.reserve(num_samples);
+    if (std::filesystem::exists(sample_path) && SamplesMatch(board_path, sample_path) &&
+        BoardCount(sample_path) == num_samples) {
+      ClassReader<CompactBoard> reader(sample_path);
+      for (auto& i : reader.ReadBatch(num_samples)) ret.push_back(MakeKey(i.data()));
+      if (ret.size() == num_samples) return ret;
+      ret.clear();
+    }
+    for (size_t i = 0; i < num_samples; i++) ret.push_back(MakeKey(BoardData(i * kStride)));
+    return ret;
+  }
+
+ public:
+  SortedBoardIndex(const std::filesystem::path& board_path, const std::filesystem::path& sample_path) :
+      file(board_path) {
+    data_offset = ReadFileHeader(board_path) ? FileHeader::kSize : 0;
+    num_boards = BoardCount(board_path);
+    if (data_offset + num_boards * kBoardBytes > file.size()) throw std::runtime_error("board file truncated");
+    BuildTree(LoadSamples(board_path, sample_path));
+  }
+  SortedBoardIndex(int group) : SortedBoardIndex(BoardPath(group), BoardSamplePath(group)) {}
+
+  // every kStride-th board of the sorted boards read from board_path, for SortedBoardIndex to load
+  static void WriteSamples(const std::filesystem::path& fname, const std::filesystem::path& board_path,
+                           const std::vector<CompactBoard>& boards) {
+    ClassWriter<CompactBoard> writer(fname);
+    writer.SetSource(board_path, board_path);
+    for (size_t i = 0; i < boards.size(); i += kStride) writer.Write(boards[i]);
+  }
+
+  size_t size() const { return num_boards; }
+
+  // thread-safe
+  std::optional<uint32_t> operator[](const CompactBoard& board) const {
+    SortKey key = MakeKey(board.data());
+    size_t k = 1, m = tree.size() - 1;
+    while (k <= m) {
+      __builtin_prefetch(tree.data() + k * 4);
+      k = k * 2 + !(key < tree[k]);
+    }
+    // k is now the first sample greater than the key (0 if there is none)
+    k >>= __builtin_ffsll(~k);
+    size_t upper = k ? tree_rank[k] : m;
+    if (!upper) return std::nullopt;
+    size_t l = (upper - 1) * kStride, r = std::min(upper * kStride, num_boards);
+    while (l < r) {
+      size_t mid = (l + r) / 2;
+      SortKey cur = MakeKey(BoardData(mid));
+      if (cur == key) return mid;
+      if (cur < key) {
+        l = mid + 1;
+      } else {
+        r = mid;
+      }
+    }
+    return std::nullopt;
+  }
+};
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <immintrin.h>
+
+#include "board.h"
+
+/*
+ * Open-addressing map from boards to ids, tuned for the lookups of edge building.
+ * Slots are kept in groups of 32; each group has 32 control bytes (0 for an empty slot, otherwise an
+ * 8-bit fingerprint of the hash) that are compared with one AVX2 instruction, so a lookup usually
+ * touches one control line and one slot. Groups are probed linearly and entries are never erased.
+ * The id is stored in the unused upper half of b4 (column 9 only uses 20 bits), making a slot 32 bytes.
+ */
+class FlatBoardMap {
+ public:
+  static constexpr uint64_t kNotFound = -1;
+  static constexpr size_t kGroupSize = 32;
+
+ private:
+  // at most 7/8 of the slots are used
+  static constexpr size_t kMaxLoadNum = 7, kMaxLoadDen = 8;
+  static constexpr uint64_t kKeyMask = 0xffffffff;
+
+  struct alignas(32) Ctrl {
+    uint8_t fp[kGroupSize];
+  };
+  struct alignas(32) Slot {
+    uint64_t b1, b2, b3, b4_value;
+  };
+
+  std::vector<Ctrl> ctrl;
+  std::vector<Slot> slots;
+  size_t group_mask = 0, num_items = 0;
+
+  static uint64_t HashBoard(const Board& b) { return std::hash<Board>()(b); }
+  static uint8_t Fingerprint(uint64_t hash) { return (hash >> 56) ? hash >> 56 : 1; }
+
+  static uint32_t MatchMask(const Ctrl& c, uint8_t fp) {
+    __m256i vec = _mm256_load_si256(reinterpret_cast<const __m256i*>(c.fp));
+    return _mm256_movemask_epi8(_mm256_cmpeq_epi8(vec, _mm256_set1_epi8(fp)));
+  }
+
+  static bool SlotEqual(const Slot& slot, const Board& b) {
+    return slot.b1 == b.b1 && slot.b2 == b.b2 && slot.b3 == b.b3 && (slot.b4_value & kKeyMask) == b.b4;
+  }
+
+  uint64_t Probe(const Board& b, uint64_t hash) const {
+    uint8_t fp = Fingerprint(hash);
+    for (size_t group = hash & group_mask;; group = (group + 1) & group_mask) {
+      for (uint32_t match = MatchMask(ctrl[group], fp); match; match &= match - 1) {
+        const Slot& slot = slots[group * kGroupSize + __builtin_ctz(match)];
+        if (SlotEqual(slot, b)) return slot.b4_value >> 32;
+      }
+      if (MatchMask(ctrl[group], 0)) return kNotFound;
+    }
+  }
+
+  void Rehash(size_t num_groups) {
+    std::vector<Ctrl> old_ctrl(num_groups);
+    std::vector<Slot> old_slots(num_groups * kGroupSize);
+    old_ctrl.swap(ctrl);
+    old_slots.swap(slots);
+    group_mask = num_groups - 1;
+    num_items = 0;
+    for (size_t group = 0; group < old_ctrl.size(); group++) {
+      for (size_t i = 0; i < kGroupSize; i++) {
+        if (!old_ctrl[group].fp[i]) continue;
+        auto& slot = old_slots[group * kGroupSize + i];
+        Insert(Board(slot.b1, slot.b2, slot.b3, slot.b4_value & kKeyMask), slot.b4_value >> 32);
+      }
+    }
+  }
+
+ public:
+  FlatBoardMap() { Rehash(1); }
+
+  void reserve(size_t n) {
+    size_t num_groups = 1;
+    while (num_groups * kGroupSize * kMaxLoadNum < n * kMaxLoadDen) num_groups *= 2;
+    if (num_groups > ctrl.size()) Rehash(num_groups);
+  }
+
+  size_t size() const { return num_items; }
+
+  // overwrites the id if the board is already present
+  void Insert(const Board& b, uint32_t value) {
+    if (b.b4 > kKeyMask) throw std::invalid_argument("board not normalized");
+    if ((num_items + 1) * kMaxLoadDen > ctrl.size() * kGroupSize * kMaxLoadNum) Rehash(ctrl.size() * 2);
+    uint64_t hash = HashBoard(b);
+    uint8_t fp = Fingerprint(hash);
+    for (size_t group = hash & group_mask;; group = (group + 1) & group_mask) {
+      for (uint32_t match = MatchMask(ctrl[group], fp); match; match &= match - 1) {
+        Slot& slot = slots[group * kGroupSize + __builtin_ctz(match)];
+        if (SlotEqual(slot, b)) {
+          slot.b4_value = b.b4 | (uint64_t)value << 32;
+          return;
+        }
+      }
+      if (uint32_t empty = MatchMask(ctrl[group], 0)) {
+        size_t idx = __builtin_ctz(empty);
+        ctrl[group].fp[idx] = fp;
+        slots[group * kGroupSize + idx] = {b.b1, b.b2, b.b3, b.b4 | (uint64_t)value << 32};
+        num_items++;
+        return;
+      }
+    }
+  }
+
+  // kNotFound if absent
+  uint64_t Find(const Board& b) const {
+    return Probe(b, HashBoard(b));
+  }
+
+  // out[i] = Find(boards[i]); the control lines of a batch are prefetched before any of them is
+  // compared, and then the first candidate slot of each, so that the cache misses overlap
+  void FindBatch(const Board* boards, size_t n, uint64_t* out) const {
+    constexpr size_t kBatch = 16;
+    uint64_t hashes[kBatch];
+    for (size_t base = 0; base < n; base += kBatch) {
+      size_t m = std::min(kBatch, n - base);
+      for (size_t i = 0; i < m; i++) {
+        hashes[i] = HashBoard(boards[base + i]);
+        __builtin_prefetch(&ctrl[hashes[i] & group_mask]);
+      }
+      for (size_t i = 0; i < m; i++) {
+        size_t group = hashes[i] & group_mask;
+        if (uint32_t match = MatchMask(ctrl[group], Fingerprint(hashes[i]))) {
+          __builtin_prefetch(&slots[group * kGroupSize + __builtin_ctz(match)]);
+        }
+      }
+      for (size_t i = 0; i < m; i++) out[base + i] = Probe(boards[base + i], hashes[i]);
+    }
+  }
+};
@@ -1,7 +1,12 @@
 #include "board_set.h"
 
+#include <deque>
+#include <queue>
+#include <mutex>
 #include <fstream>
 #include <algorithm>
+#include <iterator>
+#include <unordered_set>
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Warray-bounds"
@@ -14,8 +19,10 @@
 #include <tsl/hopscotch_map.h>
 
 #include "edge.h"
+#include "edge_fixed.h"
 #include "config.h"
 #include "io_hash.h"
+#include "board_index.h"
 #include "move_search.h"
 #include "thread_queue.h"
 
@@ -27,23 +34,250 @@ void WriteBoardMap(int group) {
   size_t num_boards = BoardCount(BoardPath(group));
   spdlog::info("Start reading boards of group {}", group);
   if (num_boards >= (1ll << 32)) throw std::range_error("Too many boards");
-  std::vector<std::pair<CompactBoard, BasicIOType<uint32_t>>> vec;
-  vec.reserve(num_boards);
-  uint32_t i = 0;
-  ProcessBoards(group, [&i,&vec](Board&& b) {
-    vec.emplace_back(b.ToBytes(), i++);
+  std::vector<CompactBoard> boards;
+  boards.reserve(num_boards);
+  ProcessBoards(group, [&boards](Board&& b) {
+    boards.push_back(b.ToBytes());
   });
-  int pow = 31 - clz<uint32_t>(num_boards);
-  pow = std::max(5, pow - 4); // ~32 boards / bucket
   spdlog::info("Writing board map for group {}", group);
-  WriteHashMap(BoardMapPath(group), std::move(vec), 1 << pow);
+  WritePerfectHashMap(BoardHashPath(group), boards);
+  SortedBoardIndex::WriteSamples(BoardSamplePath(group), BoardPath(group), boards);
+  XorFilter<CompactBoard>::Build(boards).Write(BoardFilterPath(group));
   spdlog::info("Board map writing done");
 }
 
+// the lookup files are derived from the board file, so they are removed when it is rewritten; they are
+// rebuilt by board-map, and Play falls back to the board file until then
+void RemoveBoardLookupFiles(int group) {
+  for (auto& path : {BoardMapPath(group), BoardHashPath(group), BoardSamplePath(group), BoardFilterPath(group)}) {
+    std::filesystem::remove(path);
+    std::filesystem::remove(path.string() + ".index");
+  }
+}
+
+} // namespace
+
+namespace {
+
+// order of the boards in BoardPath: by cell count, then by bytes
+bool BoardOrder(const CompactBoard& a, const CompactBoard& b) {
+  int ca = a.Count(), cb = b.Count();
+  return ca == cb ? a < b : ca < cb;
+}
+
+// in-place MSD radix sort in BoardOrder: the first pass splits by (cell count, first byte), then the
+// buckets are split by the following bytes in parallel and small ones are finished by std::sort
+// besides the boards, only one byte per board (the cached cell count of the first pass) is allocated
+void RadixSortBoards(std::vector<CompactBoard>& boards, int threads) {
+  constexpr size_t kFirstBins = (kBoardBytes * 8 + 1) * 256;
+  constexpr size_t kSmallRange = 64;
+  size_t n = boards.size();
+  if (n < 2) return;
+
+  BS::thread_pool pool(threads);
+  size_t chunks = threads;
+  auto Chunk = [&](size_t c) { return std::make_pair(n * c / chunks, n * (c + 1) / chunks); };
+  // Count() of each board, computed once; it moves along with the boards in the first pass
+  std::vector<uint8_t> counts(n);
+  std::vector<std::vector<size_t>> hist(chunks, std::vector<size_t>(kFirstBins));
+  pool.parallelize_loop(0, chunks, [&](size_t l, size_t r){
+    for (size_t c = l; c < r; c++) {
+      auto [begin, end] = Chunk(c);
+      for (size_t i = begin; i < end; i++) {
+        counts[i] = boards[i].Count();
+        hist[c][counts[i] * 256 + boards[i][0]]++;
+      }
+    }
+  }, chunks).get();
+  std::vector<size_t> head(kFirstBins + 1);
+  std::vector<std::pair<size_t, size_t>> ranges;
+  for (size_t bin = 0; bin < kFirstBins; bin++) {
+    head[bin + 1] = head[bin];
+    for (size_t c = 0; c < chunks; c++) head[bin + 1] += hist[c][bin];
+    if (head[bin + 1] - head[bin] > 1) ranges.push_back({head[bin], head[bin + 1]});
+  }
+  hist.clear();
+  {
+    // american flag sort on the first bin
+    std::vector<size_t> next_pos(head.begin(), head.end() - 1);
+    for (size_t bin = 0; bin < kFirstBins; bin++) {
+      while (next_pos[bin] < head[bin + 1]) {
+        size_t pos = next_pos[bin]++;
+        CompactBoard cur = boards[pos];
+        uint8_t cnt = counts[pos];
+        for (size_t cur_bin = cnt * 256 + cur[0]; cur_bin != bin; cur_bin = cnt * 256 + cur[0]) {
+          size_t to = next_pos[cur_bin]++;
+          std::swap(cur, boards[to]);
+          std::swap(cnt, counts[to]);
+        }
+        boards[pos] = cur;
+        counts[pos] = cnt;
+      }
+    }
+  }
+  counts = std::vector<uint8_t>();
+
+  // one level per byte; ranges are processed in parallel and hold boards equal before the byte
+  for (size_t byte = 1; ranges.size(); byte++) {
+    std::vector<std::pair<size_t, size_t>> next;
+    std::mutex mtx;
+    pool.parallelize_loop(0, ranges.size(), [&](size_t l, size_t r){
+      std::vector<std::pair<size_t, size_t>> local;
+      for (size_t x = l; x < r; x++) {
+        auto [begin, end] = ranges[x];
+        if (end - begin <= kSmallRange) {
+          std::sort(boards.begin() + begin, boards.begin() + end, [byte](const CompactBoard& a, const CompactBoard& b) {
+            return memcmp(a.data() + byte, b.data() + byte, kBoardBytes - byte) < 0;
+          });
+          continue;
+        }
+        // american flag sort on the byte
+        std::array<size_t, 257> head{};
+        for (size_t i = begin; i < end; i++) head[boards[i][byte] + 1]++;
+        head[0] = begin;
+        for (size_t d = 1; d <= 256; d++) head[d] += head[d - 1];
+        std::array<size_t, 256> next_pos;
+        std::copy(head.begin(), head.end() - 1, next_pos.begin());
+        for (size_t d = 0; d < 256; d++) {
+          while (next_pos[d] < head[d + 1]) {
+            CompactBoard cur = boards[next_pos[d]];
+            for (uint8_t digit = cur[byte]; digit != d; digit = cur[byte]) std::swap(cur, boards[next_pos[digit]++]);
+            boards[next_pos[d]++] = cur;
+          }
+        }
+        if (byte + 1 == kBoardBytes) continue;
+        for (size_t d = 0; d < 256; d++) {
+          if (head[d + 1] - head[d] > 1) local.push_back({head[d], head[d + 1]});
+        }
+      }
+      std::lock_guard lck(mtx);
+      next.insert(next.end(), local.begin(), local.end());
+    }, std::min(ranges.size(), (size_t)threads * 64)).get();
+    ranges.swap(next);
+  }
+}
+
+void SortUnique(std::vector<CompactBoard>& boards, int threads) {
+  RadixSortBoards(boards, threads);
+  boards.resize(std::unique(boards.begin(), boards.end()) - boards.begin());
+}
+
+// reads the next boards of the input file with an even cell count
+size_t ReadInputBoards(ClassReader<CompactBoard>& reader, std::vector<CompactBoard>& out, size_t num, bool& eof) {
+  size_t read = 0;
+  while (!eof && out.size() < num) {
+    size_t want = std::min(kBlock, num - out.size());
+    auto chunk = reader.ReadBatch(want);
+    read += chunk.size();
+    for (auto& i : chunk) {
+      if (i.Count() % kCellsMod == 0) out.push_back(i);
+    }
+    if (chunk.size() < want) eof = true;
+  }
+  return read;
+}
+
+// external merge sort: sorted runs are written next to the board files, then merged into the per-group files
+// memory_limit covers the boards held in memory: the kParallel runs being sorted together with the
+// count bytes of the radix sort, and in the merge the decoded batch and the read buffer of every run
+// (the fixed ~1 MiB buffers of the input file and the output files are not counted)
+void SplitBoardsExternal(const std::filesystem::path& fname, size_t memory_limit) {
+  ClassReader<CompactBoard> reader(fname);
+  // RadixSortBoards sorts in place with one extra byte per board
+  size_t run_size = std::max(kBlock, memory_limit / kParallel / (sizeof(CompactBoard) + 1));
+  auto run_dir = BoardPath(0).parent_path();
+  std::vector<std::filesystem::path> runs;
+  BS::thread_pool pool(kParallel);
+  bool eof = false;
+  size_t total = 0;
+  spdlog::info("Start writing sorted runs of {} boards with {} threads", run_size, kParallel);
+  while (!eof) {
+    std::vector<std::vector<CompactBoard>> batch;
+    for (int i = 0; i < kParallel && !eof; i++) {
+      batch.emplace_back();
+      batch.back().reserve(run_size);
+      total += ReadInputBoards(reader, batch.back(), run_size, eof);
+      if (batch.back().empty()) batch.pop_back();
+    }
+    size_t first_run = runs.size();
+    for (size_t i = 0; i < batch.size(); i++) {
+      runs.push_back(run_dir / ("split-run." + std::to_string(runs.size())));
+    }
+    pool.parallelize_loop(0, batch.size(), [&](size_t l, size_t r){
+      for (size_t i = l; i < r; i++) {
+        SortUnique(batch[i], 1);
+        ClassWriter<CompactBoard> writer(runs[first_run + i]);
+        writer.Write(batch[i]);
+      }
+    }, batch.size()).get();
+    spdlog::info("{} boards read, {} runs written", total, runs.size());
+  }
+
+  spdlog::info("Merging {} runs", runs.size());
+  // per run: the decoded batch, the next batch while it is read, and the read buffer
+  size_t merge_batch = std::clamp(
+      memory_limit / std::max((size_t)1, runs.size()) / (2 * sizeof(CompactBoard) + kBoardBytes),
+      (size_t)1024, kBlock);
+  struct Run {
+    ClassReader<CompactBoard> reader;
+    std::vector<CompactBoard> buf;
+    size_t pos = 0;
+    Run(const std::filesystem::path& path, size_t batch) :
+        reader(path), buf(reader.ReadBatch(batch, batch * kBoardBytes)) {}
+    const CompactBoard& Top() const { return buf[pos]; }
+    // false if the run is exhausted
+    bool Next(size_t batch) {
+      if (++pos < buf.size()) return true;
+      buf = reader.ReadBatch(batch, batch * kBoardBytes);
+      pos = 0;
+      return buf.size();
+    }
+  };
+  std::deque<Run> readers;
+  for (auto& path : runs) readers.emplace_back(path, merge_batch);
+  auto Greater = [&](size_t a, size_t b) {
+    return BoardOrder(readers[b].Top(), readers[a].Top());
+  };
+  std::priority_queue<size_t, std::vector<size_t>, decltype(Greater)> heap(Greater);
+  for (size_t i = 0; i < readers.size(); i++) {
+    if (readers[i].buf.size()) heap.push(i);
+  }
+  std::vector<std::unique_ptr<ClassWriter<CompactBoard>>> writers;
+  for (int group = 0; group < kGroups; group++) {
+    RemoveBoardLookupFiles(group);
+    writers.push_back(std::make_unique<ClassWriter<CompactBoard>>(BoardPath(group)));
+  }
+  std::array<size_t, kGroups> counts{};
+  std::optional<CompactBoard> last;
+  while (heap.size()) {
+    size_t idx = heap.top();
+    heap.pop();
+    const CompactBoard& board = readers[idx].Top();
+    if (!last || !(*last == board)) {
+      int group = GetGroupByCells(board.Count());
+      writers[group]->Write(board);
+      counts[group]++;
+      last = board;
+    }
+    if (readers[idx].Next(merge_batch)) heap.push(idx);
+  }
+  writers.clear();
+  readers.clear();
+  for (auto& path : runs) std::filesystem::remove(path);
+  for (int group = 0; group < kGroups; group++) {
+    spdlog::info("Group {} written with {} boards", group, counts[group]);
+  }
+}
+
 } // namespace
 
-void SplitBoards(const std::filesystem::path& fname) {
+void SplitBoards(const std::filesystem::path& fname, size_t memory_limit) {
   spdlog::info("Start preprocessing");
+  if (memory_limit) {
+    SplitBoardsExternal(fname, memory_limit);
+    spdlog::info("Done preprocessing");
+    return;
+  }
   std::array<std::vector<CompactBoard>, kGroups> boards;
   ClassReader<CompactBoard> reader(fname);
   size_t num_boards = 0;
@@ -62,19 +296,13 @@ void SplitBoards(const std::filesystem::path& fname) {
     }
     if (chunk.size() < kBlock) break;
   }
-  int threads = std::min(kParallel, kGroups);
-  spdlog::info("Finish reading board file, sorting with {} threads", threads);
-  BS::thread_pool pool(threads);
-  pool.parallelize_loop(0, kGroups, [&](int l, int r){
-    for (int i = l; i < r; i++) {
-      std::sort(boards[i].begin(), boards[i].end(), [](const CompactBoard& a, const CompactBoard& b){
-        return a.Count() == b.Count() ? a < b : a.Count() < b.Count();
-      });
-    }
-  }).wait();
+  spdlog::info("Finish reading board file, sorting with {} threads", kParallel);
+  // groups are sorted one after another, since each sort uses all --parallel threads
+  for (auto& i : boards) SortUnique(i, kParallel);
   spdlog::info("Sorting finished");
   for (int group = 0; group < kGroups; group++) {
     spdlog::info("Writing group {} with {} boards", group, boards[group].size());
+    RemoveBoardLookupFiles(group);
     ClassWriter<CompactBoard> writer(BoardPath(group));
     writer.Write(boards[group]);
   }
@@ -85,10 +313,12 @@ BoardMap GetBoardMap(int group) {
   auto fname = BoardPath(group);
   size_t num_boards = BoardCount(fname);
 
+  if (num_boards >= (1ll << 32)) throw std::range_error("Too many boards");
+
   BoardMap ret;
   ret.reserve(num_boards);
-  size_t i = 0;
-  ProcessBoards(group, [&](Board&& b) { ret[b] = i++; });
+  uint32_t i = 0;
+  ProcessBoards(group, [&](Board&& b) { ret.Insert(b, i++); });
   return ret;
 }
 
@@ -120,75 +350,148 @@ struct EdgeStats {
     return fmt::format("next {}, non_adj {}, adj_orig {}, adj {}, adj_ed {}, adj_ed_fin {}, subset {}",
         next.load(), non_adj.load(), adj_orig.load(), adj.load(), adj_ed.load(), adj_ed_fin.load(), subset.load());
   }
-} edge_stats[4];
+};
+// stats of one group
+using GroupEdgeStats = std::array<EdgeStats, kLevels>;
+
+// per-thread scratch space of edge building; every buffer is cleared but keeps its capacity between
+// uses, so that building edges does not allocate once the buffers have grown
+struct EdgeScratch {
+  static constexpr size_t kPositions = 4 * 20 * 10;
+  static constexpr size_t PositionIndex(const Position& pos) { return pos.r * 200 + pos.x * 10 + pos.y; }
+
+  // pos_idx[PositionIndex(pos)] is valid if pos_stamp of it equals stamp
+  std::array<uint32_t, kPositions> pos_stamp{};
+  std::array<uint8_t, kPositions> pos_idx{};
+  uint32_t stamp = 0;
+
+  std::vector<Position> positions;
+  std::vector<Board> boards;
+  std::vector<uint8_t> lines;
+  std::vector<uint64_t> ids;
+  std::vector<std::pair<std::pair<uint64_t, uint8_t>, Position>> nexts;
+  std::vector<Position> pos_adj;
+  std::vector<uint8_t> adj_ids;
+  EvaluateNodeEdges eval_ed;
+  PositionNodeEdges pos_ed;
+  EvaluateNodeEdges::Workspace eval_ws;
+  // inner vectors of pos_ed.adj not in use
+  std::vector<std::vector<Position>> spare_pos;
+  std::array<std::vector<std::array<PossibleMoves, kPieces>>, kLevels> search_results;
+
+  void NewStamp() {
+    if (++stamp == 0) {
+      pos_stamp.fill(0);
+      stamp = 1;
+    }
+  }
+  bool Marked(const Position& pos) const { return pos_stamp[PositionIndex(pos)] == stamp; }
+  void Mark(const Position& pos, uint8_t idx = 0) {
+    pos_stamp[PositionIndex(pos)] = stamp;
+    pos_idx[PositionIndex(pos)] = idx;
+  }
+  uint8_t Index(const Position& pos) const { return pos_idx[PositionIndex(pos)]; }
 
-inline std::pair<EvaluateNodeEdges, PositionNodeEdges> GetEdges(
-    const Board& b, int piece, const PossibleMoves& moves, const BoardMap& mp, int level) {
-  constexpr uint64_t kNone = std::numeric_limits<uint64_t>::max();
-  // use position as key; note that multiple positions may lead to same board
-  tsl::hopscotch_map<Position, std::pair<uint64_t, uint8_t>> mp_next;
-  mp_next.reserve(48);
-  for (auto& pos : moves.non_adj) mp_next[pos] = {kNone, 0};
+  // clear a vector of vectors, keeping the inner vectors in spare
+  template <class T> static void Recycle(std::vector<std::vector<T>>& v, std::vector<std::vector<T>>& spare) {
+    for (auto& i : v) {
+      if (i.capacity()) spare.push_back(std::move(i));
+    }
+    v.clear();
+  }
+  // append an empty inner vector, taken from spare if possible
+  template <class T> static std::vector<T>& EmplaceBack(std::vector<std::vector<T>>& v, std::vector<std::vector<T>>& spare) {
+    if (spare.empty()) return v.emplace_back();
+    auto& ret = v.emplace_back(std::move(spare.back()));
+    spare.pop_back();
+    ret.clear();
+    return ret;
+  }
+};
+
+thread_local EdgeScratch edge_scratch;
+
+// fills scratch.eval_ed and scratch.pos_ed
+void GetEdges(const Board& b, int piece, const PossibleMoves& moves, const BoardMap& mp, EdgeStats& stats,
+              EdgeScratch& scratch) {
+  auto& eval_ed = scratch.eval_ed;
+  auto& pos_ed = scratch.pos_ed;
+  eval_ed.cell_count = b.Count();
+  eval_ed.use_subset = false;
+  eval_ed.next_ids.clear();
+  eval_ed.non_adj.clear();
+  EdgeScratch::Recycle(eval_ed.adj, scratch.eval_ws.spare);
+  eval_ed.adj_subset.clear();
+  eval_ed.subset_idx_prev.clear();
+  pos_ed.nexts.clear();
+  EdgeScratch::Recycle(pos_ed.adj, scratch.spare_pos);
+
+  // distinct positions; note that multiple positions may lead to same board
+  scratch.NewStamp();
+  scratch.positions.clear();
+  auto AddPosition = [&](const Position& pos) {
+    if (scratch.Marked(pos)) return;
+    scratch.Mark(pos);
+    scratch.positions.push_back(pos);
+  };
+  for (auto& pos : moves.non_adj) AddPosition(pos);
   for (auto& adj : moves.adj) {
-    for (auto& pos : adj.second) mp_next[pos] = {kNone, 0};
+    for (auto& pos : adj.second) AddPosition(pos);
+  }
+  // look up all resulting boards in one batch so that the cache misses overlap
+  scratch.boards.clear();
+  scratch.lines.clear();
+  for (auto& pos : scratch.positions) {
+    auto n_board = b.Place(piece, pos.r, pos.x, pos.y).ClearLines();
+    scratch.boards.push_back(n_board.second);
+    scratch.lines.push_back(n_board.first);
   }
-  for (auto item = mp_next.begin(); item != mp_next.end();) {
-    auto n_board = b.Place(piece, item->first.r, item->first.x, item->first.y).ClearLines();
+  scratch.ids.resize(scratch.boards.size());
+  mp.FindBatch(scratch.boards.data(), scratch.boards.size(), scratch.ids.data());
+  { // nexts; sorted by board ID for delta encoding and better gather locality
+    auto& nexts = scratch.nexts;
+    nexts.clear();
+    for (size_t i = 0; i < scratch.positions.size(); i++) {
 #ifdef TETRIS_ONLY
-    if (n_board.first && n_board.first != 4) {
-      item = mp_next.erase(item); // only tetrises are allowed
-    } else // ... if
+      if (scratch.lines[i] && scratch.lines[i] != 4) continue; // only tetrises are allowed
 #endif
-    if (auto board_it = mp.find(n_board.second); board_it != mp.end()) {
-      item.value() = {board_it->second, n_board.first};
-      ++item;
-    } else {
-      item = mp_next.erase(item);
+      if (scratch.ids[i] == BoardMap::kNotFound) continue;
+      nexts.push_back({{scratch.ids[i], scratch.lines[i]}, scratch.positions[i]});
     }
-  }
-  tsl::hopscotch_map<Position, uint8_t> mp_idx;
-  EvaluateNodeEdges eval_ed;
-  PositionNodeEdges pos_ed;
-  eval_ed.cell_count = b.Count();
-  { // nexts
+    std::sort(nexts.begin(), nexts.end());
+    scratch.NewStamp();
     uint8_t idx = 0;
-    mp_idx.reserve(mp_next.size());
-    eval_ed.next_ids.reserve(mp_next.size());
-    pos_ed.nexts.reserve(mp_next.size());
-    for (auto& item : mp_next) {
-      eval_ed.next_ids.push_back(item.second);
-      pos_ed.nexts.push_back(item.first);
-      mp_idx[item.first] = idx++;
+    for (auto& [next, pos] : nexts) {
+      eval_ed.next_ids.push_back(next);
+      pos_ed.nexts.push_back(pos);
+      scratch.Mark(pos, idx++);
     }
   }
   // non-adjs
   for (const auto& pos : moves.non_adj) {
-    if (auto it = mp_idx.find(pos); it != mp_idx.end()) {
-      eval_ed.non_adj.push_back(it->second);
-    }
+    if (scratch.Marked(pos)) eval_ed.non_adj.push_back(scratch.Index(pos));
   }
   // adjs
   size_t adj_eds = 0;
-  auto& stats = edge_stats[level];
   {
-    std::vector<Position> pos_adj;
+    auto& pos_adj = scratch.pos_adj;
+    pos_adj.clear();
+    auto& ids = scratch.adj_ids;
     for (const auto& adj : moves.adj) {
-      std::vector<uint8_t> ids;
+      ids.clear();
       for (const auto& pos : adj.second) {
-        if (auto it = mp_idx.find(pos); it != mp_idx.end()) {
-          ids.push_back(it->second);
-        }
+        if (scratch.Marked(pos)) ids.push_back(scratch.Index(pos));
       }
       if (ids.empty()) continue;
-      eval_ed.adj.push_back(std::move(ids));
+      EdgeScratch::EmplaceBack(eval_ed.adj, scratch.eval_ws.spare).assign(ids.begin(), ids.end());
       pos_adj.push_back(adj.first);
-      ids.clear();
     }
     stats.adj_orig += eval_ed.adj.size();
-    const auto adj_mp = eval_ed.ReduceAdj();
-    for (const auto& i : adj_mp) {
-      pos_ed.adj.emplace_back();
-      for (const auto& j : i) pos_ed.adj.back().push_back(pos_adj[j]);
+    auto& ws = scratch.eval_ws;
+    eval_ed.ReduceAdj(ws);
+    for (size_t i = 0; i + 1 < ws.group_begin.size(); i++) {
+      auto& lst = EdgeScratch::EmplaceBack(pos_ed.adj, scratch.spare_pos);
+      for (size_t j = ws.group_begin[i]; j < ws.group_begin[i + 1]; j++) lst.push_back(pos_adj[ws.group_members[j]]);
     }
     for (auto& i : eval_ed.adj) adj_eds += i.size();
   }
@@ -198,110 +501,463 @@ inline std::pair<EvaluateNodeEdges, PositionNodeEdges> GetEdges(
   stats.adj += eval_ed.adj.size();
   stats.adj_ed += adj_eds;
   // subset optim
-  eval_ed.CalculateSubset();
+  eval_ed.CalculateSubset(scratch.eval_ws);
   if (adj_eds >= 1.5 * eval_ed.subset_idx_prev.size()) {
-    eval_ed.adj.clear();
+    EdgeScratch::Recycle(eval_ed.adj, scratch.eval_ws.spare);
     eval_ed.use_subset = true;
     stats.subset += eval_ed.subset_idx_prev.size();
   } else {
     stats.adj_ed_fin += adj_eds;
   }
-  return {eval_ed, pos_ed};
 }
 
-using EdgeChunk = std::pair<std::array<std::vector<std::vector<uint8_t>>, kLevels>,
-                            std::array<std::vector<std::vector<uint8_t>>, kLevels>>;
+// append an item to buf in the file format, as CompressedClassWriter::Write would
+template <class T> void AppendRecord(std::vector<uint8_t>& buf, const T& item) {
+  size_t sz = item.NumBytes();
+  if (SizeRangeOverflow<T::kSizeNumberBytes>(sz)) throw std::out_of_range("output size too large");
+  io_internal::WriteToBuf(buf, item, sz);
+}
+
+// edges of a block of boards; the records of each level are serialized in the file format, to be
+// written with WriteSerialized
+struct EdgeChunk {
+  std::array<std::vector<uint8_t>, kLevels> eval, pos;
+  size_t num_boards = 0;
+};
+
+// results[i][piece] = moves of the piece on boards[i]
+template <Level level, int piece>
+void SearchPiece(const std::vector<Board>& boards, std::vector<std::array<PossibleMoves, kPieces>>& results) {
+  constexpr int R = Board::NumRotations(piece);
+  constexpr size_t kBatch = 16;
+  std::array<Board, R> maps[kBatch];
+  PossibleMoves out[kBatch];
+  for (size_t base = 0; base < boards.size(); base += kBatch) {
+    size_t n = std::min(kBatch, boards.size() - base);
+    for (size_t i = 0; i < n; i++) maps[i] = boards[base + i].PieceMap<piece>();
+    MoveSearchBatch<level, R, ADJ_DELAY, TAP_SPEED>(maps, n, out);
+    for (size_t i = 0; i < n; i++) results[base + i][piece] = std::move(out[i]);
+  }
+}
 
-EdgeChunk BuildEdgeChunk(const std::vector<Board>& boards, const BoardMap& mp) {
+EdgeChunk BuildEdgeChunk(const std::vector<Board>& boards, const BoardMap& mp, GroupEdgeStats& stats) {
+  auto& scratch = edge_scratch;
   EdgeChunk ret;
-  auto& [eval_eds, pos_eds] = ret;
-  std::array<std::vector<std::array<PossibleMoves, kPieces>>, kLevels> search_results;
+  ret.num_boards = boards.size();
+  auto& search_results = scratch.search_results;
   for (int i = 0; i < kLevels; i++) search_results[i].resize(boards.size());
   For<kLevels>([&](auto level_obj) {
-    constexpr int level_val = level_obj.value;
     constexpr Level level = static_cast<Level>(level_obj.value);
-    for (size_t i = 0; i < boards.size(); i++) {
-      search_results[level_val][i][0] = MoveSearch<level, 4, ADJ_DELAY, TAP_SPEED>(boards[i].TMap());
-      search_results[level_val][i][1] = MoveSearch<level, 4, ADJ_DELAY, TAP_SPEED>(boards[i].JMap());
-      search_results[level_val][i][5] = MoveSearch<level, 4, ADJ_DELAY, TAP_SPEED>(boards[i].LMap());
-    }
-    for (size_t i = 0; i < boards.size(); i++) {
-      search_results[level_val][i][2] = MoveSearch<level, 2, ADJ_DELAY, TAP_SPEED>(boards[i].ZMap());
-      search_results[level_val][i][4] = MoveSearch<level, 2, ADJ_DELAY, TAP_SPEED>(boards[i].SMap());
-      search_results[level_val][i][6] = MoveSearch<level, 2, ADJ_DELAY, TAP_SPEED>(boards[i].IMap());
-    }
-    for (size_t i = 0; i < boards.size(); i++) {
-      search_results[level_val][i][3] = MoveSearch<level, 1, ADJ_DELAY, TAP_SPEED>(boards[i].OMap());
-    }
+    auto& results = search_results[level_obj.value];
+    // grouped by rotation count, as the pieces of each group share a search table
+    SearchPiece<level, 0>(boards, results);
+    SearchPiece<level, 1>(boards, results);
+    SearchPiece<level, 5>(boards, results);
+    SearchPiece<level, 2>(boards, results);
+    SearchPiece<level, 4>(boards, results);
+    SearchPiece<level, 6>(boards, results);
+    SearchPiece<level, 3>(boards, results);
   });
   for (int level = 0; level < kLevels; level++) {
-    auto& cur_eval = eval_eds[level];
-    auto& cur_pos = pos_eds[level];
     auto& cur_moves = search_results[level];
-    cur_eval.reserve(boards.size() * kPieces);
-    cur_pos.reserve(boards.size() * kPieces);
     for (size_t i = 0; i < boards.size(); i++) {
       for (size_t j = 0; j < kPieces; j++) {
-        auto [eval_ed, pos_ed] = GetEdges(boards[i], j, cur_moves[i][j], mp, level);
-        cur_eval.push_back(Serialize(eval_ed));
-        cur_pos.push_back(Serialize(pos_ed));
+        GetEdges(boards[i], j, cur_moves[i][j], mp, stats[level], scratch);
+        AppendRecord(ret.eval[level], scratch.eval_ed);
+        AppendRecord(ret.pos[level], scratch.pos_ed);
       }
     }
   }
   return ret;
 }
 
-void BuildEdges(int group) {
-  spdlog::info("Start building edges for group {}", group);
-  int nxt_group = NextGroup(group);
-  spdlog::info("Loading board map for group {}", nxt_group);
-  BoardMap mp = GetBoardMap(nxt_group);
-  spdlog::info("Board map loaded with {} boards", mp.size());
+// a fixed edge file would no longer match rebuilt edges
+void RemoveFixedEdges(int group, int level) {
+  std::filesystem::remove(EvaluateEdgeFixedPath(group, level));
+  std::filesystem::remove(EvaluateEdgeFixedPath(group, level).string() + ".index");
+}
 
+// threads: worker threads building the edges; compress_pool may be shared with other groups
+void BuildEdges(int group, const BoardMap& mp, size_t threads, BS::thread_pool& compress_pool) {
   std::vector<CompressedClassWriter<EvaluateNodeEdges>> eval_writers;
   std::vector<CompressedClassWriter<PositionNodeEdges>> pos_writers;
   for (int level = 0; level < kLevels; level++) {
-    eval_writers.emplace_back(EvaluateEdgePath(group, level), 512 * kPieces);
-    pos_writers.emplace_back(PositionEdgePath(group, level), 512 * kPieces);
+    RemoveFixedEdges(group, level);
+    eval_writers.emplace_back(EvaluateEdgePath(group, level), 512 * kPieces,
+                              std::make_unique<ParallelZstdCompressor>(compress_pool));
+    pos_writers.emplace_back(PositionEdgePath(group, level), 512 * kPieces,
+                             std::make_unique<ParallelZstdCompressor>(compress_pool));
   }
 
-  spdlog::info("Start building edges");
-  for (int i = 0; i < kLevels; i++) edge_stats[i].Clear();
-  auto PrintStats = [](size_t n_boards, int level, spdlog::level::level_enum log_level) {
-    spdlog::log(log_level, "{} boards processed, level {}: {}",
-        n_boards, level, edge_stats[level].ToText());
+  spdlog::info("Start building edges for group {}", group);
+  GroupEdgeStats stats;
+  for (auto& i : stats) i.Clear();
+  auto PrintStats = [&](size_t n_boards, int level, spdlog::level::level_enum log_level) {
+    spdlog::log(log_level, "Group {}: {} boards processed, level {}: {}",
+        group, n_boards, level, stats[level].ToText());
   };
   size_t n_boards = 0;
-  auto thread_queue = MakeThreadQueue<EdgeChunk>(kParallel, [&](EdgeChunk&& chunk) {
+  auto thread_queue = MakeThreadQueue<EdgeChunk>(threads, [&](EdgeChunk&& chunk) {
     constexpr size_t kOutput = 131072;
-    size_t sz = chunk.first[0].size() / kPieces;
+    size_t sz = chunk.num_boards;
     bool output = n_boards / kOutput != (n_boards + sz) / kOutput;
     n_boards += sz;
     for (int level = 0; level < kLevels; level++) {
       if (output) PrintStats(n_boards, level, spdlog::level::debug);
-      eval_writers[level].WriteRaw(chunk.first[level]);
-      pos_writers[level].WriteRaw(chunk.second[level]);
+      eval_writers[level].WriteSerialized(chunk.eval[level].data(), chunk.eval[level].size());
+      pos_writers[level].WriteSerialized(chunk.pos[level].data(), chunk.pos[level].size());
     }
   });
   std::vector<Board> block;
   block.reserve(1024);
+  auto PushBlock = [&]() {
+    thread_queue.Push([block=std::move(block),&mp,&stats]() {
+      return BuildEdgeChunk(std::cref(block), std::cref(mp), stats);
+    });
+    block.clear(); // recover from move
+  };
   ProcessBoards(group, [&](Board&& b) {
     block.push_back(std::move(b));
-    if (block.size() == 1024) {
-      thread_queue.Push([block=std::move(block),&mp]() { return BuildEdgeChunk(std::cref(block), std::cref(mp)); });
-      block.clear(); // recover from move
-    }
+    if (block.size() == 1024) PushBlock();
   });
-  thread_queue.Push([block=std::move(block),&mp]() { return BuildEdgeChunk(std::cref(block), std::cref(mp)); });
+  PushBlock();
   thread_queue.WaitAll();
   for (int level = 0; level < kLevels; level++) PrintStats(n_boards, level, spdlog::level::info);
 }
 
+// boards added to one group by AddBoards
+struct GroupDelta {
+  // for each added board in board order, the number of previous boards ordered before it
+  std::vector<uint64_t> inserted;
+  std::vector<CompactBoard> boards;
+
+  uint64_t NewId(uint64_t old_id) const {
+    return old_id + (std::upper_bound(inserted.begin(), inserted.end(), old_id) - inserted.begin());
+  }
+  uint64_t AddedId(size_t i) const { return inserted[i] + i; }
+};
+
+// BoardRemapPath holds one u64 per board added since the file was created, sorted: the number of boards
+// of the original set (before the first of these add-boards runs) ordered before it; an original
+// board with id x now has the id x + (number of entries <= x), like GroupDelta::NewId
+std::vector<uint64_t> ReadRemap(int group) {
+  std::vector<uint64_t> ret;
+  if (!std::filesystem::exists(BoardRemapPath(group))) return ret;
+  ClassReader<BasicIOType<uint64_t>> reader(BoardRemapPath(group));
+  while (true) {
+    auto batch = reader.ReadBatch(kBlock);
+    ret.insert(ret.end(), batch.begin(), batch.end());
+    if (batch.size() < kBlock) break;
+  }
+  return ret;
+}
+
+// remap entries of the original set after a run that inserted boards at `inserted` (GroupDelta::inserted)
+// into the set described by `earlier`
+std::vector<uint64_t> ComposeRemap(const std::vector<uint64_t>& earlier, const std::vector<uint64_t>& inserted) {
+  std::vector<uint64_t> rebased, ret;
+  rebased.reserve(inserted.size());
+  size_t j = 0; // boards of earlier runs ordered before the current inserted board
+  for (uint64_t q : inserted) {
+    while (j < earlier.size() && earlier[j] + j < q) j++;
+    rebased.push_back(q - j);
+  }
+  ret.reserve(earlier.size() + rebased.size());
+  std::merge(earlier.begin(), earlier.end(), rebased.begin(), rebased.end(), std::back_inserter(ret));
+  return ret;
+}
+
+// merge the sorted new boards into the board file of the group; boards already present are dropped
+GroupDelta MergeNewBoards(int group, const std::vector<CompactBoard>& add) {
+  GroupDelta ret;
+  auto path = BoardPath(group);
+  std::filesystem::path tmp_path = path.string() + ".new";
+  {
+    ClassReader<CompactBoard> reader(path);
+    ClassWriter<CompactBoard> writer(tmp_path);
+    uint64_t old_id = 0;
+    size_t j = 0;
+    while (true) {
+      auto chunk = reader.ReadBatch(kBlock);
+      for (auto& board : chunk) {
+        for (; j < add.size() && BoardOrder(add[j], board); j++) {
+          writer.Write(add[j]);
+          ret.inserted.push_back(old_id);
+          ret.boards.push_back(add[j]);
+        }
+        if (j < add.size() && add[j] == board) j++;
+        writer.Write(board);
+        old_id++;
+      }
+      if (chunk.size() < kBlock) break;
+    }
+    for (; j < add.size(); j++) {
+      writer.Write(add[j]);
+      ret.inserted.push_back(old_id);
+      ret.boards.push_back(add[j]);
+    }
+  }
+  std::filesystem::rename(tmp_path, path);
+  return ret;
+}
+
+// new ids of the existing boards of the group that have an added board of the next group as a possible successor
+std::vector<uint64_t> FindAffectedBoards(int group, const GroupDelta& nxt_delta) {
+  if (nxt_delta.boards.empty()) return {};
+  spdlog::info("Loading board map for group {}", group);
+  BoardMap mp = GetBoardMap(group);
+  std::vector<uint64_t> ret;
+  std::mutex mtx;
+  BS::thread_pool pool(kParallel);
+  pool.parallelize_loop(0, nxt_delta.boards.size(), [&](size_t l, size_t r){
+    std::vector<uint64_t> local;
+    std::vector<Board> prevs;
+    std::vector<uint64_t> ids;
+    for (size_t i = l; i < r; i++) {
+      prevs.clear();
+      ForEachPredecessor(Board(nxt_delta.boards[i]), [&](const Board& prev) { prevs.push_back(prev); });
+      ids.resize(prevs.size());
+      mp.FindBatch(prevs.data(), prevs.size(), ids.data());
+      for (auto id : ids) {
+        if (id != BoardMap::kNotFound) local.push_back(id);
+      }
+    }
+    std::lock_guard lck(mtx);
+    ret.insert(ret.end(), local.begin(), local.end());
+  }, std::min(nxt_delta.boards.size(), (size_t)kParallel * 16)).get();
+  std::sort(ret.begin(), ret.end());
+  ret.resize(std::unique(ret.begin(), ret.end()) - ret.begin());
+  return ret;
+}
+
+// replace a compressed file by the one written at tmp_path
+void ReplaceCompressedFile(const std::filesystem::path& tmp_path, const std::filesystem::path& path) {
+  std::filesystem::remove(path.string() + ".dict");
+  std::filesystem::rename(tmp_path, path);
+  std::filesystem::rename(tmp_path.string() + ".index", path.string() + ".index");
+}
+
+struct DeltaBlock {
+  std::vector<Board> boards;
+  std::vector<uint8_t> rebuild;
+  // records of the boards that are kept, indexed by kept board * kPieces + piece
+  std::array<std::vector<EvaluateNodeEdges>, kLevels> eval;
+  std::array<std::vector<PositionNodeEdges>, kLevels> pos;
+};
+
+EdgeChunk UpdateEdgeChunk(const DeltaBlock& block, const BoardMap& mp, const GroupDelta& nxt_delta,
+                          GroupEdgeStats& stats) {
+  std::vector<Board> to_build;
+  for (size_t i = 0; i < block.boards.size(); i++) {
+    if (block.rebuild[i]) to_build.push_back(block.boards[i]);
+  }
+  EdgeChunk built = BuildEdgeChunk(to_build, mp, stats);
+  // copies the records of one board from a serialized buffer
+  auto CopyRecords = []<class T>(std::vector<uint8_t>& out, const std::vector<uint8_t>& buf, size_t& offset) {
+    size_t start = offset;
+    for (size_t piece = 0; piece < kPieces; piece++) {
+      auto [sz, sz_bytes] = io_internal::GetNextSize<T>(buf.data() + offset);
+      offset += sz_bytes + sz;
+    }
+    out.insert(out.end(), buf.begin() + start, buf.begin() + offset);
+  };
+  EdgeChunk ret;
+  ret.num_boards = block.boards.size();
+  for (int level = 0; level < kLevels; level++) {
+    size_t eval_offset = 0, pos_offset = 0;
+    for (size_t i = 0, kept_idx = 0; i < block.boards.size(); i++) {
+      if (block.rebuild[i]) {
+        CopyRecords.operator()<EvaluateNodeEdges>(ret.eval[level], built.eval[level], eval_offset);
+        CopyRecords.operator()<PositionNodeEdges>(ret.pos[level], built.pos[level], pos_offset);
+        continue;
+      }
+      for (size_t piece = 0; piece < kPieces; piece++) {
+        // the order of the next boards is kept since the renumbering is monotonic
+        EvaluateNodeEdges eval_ed = block.eval[level][kept_idx * kPieces + piece];
+        for (auto& next : eval_ed.next_ids) next.first = nxt_delta.NewId(next.first);
+        AppendRecord(ret.eval[level], eval_ed);
+        AppendRecord(ret.pos[level], block.pos[level][kept_idx * kPieces + piece]);
+      }
+      kept_idx++;
+    }
+  }
+  return ret;
+}
+
+// rewrite the edges of the group: edges of added and affected boards are built, others are renumbered
+void UpdateEdges(int group, const GroupDelta& delta, const GroupDelta& nxt_delta) {
+  std::vector<uint64_t> rebuild = FindAffectedBoards(group, nxt_delta);
+  size_t num_affected = rebuild.size();
+  for (size_t i = 0; i < delta.boards.size(); i++) rebuild.push_back(delta.AddedId(i));
+  std::sort(rebuild.begin(), rebuild.end());
+  rebuild.resize(std::unique(rebuild.begin(), rebuild.end()) - rebuild.begin());
+  spdlog::info("Updating edges of group {}: building {} boards ({} added, {} affected)",
+               group, rebuild.size(), delta.boards.size(), num_affected);
+
+  int nxt_group = NextGroup(group);
+  spdlog::info("Loading board map for group {}", nxt_group);
+  BoardMap mp = GetBoardMap(nxt_group);
+
+  BS::thread_pool compress_pool(kParallel);
+  std::vector<CompressedClassReader<EvaluateNodeEdges>> eval_readers;
+  std::vector<CompressedClassReader<PositionNodeEdges>> pos_readers;
+  std::vector<CompressedClassWriter<EvaluateNodeEdges>> eval_writers;
+  std::vector<CompressedClassWriter<PositionNodeEdges>> pos_writers;
+  auto TmpPath = [](const std::filesystem::path& path) { return path.string() + ".new"; };
+  for (int level = 0; level < kLevels; level++) {
+    eval_readers.emplace_back(EvaluateEdgePath(group, level));
+    pos_readers.emplace_back(PositionEdgePath(group, level));
+    eval_writers.emplace_back(TmpPath(EvaluateEdgePath(group, level)), 512 * kPieces,
+                              std::make_unique<ParallelZstdCompressor>(compress_pool));
+    pos_writers.emplace_back(TmpPath(PositionEdgePath(group, level)), 512 * kPieces,
+                             std::make_unique<ParallelZstdCompressor>(compress_pool));
+  }
+  GroupEdgeStats stats;
+  for (auto& i : stats) i.Clear();
+  {
+    auto thread_queue = MakeThreadQueue<EdgeChunk>(kParallel, [&](EdgeChunk&& chunk) {
+      for (int level = 0; level < kLevels; level++) {
+        eval_writers[level].WriteSerialized(chunk.eval[level].data(), chunk.eval[level].size());
+        pos_writers[level].WriteSerialized(chunk.pos[level].data(), chunk.pos[level].size());
+      }
+    });
+    DeltaBlock block;
+    auto PushBlock = [&]() {
+      thread_queue.Push([block=std::move(block),&mp,&nxt_delta,&stats]() {
+        return UpdateEdgeChunk(std::cref(block), std::cref(mp), std::cref(nxt_delta), stats);
+      });
+      block = DeltaBlock();
+    };
+    uint64_t id = 0;
+    size_t rebuild_idx = 0, added_idx = 0;
+    ProcessBoards(group, [&](Board&& b) {
+      bool added = added_idx < delta.boards.size() && delta.AddedId(added_idx) == id;
+      if (added) added_idx++;
+      bool build = rebuild_idx < rebuild.size() && rebuild[rebuild_idx] == id;
+      if (build) rebuild_idx++;
+      if (!added) {
+        for (int level = 0; level < kLevels; level++) {
+          auto eval = eval_readers[level].ReadBatch(kPieces);
+          auto pos = pos_readers[level].ReadBatch(kPieces);
+          if (eval.size() != kPieces || pos.size() != kPieces) throw std::runtime_error("edge file too short");
+          if (build) continue;
+          block.eval[level].insert(block.eval[level].end(), eval.begin(), eval.end());
+          block.pos[level].insert(block.pos[level].end(), pos.begin(), pos.end());
+        }
+      }
+      block.boards.push_back(std::move(b));
+      block.rebuild.push_back(build);
+      if (block.boards.size() == 1024) PushBlock();
+      id++;
+    });
+    PushBlock();
+    thread_queue.WaitAll();
+  }
+  eval_writers.clear();
+  pos_writers.clear();
+  for (int level = 0; level < kLevels; level++) {
+    ReplaceCompressedFile(TmpPath(EvaluateEdgePath(group, level)), EvaluateEdgePath(group, level));
+    ReplaceCompressedFile(TmpPath(PositionEdgePath(group, level)), PositionEdgePath(group, level));
+    RemoveFixedEdges(group, level);
+    spdlog::info("Level {}: {}", level, stats[level].ToText());
+  }
+}
+
 } // namespace
 
-void BuildEdges(const std::vector<int>& groups) {
-  std::array<BoardMap, kGroups> maps;
-  for (int i : groups) BuildEdges(i);
+void BuildEdges(const std::vector<int>& groups, int concurrent_groups) {
+  for (int i : groups) {
+    if (i < 0 || i >= kGroups) throw std::out_of_range("invalid group");
+  }
+  size_t concurrent = std::max(1, std::min(concurrent_groups, (int)groups.size()));
+  size_t threads = std::max(1, kParallel / (int)concurrent);
+  // shared by the writers of all groups; declared before the group pool so that it outlives them
+  BS::thread_pool compress_pool(kParallel);
+  // the map of each next group is loaded once, by the task building the group that reads it, so the
+  // serial loads of different groups overlap with each other and with edge building
+  BS::thread_pool group_pool(concurrent);
+  std::vector<std::future<void>> tasks;
+  for (int group : groups) {
+    tasks.push_back(group_pool.submit([group,threads,&compress_pool]() {
+      int nxt_group = NextGroup(group);
+      spdlog::info("Loading board map for group {}", nxt_group);
+      const BoardMap mp = GetBoardMap(nxt_group);
+      spdlog::info("Board map of group {} loaded with {} boards", nxt_group, mp.size());
+      BuildEdges(group, mp, threads, compress_pool);
+    }));
+  }
+  for (auto& i : tasks) i.get();
+}
+
+void AddBoards(const std::filesystem::path& fname) {
+  std::array<std::vector<CompactBoard>, kGroups> boards;
+  {
+    ClassReader<CompactBoard> reader(fname);
+    std::vector<CompactBoard> all;
+    bool eof = false;
+    while (!eof) ReadInputBoards(reader, all, all.size() + kBlock, eof);
+    for (auto& i : all) boards[GetGroupByCells(i.Count())].push_back(i);
+  }
+  std::array<GroupDelta, kGroups> deltas;
+  for (int group = 0; group < kGroups; group++) {
+    SortUnique(boards[group], kParallel);
+    deltas[group] = MergeNewBoards(group, boards[group]);
+    boards[group] = std::vector<CompactBoard>();
+    spdlog::info("Group {}: {} boards added", group, deltas[group].boards.size());
+    if (deltas[group].boards.empty()) continue;
+    {
+      // an existing remap is extended, so that it keeps mapping the ids of the original set
+      auto remap = ComposeRemap(ReadRemap(group), deltas[group].inserted);
+      ClassWriter<BasicIOType<uint64_t>> writer(BoardRemapPath(group));
+      for (auto& i : remap) writer.Write(i);
+    }
+    RemoveBoardLookupFiles(group);
+  }
+  for (int group = 0; group < kGroups; group++) {
+    int nxt_group = NextGroup(group);
+    if (deltas[group].boards.empty() && deltas[nxt_group].boards.empty()) continue;
+    if (!std::filesystem::exists(EvaluateEdgePath(group, 0))) {
+      spdlog::warn("No edges for group {}; run build-edges for it", group);
+      continue;
+    }
+    UpdateEdges(group, deltas[group], deltas[nxt_group]);
+  }
+  spdlog::warn("Board IDs changed; values, moves and thresholds must be recomputed");
+}
+
+void WarnStaleFixedEdges(const std::string& fixed_fname) {
+  static std::mutex mtx;
+  static std::unordered_set<std::string> warned;
+  std::lock_guard lck(mtx);
+  if (warned.insert(fixed_fname).second) {
+    spdlog::warn("{} was converted from older edges; using the compressed edges (rerun fixed-edges)", fixed_fname);
+  }
+}
+
+void ConvertFixedEdges(const std::vector<int>& groups) {
+  constexpr size_t kBatch = 1024 * kPieces;
+  std::vector<std::pair<int, int>> files;
+  for (int group : groups) {
+    for (int level = 0; level < kLevels; level++) files.push_back({group, level});
+  }
+  if (files.empty()) return;
+  BS::thread_pool pool(std::min(kParallel, (int)files.size()));
+  pool.parallelize_loop(0, files.size(), [&](size_t l, size_t r){
+    for (size_t i = l; i < r; i++) {
+      auto [group, level] = files[i];
+      CompressedClassReader<EvaluateNodeEdgesFast> reader(EvaluateEdgePath(group, level));
+      FixedEdgeWriter writer(EvaluateEdgeFixedPath(group, level));
+      writer.SetSource(EvaluateEdgePath(group, level));
+      std::vector<EvaluateNodeEdgesFast> batch(kBatch);
+      while (true) {
+        size_t num = reader.ReadBatch(batch.data(), kBatch);
+        for (size_t j = 0; j < num; j++) writer.Write(batch[j]);
+        if (num < kBatch) break;
+      }
+      writer.Close();
+      spdlog::info("Converted edges of group {}, level {}: {} records", group, level, writer.Size());
+    }
+  }).get();
 }
 
 std::vector<size_t> GetBoardCountOffset(int group) {
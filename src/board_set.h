@@ -2,22 +2,17 @@
 
 #include <vector>
 #include <filesystem>
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wdangling-reference"
-#include <tsl/sparse_map.h>
-#pragma GCC diagnostic pop
 
 #include "io.h"
 #include "game.h"
 #include "board.h"
 #include "files.h"
+#include "board_map.h"
 
-using BoardMapKey = std::pair<Board, uint64_t>;
-using BoardMap = tsl::sparse_map<Board, uint64_t, std::hash<Board>, std::equal_to<Board>,
-      std::allocator<BoardMapKey>, tsl::sh::power_of_two_growth_policy<2>,
-      tsl::sh::exception_safety::basic, tsl::sh::sparsity::high>;
+using BoardMap = FlatBoardMap;
 
-void SplitBoards(const std::filesystem::path&);
+// memory_limit: bytes of boards held in memory at once; 0 to sort everything in memory
+void SplitBoards(const std::filesystem::path&, size_t memory_limit = 0);
 
 template <class Func> void ProcessBoards(int group, Func&& f) {
   constexpr size_t kBlock = 65536;
@@ -33,7 +28,16 @@ template <class Func> void ProcessBoards(int group, Func&& f) {
 BoardMap GetBoardMap(int group);
 void WriteBoardMap();
 
-void BuildEdges(const std::vector<int>& groups);
+// concurrent_groups: number of groups built at the same time, each with kParallel / concurrent_groups
+// threads and its own board map in memory
+void BuildEdges(const std::vector<int>& groups, int concurrent_groups = 1);
+// merge the boards of a board file into the board set, renumbering the existing boards
+// edges are only built for the added boards and for boards that may gain one of them as a successor
+// the renumbering of each group is written to BoardRemapPath (see ReadRemap in board_set.cpp); an existing
+// remap file is extended, so it maps the ids from before the first run until it is deleted
+void AddBoards(const std::filesystem::path& fname);
+// write the evaluate edges of the groups in the pre-decoded fixed layout (EvaluateEdgeFixedPath)
+void ConvertFixedEdges(const std::vector<int>& groups);
 
 // ret[count/10] = offset
 std::vector<size_t> GetBoardCountOffset(int group);
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+// XXH64 (little endian), used for the per-block checksums of compressed files
+inline uint64_t XXHash64(const uint8_t* data, size_t len, uint64_t seed = 0) {
+  constexpr uint64_t kP1 = 0x9e3779b185ebca87, kP2 = 0xc2b2ae3d27d4eb4f, kP3 = 0x165667b19e3779f9;
+  constexpr uint64_t kP4 = 0x85ebca77c2b2ae63, kP5 = 0x27d4eb2f165667c5;
+  auto Rotl = [](uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+  auto Read64 = [](const uint8_t* p) { uint64_t x; memcpy(&x, p, 8); return x; };
+  auto Read32 = [](const uint8_t* p) { uint32_t x; memcpy(&x, p, 4); return (uint64_t)x; };
+  auto Round = [&](uint64_t acc, uint64_t x) { return Rotl(acc + x * kP2, 31) * kP1; };
+  auto Merge = [&](uint64_t acc, uint64_t v) { return (acc ^ Round(0, v)) * kP1 + kP4; };
+
+  const uint8_t* end = data + len;
+  uint64_t h;
+  if (len >= 32) {
+    uint64_t v1 = seed + kP1 + kP2, v2 = seed + kP2, v3 = seed, v4 = seed - kP1;
+    for (; data + 32 <= end; data += 32) {
+      v1 = Round(v1, Read64(data));
+      v2 = Round(v2, Read64(data + 8));
+      v3 = Round(v3, Read64(data + 16));
+      v4 = Round(v4, Read64(data + 24));
+    }
+    h = Rotl(v1, 1) + Rotl(v2, 7) + Rotl(v3, 12) + Rotl(v4, 18);
+    h = Merge(h, v1);
+    h = Merge(h, v2);
+    h = Merge(h, v3);
+    h = Merge(h, v4);
+  } else {
+    h = seed + kP5;
+  }
+  h += len;
+  for (; data + 8 <= end; data += 8) h = Rotl(h ^ Round(0, Read64(data)), 27) * kP1 + kP4;
+  if (data + 4 <= end) {
+    h = Rotl(h ^ (Read32(data) * kP1), 23) * kP2 + kP3;
+    data += 4;
+  }
+  for (; data < end; data++) h = Rotl(h ^ (*data * kP5), 11) * kP1;
+  h ^= h >> 33;
+  h *= kP2;
+  h ^= h >> 29;
+  h *= kP3;
+  h ^= h >> 32;
+  return h;
+}
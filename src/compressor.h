@@ -2,12 +2,58 @@
 
 #include <cstdio>
 #include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
 #include <vector>
 #include <optional>
+#include <stdexcept>
 
 #include <zstd.h>
+#include <zdict.h>
 #include "thread_pool.hpp"
 
+using ZstdCDictPtr = std::shared_ptr<const ZSTD_CDict>;
+using ZstdDDictPtr = std::shared_ptr<const ZSTD_DDict>;
+
+inline ZstdCDictPtr MakeCDict(const std::vector<uint8_t>& dict, int compress_level) {
+  ZSTD_CDict* ret = ZSTD_createCDict(dict.data(), dict.size(), compress_level);
+  if (!ret) throw std::runtime_error("zstd create dictionary failed");
+  return ZstdCDictPtr(ret, ZSTD_freeCDict);
+}
+
+inline ZstdDDictPtr MakeDDict(const std::vector<uint8_t>& dict) {
+  ZSTD_DDict* ret = ZSTD_createDDict(dict.data(), dict.size());
+  if (!ret) throw std::runtime_error("zstd create dictionary failed");
+  return ZstdDDictPtr(ret, ZSTD_freeDDict);
+}
+
+// samples are concatenated in `samples`; one sample is usually one uncompressed block
+inline std::vector<uint8_t> TrainZstdDictionary(
+    const std::vector<uint8_t>& samples, const std::vector<size_t>& sample_sizes, size_t dict_size) {
+  std::vector<uint8_t> dict(dict_size);
+  size_t ret = ZDICT_trainFromBuffer(
+      dict.data(), dict.size(), samples.data(), sample_sizes.data(), sample_sizes.size());
+  if (ZDICT_isError(ret)) {
+    throw std::runtime_error(std::string("zstd dictionary training failed: ") + ZDICT_getErrorName(ret));
+  }
+  dict.resize(ret);
+  return dict;
+}
+
+inline size_t ZstdCompress(
+    ZSTD_CCtx* ctx, std::vector<uint8_t>& result, const std::vector<uint8_t>& block,
+    int compress_level, const ZSTD_CDict* cdict) {
+  size_t clear_size = ZSTD_compressBound(block.size());
+  result.resize(clear_size);
+  size_t nlen = cdict ?
+      ZSTD_compress_usingCDict(ctx, result.data(), clear_size, block.data(), block.size(), cdict) :
+      ZSTD_compressCCtx(ctx, result.data(), clear_size, block.data(), block.size(), compress_level);
+  if (ZSTD_isError(nlen)) throw std::runtime_error("zstd compress failed");
+  result.resize(nlen);
+  return nlen;
+}
+
 struct CompressorBase {
   virtual ~CompressorBase() {
     if (RemainingBlocks()) puts("Warning: Compressor destructed with blocks unread");
@@ -16,11 +62,18 @@ struct CompressorBase {
   virtual size_t RemainingBlocks() const { return 0; }
   virtual std::vector<uint8_t> GetResultBlock() { return {}; }
   virtual std::optional<std::vector<uint8_t>> GetResultBlockNoWait() { return std::nullopt; }
+  // caller should wait for results before submitting more blocks if RemainingBlocks() reaches this
+  virtual size_t MaxPendingBlocks() const { return 1; }
+  // must be called before any block is compressed
+  virtual void SetDictionary(const std::vector<uint8_t>& dict) {
+    throw std::logic_error("dictionary not supported");
+  }
 };
 
 class DefaultZstdCompressor : public CompressorBase {
   std::unique_ptr<ZSTD_CCtx, size_t(*)(ZSTD_CCtx*)> zstd_ctx;
   std::vector<uint8_t> result;
+  ZstdCDictPtr cdict;
   int compress_level;
   bool has_result;
  public:
@@ -32,15 +85,14 @@ class DefaultZstdCompressor : public CompressorBase {
 
   void CompressBlock(std::vector<uint8_t>&& block) {
     if (has_result) throw std::runtime_error("previous block not obtained");
-    size_t clear_size = ZSTD_compressBound(block.size());
-    result.resize(clear_size);
-    size_t nlen = ZSTD_compressCCtx(
-        zstd_ctx.get(), result.data(), clear_size, block.data(), block.size(), compress_level);
-    if (ZSTD_isError(nlen)) throw std::runtime_error("zstd compress failed");
-    result.resize(nlen);
+    ZstdCompress(zstd_ctx.get(), result, block, compress_level, cdict.get());
     has_result = true;
   }
 
+  void SetDictionary(const std::vector<uint8_t>& dict) override {
+    cdict = MakeCDict(dict, compress_level);
+  }
+
   size_t RemainingBlocks() const override { return has_result; }
 
   std::vector<uint8_t> GetResultBlock() override {
@@ -54,27 +106,41 @@ class DefaultZstdCompressor : public CompressorBase {
   }
 };
 
+// results are returned in submission order
 class ParallelZstdCompressor : public CompressorBase {
   std::deque<std::future<std::vector<uint8_t>>> results;
-  BS::thread_pool pool;
+  std::unique_ptr<BS::thread_pool> own_pool;
+  BS::thread_pool* pool;
+  ZstdCDictPtr cdict;
   int compress_level;
+  size_t max_pending;
  public:
-  ParallelZstdCompressor(int parallel, int compress_level = -4) : pool(parallel), compress_level(compress_level) {}
+  ParallelZstdCompressor(int parallel, int compress_level = -4, size_t max_pending = 0) :
+      own_pool(std::make_unique<BS::thread_pool>(parallel)), pool(own_pool.get()),
+      compress_level(compress_level), max_pending(max_pending) {
+    if (!this->max_pending) this->max_pending = pool->get_thread_count() * 4;
+  }
+  // share a pool between multiple writers
+  ParallelZstdCompressor(BS::thread_pool& pool, int compress_level = -4, size_t max_pending = 0) :
+      pool(&pool), compress_level(compress_level), max_pending(max_pending) {
+    if (!this->max_pending) this->max_pending = pool.get_thread_count() * 2;
+  }
   ~ParallelZstdCompressor() {}
 
   void CompressBlock(std::vector<uint8_t>&& block) {
-    results.push_back(pool.submit([compress_level=compress_level,block=std::move(block)]() {
-      std::unique_ptr<ZSTD_CCtx, size_t(*)(ZSTD_CCtx*)> zstd_ctx(ZSTD_createCCtx(), ZSTD_freeCCtx);
-      size_t clear_size = ZSTD_compressBound(block.size());
-      std::vector<uint8_t> result(clear_size);
-      size_t nlen = ZSTD_compressCCtx(
-          zstd_ctx.get(), result.data(), clear_size, block.data(), block.size(), compress_level);
-      if (ZSTD_isError(nlen)) throw std::runtime_error("zstd compress failed");
-      result.resize(nlen);
+    results.push_back(pool->submit([compress_level=compress_level,cdict=cdict,block=std::move(block)]() {
+      thread_local std::unique_ptr<ZSTD_CCtx, size_t(*)(ZSTD_CCtx*)> zstd_ctx(ZSTD_createCCtx(), ZSTD_freeCCtx);
+      if (!zstd_ctx) throw std::runtime_error("zstd initialize failed");
+      std::vector<uint8_t> result;
+      ZstdCompress(zstd_ctx.get(), result, block, compress_level, cdict.get());
       return result;
     }));
   }
 
+  void SetDictionary(const std::vector<uint8_t>& dict) override {
+    cdict = MakeCDict(dict, compress_level);
+  }
+
   size_t RemainingBlocks() const override { return results.size(); }
 
   std::vector<uint8_t> GetResultBlock() override {
@@ -84,7 +150,9 @@ class ParallelZstdCompressor : public CompressorBase {
   }
 
   std::optional<std::vector<uint8_t>> GetResultBlockNoWait() override {
-    if (!results.empty() || !IsReady(results.front())) return std::nullopt;
+    if (results.empty() || !IsReady(results.front())) return std::nullopt;
     return GetResultBlock();
   }
+
+  size_t MaxPendingBlocks() const override { return max_pending; }
 };
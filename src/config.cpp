@@ -3,3 +3,6 @@
 std::filesystem::path kDataDir;
 int kParallel = 1;
 int kIOThreads = 1;
+int kReadAhead = 0;
+bool kDirectIO = false;
+int kBlockCacheMB = 0;
@@ -5,3 +5,6 @@
 extern std::filesystem::path kDataDir;
 extern int kParallel;
 extern int kIOThreads;
+extern int kReadAhead;
+extern bool kDirectIO;
+extern int kBlockCacheMB;
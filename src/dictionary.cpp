@@ -0,0 +1,104 @@
+#include "dictionary.h"
+
+#include <random>
+#include <algorithm>
+#include <functional>
+#include <spdlog/spdlog.h>
+
+#include "io.h"
+#include "edge.h"
+#include "move.h"
+#include "files.h"
+#include "config.h"
+#include "thread_pool.hpp"
+
+namespace {
+
+template <class T>
+std::vector<uint8_t> TrainDictionary(
+    CompressedClassReader<T>& reader, size_t num_blocks, size_t dict_size, size_t num_samples, long seed) {
+  size_t items_per_index = reader.ItemsPerIndex();
+  std::vector<size_t> blocks(num_blocks);
+  for (size_t i = 0; i < num_blocks; i++) blocks[i] = i;
+  if (num_samples < num_blocks) {
+    std::mt19937_64 gen(seed);
+    std::shuffle(blocks.begin(), blocks.end(), gen);
+    blocks.resize(num_samples);
+    std::sort(blocks.begin(), blocks.end());
+  }
+  std::vector<uint8_t> samples;
+  std::vector<size_t> sample_sizes;
+  for (size_t block : blocks) {
+    size_t old_size = samples.size();
+    reader.Seek(block * items_per_index);
+    try {
+      for (size_t i = 0; i < items_per_index; i++) io_internal::WriteToBuf(samples, reader.ReadOne());
+    } catch (ReadError&) {}
+    if (samples.size() != old_size) sample_sizes.push_back(samples.size() - old_size);
+  }
+  return TrainZstdDictionary(samples, sample_sizes, dict_size);
+}
+
+template <class T>
+void TrainAndRecompress(
+    const std::string& fname, int compress_level,
+    size_t dict_size, size_t num_samples, size_t items_per_block, long seed) {
+  std::string tmp_fname = fname + ".tmp";
+  {
+    CompressedClassReader<T> reader(fname, true);
+    size_t items_per_index = reader.ItemsPerIndex();
+    auto dict = TrainDictionary(reader, reader.NumBlocks(), dict_size, num_samples, seed);
+    spdlog::info("Dictionary of {} bytes trained for {}", dict.size(), fname);
+
+    CompressedClassWriter<T> writer(tmp_fname, items_per_block ? items_per_block : items_per_index, compress_level);
+    writer.SetDictionary(dict);
+    reader.Seek(0);
+    try {
+      while (true) writer.Write(reader.ReadOne());
+    } catch (ReadError&) {}
+  }
+  size_t old_size = std::filesystem::file_size(fname);
+  // the data file is replaced last, so that it never refers to a missing dictionary; a crash before that
+  // leaves the old data file with the new index (and dictionary), which verify reports as a size mismatch
+  std::filesystem::rename(tmp_fname + ".dict", fname + ".dict");
+  std::filesystem::rename(tmp_fname + ".index", fname + ".index");
+  std::filesystem::rename(tmp_fname, fname);
+  spdlog::info("{} recompressed: {} -> {} bytes", fname, old_size, std::filesystem::file_size(fname));
+}
+
+} // namespace
+
+void TrainDictionaries(
+    DictionaryTarget target, const std::string& threshold_name,
+    size_t dict_size, size_t num_samples, size_t items_per_block, long seed) {
+  // compression levels match the ones used when the files are produced
+  std::vector<std::function<void()>> tasks;
+  for (int group = 0; group < kGroups; group++) {
+    switch (target) {
+      case DictionaryTarget::kMoves:
+        tasks.push_back([=]() {
+          TrainAndRecompress<NodeMovePositionRange>(
+              MovePath(group), -2, dict_size, num_samples, items_per_block, seed);
+        });
+        break;
+      case DictionaryTarget::kThreshold:
+        tasks.push_back([=]() {
+          TrainAndRecompress<NodeThreshold>(
+              ThresholdPath(threshold_name, group), -2, dict_size, num_samples, items_per_block, seed);
+        });
+        break;
+      case DictionaryTarget::kEdges:
+        for (int level = 0; level < kLevels; level++) {
+          tasks.push_back([=]() {
+            TrainAndRecompress<EvaluateNodeEdges>(
+                EvaluateEdgePath(group, level), -4, dict_size, num_samples, items_per_block, seed);
+          });
+        }
+        break;
+    }
+  }
+  BS::thread_pool pool(std::min(kParallel, (int)tasks.size()));
+  pool.parallelize_loop(0, tasks.size(), [&](size_t l, size_t r){
+    for (size_t i = l; i < r; i++) tasks[i]();
+  }).get();
+}
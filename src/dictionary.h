@@ -0,0 +1,17 @@
+#pragma once
+
+#include <string>
+
+// which record files to train a zstd dictionary for
+enum class DictionaryTarget {
+  kMoves,
+  kThreshold,
+  kEdges
+};
+
+// train a dictionary from sampled blocks of each file and recompress the file with it;
+// the dictionary is stored next to the index and picked up by CompressedClassReader
+// items_per_block == 0 keeps the original block size
+void TrainDictionaries(
+    DictionaryTarget target, const std::string& threshold_name,
+    size_t dict_size, size_t num_samples, size_t items_per_block, long seed);
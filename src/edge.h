@@ -1,9 +1,11 @@
 #pragma once
 
 #include <cstdint>
-#include <deque>
+#include <cstring>
+#include <algorithm>
 #include <bitset>
 #include <vector>
+#include <memory_resource>
 #include <stdexcept>
 #include <tsl/hopscotch_map.h>
 
@@ -13,16 +15,43 @@
 #include "constexpr_helpers.h"
 
 class EvaluateNodeEdges {
+ public:
+  // buffers of ReduceAdj and CalculateSubset; keeping one across calls lets them run without allocating
+  struct Workspace {
+    // backs the map of ReduceAdj, so that a fresh map (with the same iteration order) reuses its memory
+    std::pmr::unsynchronized_pool_resource pool{std::pmr::pool_options{0, 1 << 16}};
+    // result of ReduceAdj: new adj i merges old adj group_members[group_begin[i]..group_begin[i+1])
+    std::vector<size_t> group_begin;
+    std::vector<uint8_t> group_members;
+    // inner vectors of adj dropped by ReduceAdj, to be reused by the caller
+    std::vector<std::vector<uint8_t>> spare;
+
+    std::vector<std::vector<uint8_t>> adj_tmp;
+    std::vector<size_t> group_of, group_rank, group_pos;
+    std::vector<uint8_t> contain_next, adj_idx, remaining, ref_cnt, selected;
+    std::vector<size_t> child_begin, child_pos;
+    std::vector<int> child, reverse_order, queue;
+    std::vector<std::pair<uint8_t, int>> subset_tmp;
+  };
+
+ private:
   struct SubsetCalculator {
     const std::vector<std::vector<uint8_t>>& adj;
     std::vector<uint8_t>& adj_subset;
     std::vector<std::pair<uint8_t, int>>& subset_idx_prev; // (idx, prev)
+    Workspace& ws;
+    size_t next_sz;
 
-    std::vector<std::vector<uint8_t>> contain_next;
-    std::vector<uint8_t> adj_idx, remaining;
-    std::vector<uint8_t> ref_cnt, selected;
+    // contain_next of adj i at ws.contain_next[i * next_sz]
+    // ws.ref_cnt holds one array of next_sz counts per recursion depth
+    uint8_t* RefCnt(size_t frame) { return ws.ref_cnt.data() + frame * next_sz; }
 
-    void RecursiveCalculate(size_t l, size_t r, int prev) {
+    // ref_cnt of this call is at frame and may be overwritten; frame depth + 1 is used for the
+    // not selected portion
+    void RecursiveCalculate(size_t l, size_t r, int prev, size_t frame, size_t depth) {
+      auto& adj_idx = ws.adj_idx;
+      auto& remaining = ws.remaining;
+      auto& selected = ws.selected;
       if (r - l == 1) {
         for (auto& x : adj[adj_idx[l]]) {
           if (selected[x]) continue;
@@ -32,94 +61,106 @@ class EvaluateNodeEdges {
         adj_subset[adj_idx[l]] = prev;
         return;
       }
-      std::vector<uint8_t> tmp_ref_cnt(ref_cnt);
+      if (ws.ref_cnt.size() < (depth + 2) * next_sz) ws.ref_cnt.resize((depth + 2) * next_sz);
+      uint8_t* ref_cnt = RefCnt(frame);
       size_t finished = std::partition(adj_idx.begin() + l, adj_idx.begin() + r,
           [&](uint8_t idx) { return remaining[idx] > 0; }) - adj_idx.begin();
       for (size_t i = finished; i < r; i++) {
         adj_subset[adj_idx[i]] = prev;
         for (auto& x : adj[adj_idx[i]]) ref_cnt[x]--;
       }
-      if (l == finished) {
-        ref_cnt.swap(tmp_ref_cnt);
-        return;
-      }
+      if (l == finished) return;
       size_t split_id = 0;
       { // split by the most occuring next
         uint8_t mx = 0;
-        for (size_t i = 0; i < ref_cnt.size(); i++) {
+        for (size_t i = 0; i < next_sz; i++) {
           if (selected[i]) continue;
           if (ref_cnt[i] > mx) mx = ref_cnt[i], split_id = i;
         }
       }
       size_t mid = std::partition(adj_idx.begin() + l, adj_idx.begin() + finished,
-          [&](uint8_t idx) { return contain_next[idx][split_id]; }) - adj_idx.begin();
+          [&](uint8_t idx) { return ws.contain_next[idx * next_sz + split_id]; }) - adj_idx.begin();
       if (l == mid) throw std::logic_error("what?");
-      std::vector<uint8_t> n_ref_cnt(ref_cnt.size());
+      uint8_t* n_ref_cnt = RefCnt(depth + 1);
+      std::fill(n_ref_cnt, n_ref_cnt + next_sz, 0);
       for (size_t i = mid; i < finished; i++) {
         for (auto& x : adj[adj_idx[i]]) n_ref_cnt[x]++;
       }
-      for (size_t i = 0; i < ref_cnt.size(); i++) ref_cnt[i] -= n_ref_cnt[i];
+      for (size_t i = 0; i < next_sz; i++) ref_cnt[i] -= n_ref_cnt[i];
       // selected portion
       selected[split_id] = true;
       for (size_t i = l; i < mid; i++) remaining[adj_idx[i]]--;
       subset_idx_prev.push_back({(uint8_t)split_id, prev});
-      RecursiveCalculate(l, mid, subset_idx_prev.size() - 1);
+      RecursiveCalculate(l, mid, subset_idx_prev.size() - 1, frame, depth + 1);
       selected[split_id] = false;
       for (size_t i = l; i < mid; i++) remaining[adj_idx[i]]++;
       // not selected portion
-      if (mid != finished) {
-        n_ref_cnt.swap(ref_cnt);
-        RecursiveCalculate(mid, finished, prev);
-      }
-      ref_cnt.swap(tmp_ref_cnt);
+      if (mid != finished) RecursiveCalculate(mid, finished, prev, depth + 1, depth + 1);
     }
 
+    // relabel the subset nodes in BFS order
     void Reorder() {
-      std::vector<std::vector<std::pair<uint8_t, int>>> ed(subset_idx_prev.size() + 1);
-      for (size_t i = 0; i < subset_idx_prev.size(); i++) {
-        auto& item = subset_idx_prev[i];
-        ed[item.second + 1].push_back({item.first, i});
-      }
-      std::vector<int> reverse_order(subset_idx_prev.size());
-      std::deque<int> queue = {-1};
-      size_t o1 = subset_idx_prev.size();
-      subset_idx_prev.clear();
-      while (queue.size()) {
-        int cur = queue.front();
-        queue.pop_front();
-        for (auto [val, nxt] : ed[cur + 1]) {
-          reverse_order[nxt] = subset_idx_prev.size();
-          subset_idx_prev.push_back({val, cur == -1 ? cur : reverse_order[cur]});
+      size_t n = subset_idx_prev.size();
+      // children of node i (-1 for root) are child[child_begin[i + 1]..child_begin[i + 2])
+      auto& child_begin = ws.child_begin;
+      child_begin.assign(n + 2, 0);
+      for (auto& item : subset_idx_prev) child_begin[item.second + 2]++;
+      for (size_t i = 1; i < child_begin.size(); i++) child_begin[i] += child_begin[i - 1];
+      ws.child_pos.assign(child_begin.begin(), child_begin.end());
+      ws.child.resize(n);
+      for (size_t i = 0; i < n; i++) ws.child[ws.child_pos[subset_idx_prev[i].second + 1]++] = i;
+
+      auto& reverse_order = ws.reverse_order;
+      auto& queue = ws.queue;
+      auto& new_idx_prev = ws.subset_tmp;
+      reverse_order.resize(n);
+      queue.assign(1, -1);
+      new_idx_prev.clear();
+      for (size_t head = 0; head < queue.size(); head++) {
+        int cur = queue[head];
+        for (size_t i = child_begin[cur + 1]; i < child_begin[cur + 2]; i++) {
+          int nxt = ws.child[i];
+          reverse_order[nxt] = new_idx_prev.size();
+          new_idx_prev.push_back({subset_idx_prev[nxt].first, cur == -1 ? cur : reverse_order[cur]});
           queue.push_back(nxt);
         }
       }
-      if (o1 != subset_idx_prev.size()) throw;
-      std::vector<uint8_t> new_subset;
-      for (auto& i : adj_subset) new_subset.push_back(reverse_order[i]);
-      adj_subset.swap(new_subset);
+      if (n != new_idx_prev.size()) throw;
+      subset_idx_prev.swap(new_idx_prev);
+      for (auto& i : adj_subset) i = reverse_order[i];
     }
 
     SubsetCalculator(size_t next_sz,
                      const std::vector<std::vector<uint8_t>>& adj,
                      std::vector<uint8_t>& adj_subset,
-                     std::vector<std::pair<uint8_t, int>>& subset_idx_prev) :
-        adj(adj), adj_subset(adj_subset), subset_idx_prev(subset_idx_prev),
-        contain_next(adj.size(), std::vector<uint8_t>(next_sz)),
-        adj_idx(adj.size()), remaining(adj.size()),
-        ref_cnt(next_sz), selected(next_sz) {
+                     std::vector<std::pair<uint8_t, int>>& subset_idx_prev,
+                     Workspace& ws) :
+        adj(adj), adj_subset(adj_subset), subset_idx_prev(subset_idx_prev), ws(ws), next_sz(next_sz) {
+      ws.contain_next.assign(adj.size() * next_sz, 0);
+      ws.adj_idx.resize(adj.size());
+      ws.remaining.resize(adj.size());
+      ws.ref_cnt.assign(next_sz, 0);
+      ws.selected.assign(next_sz, 0);
       adj_subset.resize(adj.size());
       for (size_t i = 0; i < adj.size(); i++) {
-        adj_idx[i] = i;
-        remaining[i] = adj[i].size();
-        for (auto& x : adj[i]) ref_cnt[x]++, contain_next[i][x] = true;
+        ws.adj_idx[i] = i;
+        ws.remaining[i] = adj[i].size();
+        for (auto& x : adj[i]) ws.ref_cnt[x]++, ws.contain_next[i * next_sz + x] = true;
       }
-      RecursiveCalculate(0, adj.size(), -1);
+      RecursiveCalculate(0, adj.size(), -1, 0, 0);
       Reorder();
     }
   };
  public:
   static constexpr bool kIsConstSize = false;
   static constexpr size_t kSizeNumberBytes = 2;
+  static constexpr uint32_t kRecordTypeId = kRecordEvaluateNodeEdges;
+
+  // flags stored in the second byte
+  static constexpr uint8_t kFlagSubset = 1;
+  // next_ids sorted by ID, stored as varint deltas followed by 3-bit packed lines
+  static constexpr uint8_t kFlagDeltaIds = 2;
+  static constexpr size_t kLineBits = 3;
 
   // edge for`evaluating; no position information available
   uint8_t cell_count;
@@ -136,27 +177,57 @@ class EvaluateNodeEdges {
   bool operator==(const EvaluateNodeEdges&) const = default;
   bool operator!=(const EvaluateNodeEdges&) const = default;
 
-  // ret[new_idx] = {old_idx...}
-  std::vector<std::vector<uint8_t>> ReduceAdj() {
+  // merge adj with the same set of nexts; the new adj i merges the old adj
+  // ws.group_members[ws.group_begin[i]..ws.group_begin[i+1]), and the dropped ones are moved to ws.spare
+  void ReduceAdj(Workspace& ws) {
     using Key = std::bitset<256>;
-    tsl::hopscotch_map<Key, std::vector<uint8_t>, std::hash<Key>, std::equal_to<Key>,
-                       std::allocator<std::pair<Key, std::vector<uint8_t>>>, 30, true> mp;
+    using Alloc = std::pmr::polymorphic_allocator<std::pair<Key, size_t>>;
+    tsl::hopscotch_map<Key, size_t, std::hash<Key>, std::equal_to<Key>, Alloc, 30, true> mp(Alloc(&ws.pool));
+    ws.group_of.resize(adj.size());
     for (size_t i = 0; i < adj.size(); i++) {
       std::bitset<256> bs{};
       for (const auto& j : adj[i]) bs[j] = true;
-      mp[bs].push_back(i);
+      ws.group_of[i] = mp.try_emplace(bs, mp.size()).first->second;
+    }
+    // groups are ordered by the map
+    ws.group_rank.resize(mp.size());
+    ws.group_begin.assign(mp.size() + 1, 0);
+    size_t rank = 0;
+    for (auto& i : mp) ws.group_rank[i.second] = rank++;
+    for (auto& i : ws.group_of) i = ws.group_rank[i], ws.group_begin[i + 1]++;
+    for (size_t i = 1; i < ws.group_begin.size(); i++) ws.group_begin[i] += ws.group_begin[i - 1];
+    ws.group_pos.assign(ws.group_begin.begin(), ws.group_begin.end());
+    ws.group_members.resize(adj.size());
+    for (size_t i = 0; i < adj.size(); i++) ws.group_members[ws.group_pos[ws.group_of[i]]++] = i;
+
+    ws.adj_tmp.clear();
+    for (size_t i = 0; i < mp.size(); i++) {
+      ws.adj_tmp.push_back(std::move(adj[ws.group_members[ws.group_begin[i]]]));
     }
-    std::vector<std::vector<uint8_t>> ret, new_adj;
-    for (auto& i : mp) {
-      new_adj.push_back(std::move(adj[i.second[0]]));
-      ret.push_back(std::move(i.second));
+    for (auto& i : adj) {
+      if (i.capacity()) ws.spare.push_back(std::move(i));
+    }
+    adj.swap(ws.adj_tmp);
+    ws.adj_tmp.clear();
+  }
+
+  // ret[new_idx] = {old_idx...}
+  std::vector<std::vector<uint8_t>> ReduceAdj() {
+    Workspace ws;
+    ReduceAdj(ws);
+    std::vector<std::vector<uint8_t>> ret;
+    for (size_t i = 0; i + 1 < ws.group_begin.size(); i++) {
+      ret.emplace_back(ws.group_members.begin() + ws.group_begin[i], ws.group_members.begin() + ws.group_begin[i + 1]);
     }
-    adj.swap(new_adj);
     return ret;
   }
 
+  void CalculateSubset(Workspace& ws) {
+    SubsetCalculator(next_ids.size(), adj, adj_subset, subset_idx_prev, ws);
+  }
   void CalculateSubset() {
-    SubsetCalculator(next_ids.size(), adj, adj_subset, subset_idx_prev);
+    Workspace ws;
+    CalculateSubset(ws);
   }
 
   void CalculateAdj() {
@@ -171,9 +242,47 @@ class EvaluateNodeEdges {
     for (auto i : adj_subset) adj.emplace_back(lst[i]);
   }
 
-  size_t NumBytes() const {
+  // size of the delta encoding of next_ids, or 0 if plain encoding is used
+  size_t DeltaIdsBytes() const {
+    size_t sz = (next_ids.size() * kLineBits + 7) / 8;
+    uint64_t last = 0;
+    for (auto& i : next_ids) {
+      if (i.first < last) return 0;
+      sz += VarintSize(i.first - last);
+      last = i.first;
+    }
+    return sz < next_ids.size() * 5 ? sz : 0;
+  }
+
+  // calls func(idx, id, lines) for each next id; returns the number of bytes read (excluding the size byte)
+  template <class Func>
+  static size_t ReadNextIds(const uint8_t data[], size_t num, bool delta, Func&& func) {
+    if (!delta) {
+      for (size_t i = 0; i < num; i++) func(i, BytesToInt<uint32_t>(data + i * 5), data[i * 5 + 4]);
+      return num * 5;
+    }
+    size_t ind = 0;
+    uint64_t last = 0;
+    uint64_t ids[256];
+    for (size_t i = 0; i < num; i++) {
+      uint64_t delta_id;
+      ind += VarintInput(delta_id, data + ind);
+      ids[i] = last += delta_id;
+    }
+    for (size_t i = 0; i < num; i++) {
+      size_t bit = i * kLineBits;
+      uint16_t word = data[ind + bit / 8] | (bit % 8 + kLineBits > 8 ? data[ind + bit / 8 + 1] << 8 : 0);
+      func(i, ids[i], (word >> (bit % 8)) & ((1 << kLineBits) - 1));
+    }
+    return ind + (num * kLineBits + 7) / 8;
+  }
+
+  size_t NumBytes() const { return NumBytes(DeltaIdsBytes()); }
+
+  // NumBytes with the given DeltaIdsBytes()
+  size_t NumBytes(size_t delta_bytes) const {
     if (non_adj.size() >= 256) throw std::out_of_range("non_adj too large");
-    size_t sz = 2 + 1 + next_ids.size() * 5 + 1 + non_adj.size();
+    size_t sz = 2 + 1 + (delta_bytes ? delta_bytes : next_ids.size() * 5) + 1 + non_adj.size();
     if (use_subset) {
       if (adj_subset.size() >= 256 || subset_idx_prev.size() >= 256) {
         throw std::out_of_range("subset too large");
@@ -190,18 +299,43 @@ class EvaluateNodeEdges {
     return sz;
   }
 
-  void GetBytes(uint8_t ret[]) const {
-    size_t sz = NumBytes();
+  void GetBytes(uint8_t ret[]) const { GetBytes(ret, NumBytes()); }
+
+  // sz is NumBytes(); the delta encoding is used iff it is smaller than the plain one, so the size tells
+  // which one NumBytes chose without sizing the ids again
+  void GetBytes(uint8_t ret[], size_t sz) const {
+    bool delta = sz != NumBytes(0);
     ret[0] = cell_count;
-    ret[1] = use_subset;
+    ret[1] = (use_subset ? kFlagSubset : 0) | (delta ? kFlagDeltaIds : 0);
     // next ids
     size_t ind = 2;
-    ind += VecOutput<1>(next_ids, ret + ind, [&](auto& i, uint8_t data[]) {
-      if (i.first >= (1ll << 32)) throw std::out_of_range("too many boards");
-      IntToBytes<uint32_t>(i.first, data);
-      data[4] = i.second;
-      return 5;
-    });
+    if (delta) {
+      if (next_ids.size() >= 256) throw std::out_of_range("vec too large");
+      ret[ind++] = next_ids.size();
+      uint64_t last = 0;
+      for (auto& i : next_ids) {
+        if (i.first >= (1ll << 32)) throw std::out_of_range("too many boards");
+        ind += VarintOutput(i.first - last, ret + ind);
+        last = i.first;
+      }
+      size_t line_bytes = (next_ids.size() * kLineBits + 7) / 8;
+      memset(ret + ind, 0, line_bytes);
+      for (size_t i = 0; i < next_ids.size(); i++) {
+        if (next_ids[i].second >= (1 << kLineBits)) throw std::out_of_range("lines too large");
+        size_t bit = i * kLineBits;
+        uint16_t word = next_ids[i].second << (bit % 8);
+        ret[ind + bit / 8] |= word;
+        if (word >> 8) ret[ind + bit / 8 + 1] |= word >> 8;
+      }
+      ind += line_bytes;
+    } else {
+      ind += VecOutput<1>(next_ids, ret + ind, [&](auto& i, uint8_t data[]) {
+        if (i.first >= (1ll << 32)) throw std::out_of_range("too many boards");
+        IntToBytes<uint32_t>(i.first, data);
+        data[4] = i.second;
+        return 5;
+      });
+    }
     // non_adjs
     ind += SimpleVecOutput<1>(non_adj, ret + ind);
     // adjs
@@ -226,12 +360,11 @@ class EvaluateNodeEdges {
   EvaluateNodeEdges(const uint8_t data[], size_t sz) {
     size_t ind = 0;
     cell_count = data[ind++];
-    use_subset = data[ind++];
-    ind += VecInput<1>(next_ids, data + ind, [](auto& i, const uint8_t data[]) {
-      i.first = BytesToInt<uint32_t>(data);
-      i.second = data[4];
-      return 5;
-    });
+    uint8_t flags = data[ind++];
+    use_subset = flags & kFlagSubset;
+    next_ids.resize(data[ind++]);
+    ind += ReadNextIds(data + ind, next_ids.size(), flags & kFlagDeltaIds,
+                       [&](size_t i, uint64_t id, uint8_t lines) { next_ids[i] = {id, lines}; });
     // non_adjs
     ind += SimpleVecInput<1>(non_adj, data + ind);
     // adjs
@@ -254,10 +387,39 @@ class EvaluateNodeEdges {
   }
 };
 
+// compare a decoded view (EvaluateNodeEdgesFastTmpl / EvaluateNodeEdgesFixed) with the original edges
+template <class View>
+bool EvaluateEdgeViewEqual(const View& v, const EvaluateNodeEdges& x) {
+  if (!(v.cell_count == x.cell_count && v.use_subset == x.use_subset &&
+        v.next_ids_size == x.next_ids.size() &&
+        v.non_adj_size == x.non_adj.size() &&
+        std::equal(v.next_ids, v.next_ids + v.next_ids_size, x.next_ids.begin(),
+                   [](const auto& a, const auto& b) { return a.first == b.first && a.second == b.second; }) &&
+        std::equal(v.non_adj, v.non_adj + v.non_adj_size, x.non_adj.begin()))) {
+    return false;
+  }
+  if (v.use_subset) {
+    return v.adj_subset_size == x.adj_subset.size() &&
+      v.subset_idx_prev_size == x.subset_idx_prev.size() &&
+      std::equal(v.adj_subset, v.adj_subset + v.adj_subset_size, x.adj_subset.begin()) &&
+      std::equal(v.subset_idx_prev, v.subset_idx_prev + v.subset_idx_prev_size, x.subset_idx_prev.begin(),
+                 [](const std::pair<uint8_t, uint8_t>& a, const std::pair<uint8_t, int>& b) {
+                   return a.first == b.first && a.second == (b.second == -1 ? 255 : (unsigned)b.second);
+                 });
+  }
+  if (v.adj_lst_size != x.adj.size()) return false;
+  for (size_t i = 0; i < v.adj_lst_size; i++) {
+    if (!(v.adj_lst[i+1] - v.adj_lst[i] == x.adj[i].size() &&
+          std::equal(v.adj + v.adj_lst[i], v.adj + v.adj_lst[i+1], x.adj[i].begin()))) return false;
+  }
+  return true;
+}
+
 template <int kBufSize>
 struct EvaluateNodeEdgesFastTmpl {
   static constexpr bool kIsConstSize = false;
   static constexpr size_t kSizeNumberBytes = 2;
+  static constexpr uint32_t kRecordTypeId = kRecordEvaluateNodeEdges;
 
   uint8_t* base_ptr;
   // edge for`evaluating; no position information available
@@ -287,28 +449,7 @@ struct EvaluateNodeEdgesFastTmpl {
   bool operator!=(const EvaluateNodeEdgesFastTmpl<kBufSize>& x) const { return !(*this == x); }
 
   bool operator==(const EvaluateNodeEdges& x) const {
-    if (!(cell_count == x.cell_count && use_subset == x.use_subset &&
-          next_ids_size == x.next_ids.size() &&
-          non_adj_size == x.non_adj.size() &&
-          std::equal(next_ids, next_ids + next_ids_size, x.next_ids.begin()) &&
-          std::equal(non_adj, non_adj + non_adj_size, x.non_adj.begin()))) {
-      return false;
-    }
-    if (use_subset) {
-      return adj_subset_size == x.adj_subset.size() &&
-        subset_idx_prev_size == x.subset_idx_prev.size() &&
-        std::equal(adj_subset, adj_subset + adj_subset_size, x.adj_subset.begin()) &&
-        std::equal(subset_idx_prev, subset_idx_prev + subset_idx_prev_size, x.subset_idx_prev.begin(),
-                   [](const std::pair<uint8_t, uint8_t>& a, const std::pair<uint8_t, int>& b) {
-                     return a.first == b.first && a.second == (b.second == -1 ? 255 : (unsigned)b.second);
-                   });
-    }
-    if (adj_lst_size != x.adj.size()) return false;
-    for (size_t i = 0; i < adj_lst_size; i++) {
-      if (!(adj_lst[i+1] - adj_lst[i] == x.adj[i].size() &&
-            std::equal(adj + adj_lst[i], adj + adj_lst[i+1], x.adj[i].begin()))) return false;
-    }
-    return true;
+    return EvaluateEdgeViewEqual(*this, x);
   }
 
   size_t NumBytes() const {
@@ -324,15 +465,14 @@ struct EvaluateNodeEdgesFastTmpl {
     base_ptr = buf;
     size_t ind = 0, buf_ind = 0;
     cell_count = data[ind++];
-    use_subset = data[ind++];
+    uint8_t flags = data[ind++];
+    use_subset = flags & EvaluateNodeEdges::kFlagSubset;
     // nexts
     next_ids_size = data[ind++];
     next_ids = reinterpret_cast<decltype(next_ids)>(buf + buf_ind);
-    for (size_t i = 0; i < next_ids_size; i++) {
-      next_ids[i].first = BytesToInt<uint32_t>(data + ind);
-      next_ids[i].second = data[ind + 4];
-      ind += 5;
-    }
+    ind += EvaluateNodeEdges::ReadNextIds(
+        data + ind, next_ids_size, flags & EvaluateNodeEdges::kFlagDeltaIds,
+        [this](size_t i, uint64_t id, uint8_t lines) { next_ids[i] = {id, lines}; });
     buf_ind += sizeof(decltype(*next_ids)) * next_ids_size;
     // non_adjs
     non_adj_size = data[ind++];
@@ -380,9 +520,136 @@ struct EvaluateNodeEdgesFastTmpl {
 
 using EvaluateNodeEdgesFast = EvaluateNodeEdgesFastTmpl<1536>;
 
+/*
+ * Pre-decoded layout of EvaluateNodeEdges, stored as-is in fixed edge files (EvaluateEdgeFixedPath)
+ * and used in place; the members mirror EvaluateNodeEdgesFastTmpl so that the calculation code is shared.
+ * Records must start at 8-byte aligned addresses and are padded to a multiple of 8 bytes.
+ *
+ *   0 record size (u16)   4 next_ids_size   6 adj_lst_size / subset_idx_prev_size
+ *   2 cell_count          5 non_adj_size    7 adj_subset_size
+ *   3 use_subset
+ *   8 next_ids (u32 id, u8 lines, 3 bytes padding), non_adj
+ *     then subset_idx_prev (2-aligned), adj_subset  if use_subset
+ *     else adj_lst (4-aligned, adj_lst_size+1), adj
+ */
+struct EvaluateNodeEdgesFixed {
+  static constexpr size_t kAlign = 8;
+  static constexpr size_t kHeaderBytes = 8;
+  using NextId = std::pair<uint32_t, uint8_t>;
+  static_assert(sizeof(NextId) == 8 && alignof(NextId) == 4);
+
+  const uint8_t* base_ptr;
+  uint8_t cell_count;
+  bool use_subset;
+  const NextId* next_ids;
+  size_t next_ids_size;
+  const uint8_t* non_adj;
+  size_t non_adj_size;
+  const uint32_t* adj_lst; // length=adj_lst_size+1
+  size_t adj_lst_size;
+  const uint8_t* adj;
+  const uint8_t* adj_subset;
+  size_t adj_subset_size;
+  const std::pair<uint8_t, uint8_t>* subset_idx_prev; // (idx, prev)
+  size_t subset_idx_prev_size;
+
+  bool operator==(const EvaluateNodeEdges& x) const {
+    return EvaluateEdgeViewEqual(*this, x);
+  }
+
+  EvaluateNodeEdgesFixed() :
+      base_ptr(), cell_count(), use_subset(), next_ids_size(), non_adj_size(),
+      adj_lst_size(), adj_subset_size(), subset_idx_prev_size() {}
+  // only pointer arithmetic; data must outlive this object
+  explicit EvaluateNodeEdgesFixed(const uint8_t data[]) : base_ptr(data) {
+    cell_count = data[2];
+    use_subset = data[3];
+    next_ids_size = data[4];
+    non_adj_size = data[5];
+    size_t ind = kHeaderBytes;
+    next_ids = reinterpret_cast<const NextId*>(data + ind);
+    ind += sizeof(NextId) * next_ids_size;
+    non_adj = data + ind;
+    ind += non_adj_size;
+    if (use_subset) {
+      subset_idx_prev_size = data[6];
+      adj_subset_size = data[7];
+      ind = AlignTo(ind, 2);
+      subset_idx_prev = reinterpret_cast<decltype(subset_idx_prev)>(data + ind);
+      ind += sizeof(decltype(*subset_idx_prev)) * subset_idx_prev_size;
+      adj_subset = data + ind;
+      adj_lst_size = 0;
+    } else {
+      adj_lst_size = data[6];
+      ind = AlignTo(ind, 4);
+      adj_lst = reinterpret_cast<const uint32_t*>(data + ind);
+      ind += sizeof(uint32_t) * (adj_lst_size + 1);
+      adj = data + ind;
+      adj_subset_size = subset_idx_prev_size = 0;
+    }
+  }
+
+  size_t NumBytes() const {
+    return BytesToInt<uint16_t>(base_ptr);
+  }
+
+  // encoded size of a decoded record (EvaluateNodeEdgesFastTmpl)
+  template <class Edges>
+  static size_t NumBytes(const Edges& x) {
+    size_t ind = kHeaderBytes + sizeof(NextId) * x.next_ids_size + x.non_adj_size;
+    if (x.use_subset) {
+      ind = AlignTo(ind, 2) + 2 * x.subset_idx_prev_size + x.adj_subset_size;
+    } else {
+      ind = AlignTo(ind, 4) + sizeof(uint32_t) * (x.adj_lst_size + 1) + x.adj_lst[x.adj_lst_size];
+    }
+    return AlignTo(ind, kAlign);
+  }
+
+  // ret must hold NumBytes(x) bytes
+  template <class Edges>
+  static size_t GetBytes(const Edges& x, uint8_t ret[]) {
+    size_t sz = NumBytes(x);
+    if (sz > 65535) throw std::out_of_range("record too large");
+    memset(ret, 0, sz);
+    IntToBytes<uint16_t>(sz, ret);
+    ret[2] = x.cell_count;
+    ret[3] = x.use_subset;
+    ret[4] = x.next_ids_size;
+    ret[5] = x.non_adj_size;
+    ret[6] = x.use_subset ? x.subset_idx_prev_size : x.adj_lst_size;
+    ret[7] = x.use_subset ? x.adj_subset_size : 0;
+    size_t ind = kHeaderBytes;
+    for (size_t i = 0; i < x.next_ids_size; i++, ind += sizeof(NextId)) {
+      IntToBytes<uint32_t>(x.next_ids[i].first, ret + ind);
+      ret[ind + 4] = x.next_ids[i].second;
+    }
+    memcpy(ret + ind, x.non_adj, x.non_adj_size);
+    ind += x.non_adj_size;
+    if (x.use_subset) {
+      ind = AlignTo(ind, 2);
+      memcpy(ret + ind, x.subset_idx_prev, 2 * x.subset_idx_prev_size);
+      ind += 2 * x.subset_idx_prev_size;
+      memcpy(ret + ind, x.adj_subset, x.adj_subset_size);
+    } else {
+      ind = AlignTo(ind, 4);
+      for (size_t i = 0; i <= x.adj_lst_size; i++, ind += sizeof(uint32_t)) {
+        IntToBytes<uint32_t>(x.adj_lst[i], ret + ind);
+      }
+      memcpy(ret + ind, x.adj, x.adj_lst[x.adj_lst_size]);
+    }
+    return sz;
+  }
+
+ private:
+  static constexpr size_t AlignTo(size_t x, size_t align) {
+    return (x + align - 1) / align * align;
+  }
+};
+
 struct PositionNodeEdges {
   static constexpr bool kIsConstSize = false;
   static constexpr size_t kSizeNumberBytes = 2;
+  static constexpr uint32_t kRecordTypeId = kRecordPositionNodeEdges;
 
   std::vector<Position> nexts;
   std::vector<std::vector<Position>> adj;
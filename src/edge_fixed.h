@@ -0,0 +1,230 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+#include <filesystem>
+
+#include "io.h"
+#include "edge.h"
+#include "board.h"
+#include "files.h"
+#include "config.h"
+#include "file_header.h"
+
+/*
+ * Uncompressed edge file of EvaluateNodeEdgesFixed records, mapped and used in place.
+ * Starts with a FileHeader; the index file stores
+ * [items_per_index, offset of record 0, offset of record items_per_index, ..., end offset].
+ * The header records the compressed edge file it was converted from (SetFixedEdgeSource), so that a
+ * fixed file left behind after the edges are rebuilt is detected (FixedEdgeFile::IsConvertedFrom).
+ */
+
+// fills the source fields of the header from a compressed edge file; false if its index is missing
+inline bool SetFixedEdgeSource(FileHeader& header, const std::string& source_fname) {
+  return io_internal::SetFileSource(header, source_fname, source_fname + ".index");
+}
+
+class FixedEdgeWriter {
+  static constexpr size_t kBufferSize = 1048576;
+
+  std::vector<uint8_t> buf;
+  size_t current;
+  size_t items_per_index;
+  size_t current_written_size;
+  std::ofstream fout;
+  std::ofstream fout_ind;
+  FileHeader header;
+  bool closed;
+
+  void Flush() {
+    if (!fout.write(reinterpret_cast<const char*>(buf.data()), buf.size())) {
+      throw std::runtime_error("write failed");
+    }
+    current_written_size += buf.size();
+    buf.clear();
+  }
+
+  void WriteHeader() {
+    uint8_t out[FileHeader::kSize];
+    header.GetBytes(out);
+    fout.seekp(0);
+    if (!fout.write(reinterpret_cast<const char*>(out), sizeof(out))) {
+      throw std::runtime_error("write failed");
+    }
+  }
+
+  void WriteIndex(uint64_t val) {
+    uint8_t out[8];
+    IntToBytes<uint64_t>(val, out);
+    if (!fout_ind.write(reinterpret_cast<const char*>(out), sizeof(out))) {
+      throw std::runtime_error("write failed");
+    }
+  }
+ public:
+  FixedEdgeWriter(const std::string& fname, size_t items_per_index = 16 * kPieces) :
+      current(0), items_per_index(items_per_index), current_written_size(FileHeader::kSize),
+      header(FileHeader::Current()), closed(false) {
+    if (!items_per_index) throw std::invalid_argument("items_per_index must be positive");
+    header.record_type = kRecordEvaluateNodeEdgesFixed;
+    header.record_bytes = EvaluateNodeEdgesFixed::kAlign;
+    header.items_per_index = items_per_index;
+    MkdirForFile(fname);
+    fout.open(fname, std::ios_base::out | std::ios_base::trunc);
+    if (!fout.is_open()) throw std::runtime_error("cannot open file");
+    fout_ind.open(fname + ".index", std::ios_base::out | std::ios_base::trunc);
+    if (!fout_ind.is_open()) throw std::runtime_error("cannot open index file");
+    // record count is filled in on close
+    WriteHeader();
+    WriteIndex(items_per_index);
+    buf.reserve(kBufferSize);
+  }
+  FixedEdgeWriter(const FixedEdgeWriter&) = delete;
+
+  // records the compressed edge file the records are converted from
+  void SetSource(const std::string& source_fname) {
+    if (!SetFixedEdgeSource(header, source_fname)) throw std::runtime_error("source index file not found");
+  }
+
+  // a writer destroyed without Close leaves the record count unknown, so the file is rejected by FixedEdgeFile
+  ~FixedEdgeWriter() = default;
+
+  // writes the remaining records, the end of the index and the record count
+  void Close() {
+    if (closed) return;
+    closed = true;
+    Flush();
+    WriteIndex(current_written_size);
+    header.record_count = current;
+    WriteHeader();
+    fout.close();
+    fout_ind.close();
+    if (!fout || !fout_ind) throw std::runtime_error("write failed");
+  }
+
+  template <class Edges>
+  void Write(const Edges& item) {
+    if (closed) throw std::logic_error("writer closed");
+    if (current % items_per_index == 0) WriteIndex(current_written_size + buf.size());
+    current++;
+    size_t old_sz = buf.size();
+    buf.resize(old_sz + EvaluateNodeEdgesFixed::NumBytes(item));
+    EvaluateNodeEdgesFixed::GetBytes(item, buf.data() + old_sz);
+    if (buf.size() >= kBufferSize) Flush();
+  }
+
+  size_t Size() const {
+    return current;
+  }
+};
+
+// thread-safe; the records returned by Read are valid while this object lives
+class FixedEdgeFile {
+  io_internal::MappedFile data;
+  io_internal::MappedFile index;
+  size_t items_per_index;
+  size_t num_records;
+  FileHeader header;
+
+  uint64_t IndexWord(size_t i) const {
+    return BytesToInt<uint64_t>(index.data() + i * sizeof(uint64_t));
+  }
+ public:
+  FixedEdgeFile(const std::string& fname) : data(fname), index(fname + ".index") {
+    if (data.size() < FileHeader::kSize) throw std::runtime_error("invalid fixed edge file");
+    auto parsed = FileHeader::Parse(data.data());
+    if (!parsed || parsed->record_type != kRecordEvaluateNodeEdgesFixed) {
+      throw std::runtime_error("file record type mismatch");
+    }
+    header = *parsed;
+    header.CheckBuild();
+    if (header.record_count == FileHeader::kUnknownCount) throw std::runtime_error("incomplete file");
+    num_records = header.record_count;
+    if (index.size() < 16 || index.size() % sizeof(uint64_t)) {
+      throw std::runtime_error("unexpected index file size");
+    }
+    items_per_index = IndexWord(0);
+    if (!items_per_index ||
+        index.size() / sizeof(uint64_t) != (num_records + items_per_index - 1) / items_per_index + 2 ||
+        IndexWord(index.size() / sizeof(uint64_t) - 1) != data.size()) {
+      throw std::runtime_error("invalid index file");
+    }
+  }
+  FixedEdgeFile(const FixedEdgeFile&) = delete;
+
+  size_t Size() const {
+    return num_records;
+  }
+
+  // false if the compressed edge file was rewritten after the conversion (or the source was not recorded)
+  bool IsConvertedFrom(const std::string& source_fname) const {
+    FileHeader cur;
+    return header.HasSource() && SetFixedEdgeSource(cur, source_fname) && cur.SameSource(header);
+  }
+
+  // returns the number of records read
+  size_t Read(size_t start, EvaluateNodeEdgesFixed out[], size_t num) const {
+    if (start > num_records) throw std::out_of_range("index out of range");
+    num = std::min(num, num_records - start);
+    size_t offset = IndexWord(start / items_per_index + 1);
+    for (size_t i = start / items_per_index * items_per_index; i < start; i++) {
+      if (offset >= data.size()) throw std::runtime_error("read failure");
+      offset += BytesToInt<uint16_t>(data.data() + offset);
+    }
+    for (size_t i = 0; i < num; i++) {
+      if (offset >= data.size()) throw std::runtime_error("read failure");
+      out[i] = EvaluateNodeEdgesFixed(data.data() + offset);
+      offset += out[i].NumBytes();
+    }
+    return num;
+  }
+};
+
+// ParallelScan over a fixed edge file; func(batch_begin, std::vector<EvaluateNodeEdgesFixed>& items)
+// the records are used in place, so every batch is read and called back on one of opts.workers threads
+// (io_threads, read_ahead and direct_io do not apply)
+template <class Func>
+void ParallelScan(const FixedEdgeFile& file, size_t begin, size_t end, size_t batch,
+                  Func&& func, const ScanOptions& opts = {}) {
+  if (!opts.unit || begin % opts.unit || batch % opts.unit) throw std::invalid_argument("unaligned scan");
+  ScanOptions fixed_opts = opts;
+  fixed_opts.io_threads = std::max(opts.workers, (size_t)1);
+  fixed_opts.workers = 0;
+  ParallelScanChunks(begin, end, opts.unit, batch, [&](size_t chunk_begin) {
+    return [&file, pos = chunk_begin](size_t num) mutable {
+      std::vector<EvaluateNodeEdgesFixed> items(num);
+      if (file.Read(pos, items.data(), num) != num) throw std::runtime_error("read failure");
+      pos += num;
+      return items;
+    };
+  }, [&](size_t pos, std::vector<EvaluateNodeEdgesFixed>&& items) {
+    func(pos, items);
+  }, fixed_opts);
+}
+
+// logs once per file that a fixed edge file is ignored; defined in board_set.cpp
+void WarnStaleFixedEdges(const std::string& fixed_fname);
+
+// scan evaluate edges [begin, end) of a group and speed level with the I/O settings of this run
+// the fixed edge file is used in place if it exists and was converted from the current edges,
+// otherwise the compressed edges are decoded;
+// func(batch_begin, items) receives a std::vector of EvaluateNodeEdgesFixed or EvaluateNodeEdgesFast
+template <class Func>
+void ScanEvaluateEdges(int group, int level, size_t begin, size_t end, size_t batch, Func&& func) {
+  ScanOptions opts{
+      .io_threads = (size_t)kIOThreads, .workers = (size_t)kParallel, .unit = kPieces,
+      .read_ahead = (size_t)kReadAhead, .direct_io = kDirectIO};
+  std::string fname = EvaluateEdgePath(group, level);
+  std::string fixed_fname = EvaluateEdgeFixedPath(group, level);
+  if (std::filesystem::exists(fixed_fname)) {
+    FixedEdgeFile edge_file(fixed_fname);
+    if (edge_file.IsConvertedFrom(fname)) {
+      ParallelScan(edge_file, begin, end, batch, func, opts);
+      return;
+    }
+    WarnStaleFixedEdges(fixed_fname);
+  }
+  ParallelScan<EvaluateNodeEdgesFast>(fname, begin, end, batch, func, opts);
+}
@@ -11,6 +11,7 @@
 #include <spdlog/fmt/ranges.h>
 #pragma GCC diagnostic pop
 #include "edge.h"
+#include "edge_fixed.h"
 #include "game.h"
 #include "board.h"
 #include "config.h"
@@ -45,11 +46,12 @@ struct Stats {
   }
 } stats;
 
+template <class Edges, class Value>
 void CalculateBlock(
-    const EvaluateNodeEdgesFast* edges, size_t edges_size,
-    const std::vector<NodeEval>& prev,
+    const Edges* edges, size_t edges_size,
+    const std::vector<Value>& prev,
     int base_lines,
-    NodeEval out[]) {
+    Value out[]) {
   if (!edges_size) return;
   if (edges_size % kPieces != 0) throw std::logic_error("unexpected: not multiples of 7");
   size_t boards = edges_size / kPieces;
@@ -60,11 +62,8 @@ void CalculateBlock(
     for (size_t piece = 0; piece < kPieces; piece++) {
       auto& item = edges[b * kPieces + piece];
       if (!item.next_ids_size) continue;
-      for (size_t i = 0; i < item.next_ids_size; i++) {
-        auto& [next, lines] = item.next_ids[i];
-        local_val[i] = prev[next];
-        local_val[i] += Score(base_lines, lines);
-      }
+      GatherValues(prev.data(), item.next_ids, item.next_ids_size, local_val);
+      for (size_t i = 0; i < item.next_ids_size; i++) local_val[i] += Score(base_lines, item.next_ids[i].second);
       __m256 probs = _mm256_load_ps(kTransitionProb[piece]);
       NodeEval result(_mm256_setzero_ps(), _mm256_setzero_ps());
       float mx_ev = 0.;
@@ -101,77 +100,25 @@ void CalculateBlock(
   }
 }
 
+template <class Value>
 void CalculateSameLines(
-    int group, size_t start, size_t end, const std::vector<NodeEval>& prev, int lines,
-    NodeEval out[]) {
+    int group, size_t start, size_t end, const std::vector<Value>& prev, int lines,
+    Value out[]) {
   constexpr size_t kBatchSize = 1024;
-  constexpr size_t kBlockSize = 524288;
 
   int level = GetLevelByLines(lines);
-  auto fname = EvaluateEdgePath(group, GetLevelSpeed(level));
-  using Result = std::pair<size_t, size_t>;
-
-  BS::thread_pool io_pool(kIOThreads);
-  auto thread_queue = MakeThreadQueue<Result>(kParallel,
-      [&](Result range) {
-        /* collect stats */
+  ScanEvaluateEdges(group, GetLevelSpeed(level), start * kPieces, end * kPieces, kBatchSize * kPieces,
+      [&](size_t pos, auto& edges) {
+        size_t batch_l = pos / kPieces;
+        CalculateBlock(edges.data(), edges.size(), prev, lines, out + batch_l);
       });
-
-  std::mutex mtx;
-  std::condition_variable cv;
-  size_t unfinished = 0;
-  std::deque<std::function<Result()>> works;
-
-  std::vector<std::thread> thrs;
-  for (size_t block_start = start; block_start < end; block_start += kBlockSize) {
-    size_t block_end = std::min(end, block_start + kBlockSize);
-    unfinished++;
-    io_pool.push_task([&fname,&thread_queue,&works,&unfinished,&cv,&mtx,block_start,block_end,&prev,lines,out]() {
-      CompressedClassReader<EvaluateNodeEdgesFast> reader(fname);
-      reader.Seek(block_start * kPieces);
-      for (size_t batch_l = block_start; batch_l < block_end; batch_l += kBatchSize) {
-        size_t batch_r = std::min(block_end, batch_l + kBatchSize);
-        size_t num_to_read = (batch_r - batch_l) * kPieces;
-        std::unique_ptr<EvaluateNodeEdgesFast[]> edges(new EvaluateNodeEdgesFast[num_to_read]);
-        if (num_to_read != reader.ReadBatch(edges.get(), num_to_read)) throw std::runtime_error("read failure");
-        {
-          std::lock_guard lck(mtx);
-          works.push_back(make_copyable_function([
-                edges=std::move(edges),&works,&unfinished,&cv,&mtx,num_to_read,batch_l,batch_r,&prev,lines,out
-          ]() {
-            CalculateBlock(edges.get(), num_to_read, prev, lines, out + batch_l);
-            return std::make_pair(batch_l, batch_r);
-          }));
-        }
-        cv.notify_one();
-      }
-      {
-        std::lock_guard lck(mtx);
-        unfinished--;
-      }
-      cv.notify_one();
-    });
-  }
-  {
-    std::unique_lock lck(mtx);
-    while (unfinished) {
-      cv.wait(lck, [&]{ return unfinished == 0 || works.size(); });
-      while (works.size()) {
-        thread_queue.Push(std::move(works.front()));
-        works.pop_front();
-      }
-    }
-  }
-  io_pool.wait_for_tasks();
-  thread_queue.WaitAll();
 }
 
-} // namespace
-
-std::vector<NodeEval> CalculatePiece(
-    int pieces, const std::vector<NodeEval>& prev, const std::vector<size_t>& offsets) {
+template <class Value>
+std::vector<Value> CalculatePieceImpl(
+    int pieces, const std::vector<Value>& prev, const std::vector<size_t>& offsets) {
   int group = GetGroupByPieces(pieces);
-  std::vector<NodeEval> ret(offsets.back());
+  std::vector<Value> ret(offsets.back());
 
   spdlog::info("Start calculate piece {}", pieces);
   stats.Clear();
@@ -187,7 +134,7 @@ std::vector<NodeEval> CalculatePiece(
     int lines = cells / 10;
     if (lines >= kLineCap) {
       // lines will decrease as i increase, so this only happen at the start of the loop
-      memset(ret.data() + start, 0x0, (offsets[i + 1] - start) * sizeof(NodeEval));
+      memset(ret.data() + start, 0x0, (offsets[i + 1] - start) * sizeof(Value));
       start = offsets[i + 1];
       continue;
     }
@@ -219,31 +166,80 @@ std::vector<NodeEval> CalculatePiece(
   return ret;
 }
 
-std::vector<NodeEval> ReadValues(int pieces, size_t total_size) {
-  int group = GetGroupByPieces(pieces);
-  if (!total_size) total_size = BoardCount(BoardPath(group));
-  CompressedClassReader<NodeEval> reader(ValuePath(pieces));
-  auto values = reader.ReadBatch(total_size);
-  if (values.size() != total_size) throw std::length_error("value file length incorrect");
-  return values;
+} // namespace
+
+std::vector<NodeEval> CalculatePiece(
+    int pieces, const std::vector<NodeEval>& prev, const std::vector<size_t>& offsets) {
+  return CalculatePieceImpl(pieces, prev, offsets);
+}
+
+std::vector<NodeEvalHalf> CalculatePiece(
+    int pieces, const std::vector<NodeEvalHalf>& prev, const std::vector<size_t>& offsets) {
+  return CalculatePieceImpl(pieces, prev, offsets);
+}
+
+namespace {
+
+bool IsHalfValueFile(const std::filesystem::path& fname) {
+  auto header = ReadFileHeader(fname);
+  return header && header->record_type == kRecordNodeEvalHalf;
 }
 
-std::vector<MoveEval> ReadValuesEvOnly(int pieces, size_t total_size) {
+// read a value file of type Stored, converting each value to T
+template <class Stored, class T, class Func>
+std::vector<T> ReadValuesAs(const std::filesystem::path& fname, size_t total_size, Func&& convert) {
   constexpr size_t kBatchSize = 131072;
-  int group = GetGroupByPieces(pieces);
-  if (!total_size) total_size = BoardCount(BoardPath(group));
-  CompressedClassReader<NodeEval> reader(ValuePath(pieces));
-  std::vector<MoveEval> values;
+  CompressedClassReader<Stored> reader(fname, true);
+  std::vector<T> values;
   values.reserve(total_size);
   for (size_t i = 0; i < total_size; i += kBatchSize) {
     auto vec = reader.ReadBatch(kBatchSize);
-    for (auto& x : vec) values.emplace_back(x.ev_vec);
+    for (auto& x : vec) values.emplace_back(convert(x));
   }
   if (values.size() != total_size) throw std::length_error("value file length incorrect");
   return values;
 }
 
-void RunEvaluate(int start_pieces, const std::vector<int>& output_locations, bool sample) {
+} // namespace
+
+template <class T>
+std::vector<T> ReadValues(int pieces, size_t total_size) {
+  int group = GetGroupByPieces(pieces);
+  if (!total_size) total_size = BoardCount(BoardPath(group));
+  auto fname = ValuePath(pieces);
+  bool half = IsHalfValueFile(fname);
+  if (half == std::is_same_v<T, NodeEvalHalf>) {
+    CompressedClassReader<T> reader(fname, true);
+    auto values = reader.ReadBatch(total_size);
+    if (values.size() != total_size) throw std::length_error("value file length incorrect");
+    return values;
+  }
+  if (half) return ReadValuesAs<NodeEvalHalf, T>(fname, total_size, [](const NodeEvalHalf& x) { return T(x); });
+  return ReadValuesAs<NodeEval, T>(fname, total_size, [](const NodeEval& x) { return T(x); });
+}
+
+template std::vector<NodeEval> ReadValues<NodeEval>(int, size_t);
+template std::vector<NodeEvalHalf> ReadValues<NodeEvalHalf>(int, size_t);
+
+template <class T>
+std::vector<T> ReadValuesEvOnly(int pieces, size_t total_size) {
+  int group = GetGroupByPieces(pieces);
+  if (!total_size) total_size = BoardCount(BoardPath(group));
+  auto fname = ValuePath(pieces);
+  if (IsHalfValueFile(fname)) {
+    return ReadValuesAs<NodeEvalHalf, T>(fname, total_size, [](const NodeEvalHalf& x) { return T(MoveEval(x.EvVec())); });
+  }
+  return ReadValuesAs<NodeEval, T>(fname, total_size, [](const NodeEval& x) { return T(MoveEval(x.ev_vec)); });
+}
+
+template std::vector<MoveEval> ReadValuesEvOnly<MoveEval>(int, size_t);
+template std::vector<MoveEvalPacked> ReadValuesEvOnly<MoveEvalPacked>(int, size_t);
+template std::vector<MoveEvalHalf> ReadValuesEvOnly<MoveEvalHalf>(int, size_t);
+
+namespace {
+
+template <class Value>
+void RunEvaluateImpl(int start_pieces, const std::vector<int>& output_locations, bool sample) {
   std::vector<size_t> offsets[kGroups];
   for (int i = 0; i < kGroups; i++) offsets[i] = GetBoardCountOffset(i);
 
@@ -277,7 +273,7 @@ void RunEvaluate(int start_pieces, const std::vector<int>& output_locations, boo
     }
   }
 
-  std::vector<NodeEval> values;
+  std::vector<Value> values;
   if (start_pieces == -1) {
     size_t max_cells = 0;
     for (int i = 0; i < kGroups; i++) {
@@ -286,10 +282,10 @@ void RunEvaluate(int start_pieces, const std::vector<int>& output_locations, boo
     start_pieces = (kLineCap * 10 + max_cells + 3) / 4;
     int start_group = GetGroupByPieces(start_pieces);
     values.resize(offsets[start_group].back());
-    memset(values.data(), 0x0, values.size() * sizeof(NodeEval));
+    memset(values.data(), 0x0, values.size() * sizeof(Value));
   } else {
     int start_group = GetGroupByPieces(start_pieces);
-    values = ReadValues(start_pieces, offsets[start_group].back());
+    values = ReadValues<Value>(start_pieces, offsets[start_group].back());
     if (values.size() != offsets[start_group].back()) throw std::length_error("initial value file incorrect");
   }
 
@@ -300,7 +296,8 @@ void RunEvaluate(int start_pieces, const std::vector<int>& output_locations, boo
     values = CalculatePiece(pieces, values, offsets[GetGroupByPieces(pieces)]);
     if (location_set.count(pieces)) {
       spdlog::info("Writing values of piece {}", pieces);
-      CompressedClassWriter<NodeEval> writer(ValuePath(pieces), 2048);
+      CompressedClassWriter<Value> writer(
+          ValuePath(pieces), 2048, std::make_unique<ParallelZstdCompressor>(kParallel));
       writer.Write(values);
     }
     if (sample) {
@@ -316,3 +313,13 @@ void RunEvaluate(int start_pieces, const std::vector<int>& output_locations, boo
     }
   }
 }
+
+} // namespace
+
+void RunEvaluate(int start_pieces, const std::vector<int>& output_locations, bool sample, bool half) {
+  if (half) {
+    RunEvaluateImpl<NodeEvalHalf>(start_pieces, output_locations, sample);
+  } else {
+    RunEvaluateImpl<NodeEval>(start_pieces, output_locations, sample);
+  }
+}
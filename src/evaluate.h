@@ -5,6 +5,8 @@
 #include <vector>
 #include <immintrin.h>
 
+#include "file_header.h"
+
 class MoveEval {
  protected:
   static constexpr size_t kVecOutputSize = 7 * sizeof(float);
@@ -96,6 +98,7 @@ class NodeEval : public MoveEval {
 
   static constexpr bool kIsConstSize = true;
   static constexpr size_t NumBytes() { return kVecOutputSize * 2; }
+  static constexpr uint32_t kRecordTypeId = kRecordNodeEval;
 
   void GetBytes(uint8_t ret[]) const {
     GetEv(reinterpret_cast<float*>(ret));
@@ -133,10 +136,134 @@ class NodeEval : public MoveEval {
   }
 };
 
+// scaled IEEE half floats (F16C) for compact value storage; about 3 significant digits
+#ifdef TETRIS_ONLY
+constexpr float kHalfScale = 1;
+#else
+constexpr float kHalfScale = 64; // largest half is 65504, so values up to ~4.19M are representable
+#endif
+
+inline __m128i PackHalf(__m256 x) {
+  return _mm256_cvtps_ph(_mm256_mul_ps(x, _mm256_set1_ps(1 / kHalfScale)), _MM_FROUND_TO_NEAREST_INT);
+}
+inline __m256 UnpackHalf(const uint16_t x[]) {
+  return _mm256_mul_ps(_mm256_cvtph_ps(_mm_load_si128(reinterpret_cast<const __m128i*>(x))), _mm256_set1_ps(kHalfScale));
+}
+
+// half-size NodeEval storing ev and standard deviation as half floats;
+// converted to NodeEval when loaded for calculation
+class NodeEvalHalf {
+  static constexpr size_t kVecOutputSize = 7 * sizeof(uint16_t);
+
+  alignas(16) uint16_t ev[8];
+  alignas(16) uint16_t sd[8];
+
+  static __m256 LoadFloats(const float buf[]) {
+    alignas(32) float x[8] = {};
+    memcpy(x, buf, 7 * sizeof(float));
+    return _mm256_load_ps(x);
+  }
+ public:
+  NodeEvalHalf() {}
+  NodeEvalHalf(const NodeEval& x) {
+    SetEv(x.ev_vec);
+    SetVar(x.var_vec);
+  }
+  NodeEvalHalf(const uint8_t buf[], size_t) : ev(), sd() {
+    memcpy(ev, buf, kVecOutputSize);
+    memcpy(sd, buf + kVecOutputSize, kVecOutputSize);
+  }
+
+  static constexpr bool kIsConstSize = true;
+  static constexpr size_t NumBytes() { return kVecOutputSize * 2; }
+  static constexpr uint32_t kRecordTypeId = kRecordNodeEvalHalf;
+
+  void GetBytes(uint8_t ret[]) const {
+    memcpy(ret, ev, kVecOutputSize);
+    memcpy(ret + kVecOutputSize, sd, kVecOutputSize);
+  }
+
+  operator NodeEval() const {
+    __m256 sd_vec = UnpackHalf(sd);
+    return NodeEval(EvVec(), _mm256_mul_ps(sd_vec, sd_vec));
+  }
+  __m256 EvVec() const { return UnpackHalf(ev); }
+
+  void SetEv(__m256 vec) {
+    _mm_store_si128(reinterpret_cast<__m128i*>(ev), PackHalf(vec));
+  }
+  void SetVar(__m256 vec) {
+    _mm_store_si128(reinterpret_cast<__m128i*>(sd), PackHalf(_mm256_sqrt_ps(_mm256_max_ps(vec, _mm256_setzero_ps()))));
+  }
+  void LoadEv(const float buf[]) { SetEv(LoadFloats(buf)); }
+  void LoadVar(const float buf[]) { SetVar(LoadFloats(buf)); }
+  void GetEv(float buf[]) const { MoveEval(EvVec()).GetEv(buf); }
+  void GetVar(float buf[]) const { static_cast<NodeEval>(*this).GetVar(buf); }
+};
+
+// packed MoveEval for the large value arrays of the move / threshold / prune passes: 7 unaligned floats (28 bytes)
+class MoveEvalPacked {
+  float ev[7];
+ public:
+  MoveEvalPacked() {}
+  MoveEvalPacked(const MoveEval& x) { x.GetEv(ev); }
+
+  operator MoveEval() const { return EvVec(); }
+  __m256 EvVec() const {
+    return _mm256_maskload_ps(ev, _mm256_setr_epi32(-1, -1, -1, -1, -1, -1, -1, 0));
+  }
+  void LoadEv(const float buf[]) { memcpy(ev, buf, sizeof(ev)); }
+  void GetEv(float buf[]) const { memcpy(buf, ev, sizeof(ev)); }
+};
+
+// MoveEval as 7 half floats (16 bytes)
+class MoveEvalHalf {
+  alignas(16) uint16_t ev[8];
+ public:
+  MoveEvalHalf() {}
+  MoveEvalHalf(const MoveEval& x) {
+    _mm_store_si128(reinterpret_cast<__m128i*>(ev), PackHalf(x.ev_vec));
+  }
+
+  operator MoveEval() const { return EvVec(); }
+  __m256 EvVec() const { return UnpackHalf(ev); }
+  void LoadEv(const float buf[]) { *this = MoveEvalHalf(MoveEval(buf)); }
+  void GetEv(float buf[]) const { MoveEval(EvVec()).GetEv(buf); }
+};
+
+// out[i] = prev[next_ids[i].first], widened from the storage type;
+// all rows are prefetched first so that the cache misses of the random gathers overlap
+// (rows not aligned to the cache line, e.g. the 28-byte MoveEvalPacked, may span two lines)
+template <class Eval, class Value, class NextId>
+inline void GatherValues(const Value prev[], const NextId next_ids[], size_t num, Eval out[]) {
+  constexpr uintptr_t kLine = 64;
+  for (size_t i = 0; i < num; i++) {
+    const char* first = reinterpret_cast<const char*>(prev + next_ids[i].first);
+    const char* last = reinterpret_cast<const char*>(prev + next_ids[i].first + 1) - 1;
+    _mm_prefetch(first, _MM_HINT_T0);
+    if constexpr (sizeof(Value) % kLine != 0) {
+      if ((reinterpret_cast<uintptr_t>(first) ^ reinterpret_cast<uintptr_t>(last)) >= kLine) {
+        _mm_prefetch(last, _MM_HINT_T0);
+      }
+    }
+  }
+  for (size_t i = 0; i < num; i++) out[i] = prev[next_ids[i].first];
+}
+
 std::vector<NodeEval> CalculatePiece(
     int pieces, const std::vector<NodeEval>& prev, const std::vector<size_t>& offsets);
-std::vector<MoveEval> CalculatePiece( // implemented in move.cpp
+std::vector<NodeEvalHalf> CalculatePiece(
+    int pieces, const std::vector<NodeEvalHalf>& prev, const std::vector<size_t>& offsets);
+// implemented in move.cpp
+std::vector<MoveEval> CalculatePiece(
     int pieces, const std::vector<MoveEval>& prev, const std::vector<size_t>& offsets);
-std::vector<NodeEval> ReadValues(int pieces, size_t total_size = 0);
-std::vector<MoveEval> ReadValuesEvOnly(int pieces, size_t total_size = 0);
-void RunEvaluate(int start_pieces, const std::vector<int>& output_locations, bool sample);
+std::vector<MoveEvalPacked> CalculatePiece(
+    int pieces, const std::vector<MoveEvalPacked>& prev, const std::vector<size_t>& offsets);
+std::vector<MoveEvalHalf> CalculatePiece(
+    int pieces, const std::vector<MoveEvalHalf>& prev, const std::vector<size_t>& offsets);
+// value files may be stored as NodeEval or NodeEvalHalf; both are converted to the requested type
+template <class T = NodeEval> std::vector<T> ReadValues(int pieces, size_t total_size = 0);
+// T = MoveEval / MoveEvalPacked / MoveEvalHalf
+template <class T = MoveEval> std::vector<T> ReadValuesEvOnly(int pieces, size_t total_size = 0);
+// half: keep values as NodeEvalHalf in memory and in the value files
+void RunEvaluate(int start_pieces, const std::vector<int>& output_locations, bool sample, bool half = false);
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <algorithm>
+#include <fstream>
+#include <optional>
+#include <stdexcept>
+
+#include "game.h"
+#include "constexpr_helpers.h"
+
+#define FILE_HEADER_STR_(x) #x
+#define FILE_HEADER_STR(x) FILE_HEADER_STR_(x)
+
+// ids of record types stored by ClassWriter / CompressedClassWriter
+// types read with a different in-memory representation (e.g. *Fast) share the id of the written type
+enum RecordTypeId : uint32_t {
+  kRecordUnknown = 0, // not checked
+  kRecordCompactBoard,
+  kRecordEvaluateNodeEdges,
+  kRecordPositionNodeEdges,
+  kRecordNodeEval,
+  kRecordNodeMoveIndexRange,
+  kRecordNodeMovePositionRange,
+  kRecordNodeMoveBoardRange,
+  kRecordNodePartialThreshold,
+  kRecordPruneMask,
+  kRecordEvaluateNodeEdgesFixed,
+  kRecordNodeEvalHalf,
+};
+
+/*
+ * Fixed-size header at the beginning of every file written by ClassWriter / CompressedClassWriter.
+ * All offsets in the index file are absolute, so they include the header.
+ * Files without the magic are treated as headerless (old format).
+ *
+ *   0 magic[8]        24 line_cap        48 tap_speed[16]
+ *   8 version         28 adj_delay       64 items_per_index (u64)
+ *  12 flags           32 groups          72 record_count (u64)
+ *  16 record_type     36 levels          80 source_count (u64)
+ *  20 record_bytes    40 build_flags     88 source_index_size (u64)
+ *                                        96 source_index_mtime (u64)
+ *                                       104 reserved
+ */
+struct FileHeader {
+  static constexpr size_t kSize = 128;
+  static constexpr uint32_t kVersion = 1;
+  static constexpr char kMagic[8] = {'B', 'T', 'T', 'B', 'F', 'I', 'L', 'E'};
+  static constexpr uint64_t kUnknownCount = -1;
+
+  // flags
+  static constexpr uint32_t kCompressed = 1;
+  static constexpr uint32_t kConstSize = 2;
+  // the index stores a checksum of every compressed block
+  static constexpr uint32_t kBlockChecksum = 4;
+  // build_flags
+  static constexpr uint32_t kDoubleTuck = 1;
+
+  uint32_t version = kVersion;
+  uint32_t flags = 0;
+  uint32_t record_type = kRecordUnknown;
+  // NumBytes() for const-size records, kSizeNumberBytes otherwise
+  uint32_t record_bytes = 0;
+  uint32_t line_cap = 0;
+  uint32_t adj_delay = 0;
+  uint32_t groups = 0;
+  uint32_t levels = 0;
+  uint32_t build_flags = 0;
+  std::string tap_speed;
+  uint64_t items_per_index = 0;
+  // kUnknownCount if the writer did not finish
+  uint64_t record_count = kUnknownCount;
+  // files derived from another file (fixed edge files, board samples): the record count of the source
+  // file, and the size and modification time (ns) of its index, or of the file itself if it has no index;
+  // all 0 if not recorded
+  uint64_t source_count = 0;
+  uint64_t source_index_size = 0;
+  uint64_t source_index_mtime = 0;
+
+  bool HasSource() const { return source_index_mtime != 0; }
+  bool SameSource(const FileHeader& x) const {
+    return source_count == x.source_count && source_index_size == x.source_index_size &&
+        source_index_mtime == x.source_index_mtime;
+  }
+
+  // header with the build parameters of this binary
+  static FileHeader Current() {
+    FileHeader ret;
+    ret.line_cap = kLineCap;
+#ifdef ADJ_DELAY
+    ret.adj_delay = ADJ_DELAY;
+#endif
+#ifdef TAP_SPEED
+    ret.tap_speed = FILE_HEADER_STR(TAP_SPEED);
+#endif
+    ret.groups = kGroups;
+    ret.levels = kLevels;
+    ret.build_flags = kDoubleTuckAllowed ? kDoubleTuck : 0;
+    return ret;
+  }
+
+  static std::optional<FileHeader> Parse(const uint8_t buf[kSize]) {
+    if (memcmp(buf, kMagic, sizeof(kMagic)) != 0) return std::nullopt;
+    FileHeader ret;
+    ret.version = BytesToInt<uint32_t>(buf + 8);
+    if (ret.version > kVersion) throw std::runtime_error("unsupported file version");
+    ret.flags = BytesToInt<uint32_t>(buf + 12);
+    ret.record_type = BytesToInt<uint32_t>(buf + 16);
+    ret.record_bytes = BytesToInt<uint32_t>(buf + 20);
+    ret.line_cap = BytesToInt<uint32_t>(buf + 24);
+    ret.adj_delay = BytesToInt<uint32_t>(buf + 28);
+    ret.groups = BytesToInt<uint32_t>(buf + 32);
+    ret.levels = BytesToInt<uint32_t>(buf + 36);
+    ret.build_flags = BytesToInt<uint32_t>(buf + 40);
+    ret.tap_speed = std::string(reinterpret_cast<const char*>(buf + 48), strnlen(reinterpret_cast<const char*>(buf + 48), 16));
+    ret.items_per_index = BytesToInt<uint64_t>(buf + 64);
+    ret.record_count = BytesToInt<uint64_t>(buf + 72);
+    ret.source_count = BytesToInt<uint64_t>(buf + 80);
+    ret.source_index_size = BytesToInt<uint64_t>(buf + 88);
+    ret.source_index_mtime = BytesToInt<uint64_t>(buf + 96);
+    return ret;
+  }
+
+  void GetBytes(uint8_t ret[kSize]) const {
+    memset(ret, 0, kSize);
+    memcpy(ret, kMagic, sizeof(kMagic));
+    IntToBytes<uint32_t>(version, ret + 8);
+    IntToBytes<uint32_t>(flags, ret + 12);
+    IntToBytes<uint32_t>(record_type, ret + 16);
+    IntToBytes<uint32_t>(record_bytes, ret + 20);
+    IntToBytes<uint32_t>(line_cap, ret + 24);
+    IntToBytes<uint32_t>(adj_delay, ret + 28);
+    IntToBytes<uint32_t>(groups, ret + 32);
+    IntToBytes<uint32_t>(levels, ret + 36);
+    IntToBytes<uint32_t>(build_flags, ret + 40);
+    memcpy(ret + 48, tap_speed.data(), std::min(tap_speed.size(), (size_t)16));
+    IntToBytes<uint64_t>(items_per_index, ret + 64);
+    IntToBytes<uint64_t>(record_count, ret + 72);
+    IntToBytes<uint64_t>(source_count, ret + 80);
+    IntToBytes<uint64_t>(source_index_size, ret + 88);
+    IntToBytes<uint64_t>(source_index_mtime, ret + 96);
+  }
+
+  // throws if the file was produced by a binary built with different parameters
+  void CheckBuild() const {
+    FileHeader cur = Current();
+    auto Check = [](const char* name, auto file_val, auto cur_val) {
+      if (file_val == cur_val) return;
+      throw std::runtime_error(
+          std::string("file built with different ") + name + " (file: " + ToString(file_val) +
+          ", current: " + ToString(cur_val) + ")");
+    };
+    Check("LINE_CAP", line_cap, cur.line_cap);
+    Check("kGroups", groups, cur.groups);
+    Check("kLevels", levels, cur.levels);
+    Check("build flags", build_flags, cur.build_flags);
+    // unset in some auxiliary builds
+    if (adj_delay && cur.adj_delay) Check("ADJ_DELAY", adj_delay, cur.adj_delay);
+    if (tap_speed.size() && cur.tap_speed.size()) Check("TAP_SPEED", tap_speed, cur.tap_speed);
+  }
+
+ private:
+  static std::string ToString(const std::string& x) { return x; }
+  static std::string ToString(uint32_t x) { return std::to_string(x); }
+};
+
+// nullopt if the file has no header
+inline std::optional<FileHeader> ReadFileHeader(const std::string& fname) {
+  std::ifstream fin(fname, std::ios_base::binary);
+  if (!fin.is_open()) throw std::runtime_error("cannot open file");
+  uint8_t buf[FileHeader::kSize];
+  if (!fin.read(reinterpret_cast<char*>(buf), sizeof(buf))) return std::nullopt;
+  return FileHeader::Parse(buf);
+}
@@ -5,6 +5,7 @@
 #include <algorithm>
 #include <filesystem>
 #include "board.h"
+#include "file_header.h"
 #include "config.h"
 
 namespace fs = std::filesystem;
@@ -38,9 +39,24 @@ fs::path BoardPath(int group) {
 fs::path BoardMapPath(int group) {
   return kDataDir / "boards" / (std::to_string(group) + ".map");
 }
+fs::path BoardHashPath(int group) {
+  return kDataDir / "boards" / (std::to_string(group) + ".mphf");
+}
+fs::path BoardSamplePath(int group) {
+  return kDataDir / "boards" / (std::to_string(group) + ".sample");
+}
+fs::path BoardFilterPath(int group) {
+  return kDataDir / "boards" / (std::to_string(group) + ".filter");
+}
+fs::path BoardRemapPath(int group) {
+  return kDataDir / "boards" / (std::to_string(group) + ".remap");
+}
 fs::path EvaluateEdgePath(int group, int level) {
   return kDataDir / "edges" / (std::to_string(group) + ".l" + std::to_string(level) + ".eval");
 }
+fs::path EvaluateEdgeFixedPath(int group, int level) {
+  return kDataDir / "edges" / (std::to_string(group) + ".l" + std::to_string(level) + ".fixed");
+}
 fs::path PositionEdgePath(int group, int level) {
   return kDataDir / "edges" / (std::to_string(group) + ".l" + std::to_string(level) + ".pos");
 }
@@ -99,7 +115,10 @@ fs::path SVDResultListPath(bool ev, int rank) {
 }
 
 uint64_t BoardCount(const fs::path& board_file) {
-  return fs::file_size(board_file) / kBoardBytes;
+  auto header = ReadFileHeader(board_file);
+  if (!header) return fs::file_size(board_file) / kBoardBytes;
+  if (header->record_count != FileHeader::kUnknownCount) return header->record_count;
+  return (fs::file_size(board_file) - FileHeader::kSize) / kBoardBytes;
 }
 
 bool MkdirForFile(fs::path path) {
@@ -7,7 +7,12 @@
 // group = 0,1,2,3,4 (count/2%5)
 std::filesystem::path BoardPath(int group);
 std::filesystem::path BoardMapPath(int group);
+std::filesystem::path BoardHashPath(int group);
+std::filesystem::path BoardSamplePath(int group);
+std::filesystem::path BoardFilterPath(int group);
+std::filesystem::path BoardRemapPath(int group);
 std::filesystem::path EvaluateEdgePath(int group, int level);
+std::filesystem::path EvaluateEdgeFixedPath(int group, int level);
 std::filesystem::path PositionEdgePath(int group, int level);
 std::filesystem::path ValuePath(int pieces);
 std::filesystem::path ValueStatsPath(int pieces);
@@ -1,34 +1,281 @@
 #pragma once
 
+#include <cerrno>
 #include <cstdint>
+#include <cstdlib>
 #include <cstring>
+#include <map>
+#include <numeric>
+#include <mutex>
+#include <tuple>
 #include <vector>
+#include <optional>
+#include <exception>
+#include <type_traits>
+#include <condition_variable>
 #include <fstream>
+#include <iterator>
 #include <stdexcept>
+#include <unordered_map>
 #include <zstd.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "files.h"
+#include "checksum.h"
 #include "compressor.h"
+#include "block_cache.h"
+#include "file_header.h"
+#include "thread_pool.hpp"
 #include "constexpr_helpers.h"
 
 namespace io_internal {
 
+// read-only mapping of a whole file
+class MappedFile {
+  const uint8_t* ptr;
+  size_t sz;
+ public:
+  MappedFile(const std::string& fname) : ptr(nullptr), sz(0) {
+    int fd = open(fname.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("cannot open file");
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+      close(fd);
+      throw std::runtime_error("cannot stat file");
+    }
+    sz = st.st_size;
+    if (sz) {
+      void* addr = mmap(nullptr, sz, PROT_READ, MAP_SHARED, fd, 0);
+      if (addr == MAP_FAILED) {
+        close(fd);
+        throw std::runtime_error("mmap failed");
+      }
+      ptr = static_cast<const uint8_t*>(addr);
+    }
+    close(fd);
+  }
+  MappedFile(const MappedFile&) = delete;
+  ~MappedFile() {
+    if (ptr) munmap(const_cast<uint8_t*>(ptr), sz);
+  }
+
+  const uint8_t* data() const { return ptr; }
+  size_t size() const { return sz; }
+};
+
+// file read with O_DIRECT, bypassing the page cache
+// falls back to buffered reads if the filesystem does not support O_DIRECT
+class DirectFile {
+  static constexpr size_t kAlignment = 4096;
+  struct FreeDeleter {
+    void operator()(uint8_t* ptr) const { free(ptr); }
+  };
+  using AlignedBuffer = std::unique_ptr<uint8_t[], FreeDeleter>;
+
+  int fd;
+  size_t sz;
+  bool direct;
+ public:
+  DirectFile(const std::string& fname) : fd(-1), sz(0), direct(true) {
+    fd = open(fname.c_str(), O_RDONLY | O_DIRECT);
+    if (fd < 0 && errno == EINVAL) {
+      direct = false;
+      fd = open(fname.c_str(), O_RDONLY);
+    }
+    if (fd < 0) throw std::runtime_error("cannot open file");
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+      close(fd);
+      throw std::runtime_error("cannot stat file");
+    }
+    sz = st.st_size;
+  }
+  DirectFile(const DirectFile&) = delete;
+  ~DirectFile() {
+    if (fd >= 0) close(fd);
+  }
+
+  size_t size() const { return sz; }
+  bool IsDirect() const { return direct; }
+
+  // call func(const uint8_t* data) with the bytes [start, end); data is only valid during the call
+  template <class Func>
+  auto Read(size_t start, size_t end, Func&& func) const {
+    thread_local AlignedBuffer buffer;
+    thread_local size_t buffer_size = 0;
+    size_t aligned_start = start / kAlignment * kAlignment;
+    size_t aligned_end = (end + kAlignment - 1) / kAlignment * kAlignment;
+    size_t len = aligned_end - aligned_start;
+    if (buffer_size < len) {
+      buffer.reset(static_cast<uint8_t*>(aligned_alloc(kAlignment, len)));
+      if (!buffer) throw std::bad_alloc();
+      buffer_size = len;
+    }
+    size_t need = end - aligned_start, got = 0;
+    while (got < need) {
+      // the last read may be short at EOF
+      ssize_t ret = pread(fd, buffer.get() + got, len - got, aligned_start + got);
+      if (ret < 0 && errno == EINTR) continue;
+      if (ret <= 0) throw std::runtime_error("read failed");
+      got += ret;
+    }
+    return func(static_cast<const uint8_t*>(buffer.get() + (start - aligned_start)));
+  }
+};
+
+// read-only index of a compressed file
+// [items_per_index, start_byte, (orig_size, end_byte)...]; block i ends where block i+1 starts
+// with kChecksumFlag set in the first word, each block also stores the XXH64 of its compressed bytes:
+// [items_per_index | kChecksumFlag, start_byte, (checksum, orig_size, end_byte)...]
+class BlockIndex {
+  MappedFile file;
+  size_t stride;
+ public:
+  static constexpr uint64_t kChecksumFlag = 1ull << 63;
+
+  BlockIndex(const std::string& fname) : file(fname), stride(2) {
+    if (file.size() % sizeof(uint64_t) != 0 || file.size() < 2 * sizeof(uint64_t)) {
+      throw std::runtime_error("unexpected index file size");
+    }
+    if (HasChecksums()) stride = 3;
+    if (!ItemsPerIndex() || (file.size() / sizeof(uint64_t) - 2) % stride) {
+      throw std::runtime_error("invalid index file");
+    }
+  }
+
+  uint64_t Word(size_t idx) const {
+    return BytesToInt<uint64_t>(file.data() + idx * sizeof(uint64_t));
+  }
+  bool HasChecksums() const { return Word(0) & kChecksumFlag; }
+  size_t ItemsPerIndex() const { return Word(0) & ~kChecksumFlag; }
+  size_t NumBlocks() const {
+    return (file.size() / sizeof(uint64_t) - 2) / stride;
+  }
+  // returns (start_byte, orig_size, end_byte)
+  std::tuple<uint64_t, uint64_t, uint64_t> Block(size_t block_idx) const {
+    size_t base = block_idx * stride;
+    return {Word(base + 1), Word(base + stride), Word(base + stride + 1)};
+  }
+  uint64_t Checksum(size_t block_idx) const {
+    return HasChecksums() ? Word(block_idx * stride + 2) : 0;
+  }
+  // throws if the compressed bytes of the block are corrupted
+  void CheckBlock(size_t block_idx, const uint8_t* data, size_t size) const {
+    if (HasChecksums() && XXHash64(data, size) != Checksum(block_idx)) {
+      throw std::runtime_error("block checksum mismatch (block " + std::to_string(block_idx) + ")");
+    }
+  }
+};
+
+// identifies the contents of a file on disk; changes when it is rewritten or replaced by rename
+struct FileStamp {
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  struct timespec mtime;
+
+  // nullopt if the file does not exist
+  static std::optional<FileStamp> Of(const std::string& fname) {
+    struct stat st;
+    if (stat(fname.c_str(), &st) < 0) return std::nullopt;
+    return FileStamp{st.st_dev, st.st_ino, st.st_size, st.st_mtim};
+  }
+  bool operator==(const FileStamp& x) const {
+    return dev == x.dev && ino == x.ino && size == x.size &&
+        mtime.tv_sec == x.mtime.tv_sec && mtime.tv_nsec == x.mtime.tv_nsec;
+  }
+};
+
+// process-wide cache of objects loaded from files, so each file is loaded once and shared by all readers
+// an entry is replaced when the file on disk changes
+template <class T, class Load>
+std::shared_ptr<const T> GetCachedFileObject(const std::string& fname, const FileStamp& stamp, Load&& load) {
+  static std::mutex mtx;
+  static std::unordered_map<std::string, std::pair<std::shared_ptr<const T>, FileStamp>> cache;
+  std::lock_guard lck(mtx);
+  auto it = cache.find(fname);
+  if (it != cache.end() && it->second.second == stamp) return it->second.first;
+  std::shared_ptr<const T> obj = load();
+  cache[fname] = {obj, stamp};
+  return obj;
+}
+
+inline std::shared_ptr<const BlockIndex> GetBlockIndex(const std::string& fname) {
+  auto stamp = FileStamp::Of(fname);
+  if (!stamp) throw std::runtime_error("index file not found");
+  return GetCachedFileObject<BlockIndex>(fname, *stamp, [&]() { return std::make_shared<const BlockIndex>(fname); });
+}
+
+// fills the source fields of the header from source_fname, stamped by stamp_fname (its index, or the file
+// itself if it has none); false if stamp_fname is missing
+inline bool SetFileSource(FileHeader& header, const std::string& source_fname, const std::string& stamp_fname) {
+  auto stamp = FileStamp::Of(stamp_fname);
+  if (!stamp) return false;
+  auto source_header = ReadFileHeader(source_fname);
+  header.source_count = source_header ? source_header->record_count : FileHeader::kUnknownCount;
+  header.source_index_size = stamp->size;
+  header.source_index_mtime = (uint64_t)stamp->mtime.tv_sec * 1000000000 + stamp->mtime.tv_nsec;
+  return true;
+}
+
+inline void ZstdDecompress(
+    ZSTD_DCtx* ctx, std::vector<uint8_t>& out, const uint8_t* src, size_t src_size, size_t orig_size,
+    const ZSTD_DDict* ddict = nullptr) {
+  out.resize(orig_size);
+  size_t ret = ddict ?
+      ZSTD_decompress_usingDDict(ctx, out.data(), out.size(), src, src_size, ddict) :
+      ZSTD_decompressDCtx(ctx, out.data(), out.size(), src, src_size);
+  if (ZSTD_isError(ret)) throw std::runtime_error("zstd decompress failed");
+  if (ret != out.size()) throw std::runtime_error("decompress: unexpected data length");
+}
+
+inline std::string DictPath(const std::string& fname) {
+  return fname + ".dict";
+}
+
+inline std::vector<uint8_t> ReadWholeFile(const std::string& fname) {
+  std::ifstream fin(fname, std::ios_base::binary);
+  if (!fin.is_open()) throw std::runtime_error("cannot open file");
+  return std::vector<uint8_t>(std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>());
+}
+
+// nullptr if the file has no trained dictionary; cached like GetBlockIndex
+inline ZstdDDictPtr LoadDDict(const std::string& fname) {
+  std::string dict_fname = DictPath(fname);
+  auto stamp = FileStamp::Of(dict_fname);
+  if (!stamp) return nullptr;
+  return GetCachedFileObject<ZSTD_DDict>(dict_fname, *stamp, [&]() { return MakeDDict(ReadWholeFile(dict_fname)); });
+}
+
+// sz is val.NumBytes(), passed to GetBytes(ret, sz) if the record has it, so it is not computed again
 template <class T>
-inline void WriteToBuf(std::vector<uint8_t>& buf, const T& val) {
+inline void WriteToBuf(std::vector<uint8_t>& buf, const T& val, size_t sz) {
   size_t old_sz = buf.size();
   if constexpr (T::kIsConstSize) {
     buf.resize(old_sz + T::NumBytes());
     val.GetBytes(buf.data() + old_sz);
   } else {
-    size_t sz = val.NumBytes();
     buf.resize(old_sz + T::kSizeNumberBytes + sz);
     uint8_t sz_buf[8] = {};
     IntToBytes<uint64_t>(sz, sz_buf);
     memcpy(buf.data() + old_sz, sz_buf, T::kSizeNumberBytes);
-    val.GetBytes(buf.data() + old_sz + T::kSizeNumberBytes);
+    uint8_t* out = buf.data() + old_sz + T::kSizeNumberBytes;
+    if constexpr (requires { val.GetBytes(out, sz); }) {
+      val.GetBytes(out, sz);
+    } else {
+      val.GetBytes(out);
+    }
   }
 }
 
+template <class T>
+inline void WriteToBuf(std::vector<uint8_t>& buf, const T& val) {
+  WriteToBuf(buf, val, val.NumBytes());
+}
+
 template <class T>
 inline void WriteToBufRaw(std::vector<uint8_t>& buf, const std::vector<uint8_t>& val) {
   size_t old_sz = buf.size();
@@ -75,6 +322,43 @@ struct ClassIOAttr {
   }();
 };
 
+template <class T>
+constexpr uint32_t RecordTypeIdOf() {
+  if constexpr (requires { T::kRecordTypeId; }) {
+    return T::kRecordTypeId;
+  } else {
+    return kRecordUnknown;
+  }
+}
+
+template <class T>
+FileHeader MakeFileHeader(bool compressed, size_t items_per_index) {
+  FileHeader ret = FileHeader::Current();
+  ret.flags = (compressed ? FileHeader::kCompressed : 0) | (ClassIOAttr<T>::kIsConstSize ? FileHeader::kConstSize : 0);
+  ret.record_type = RecordTypeIdOf<T>();
+  if constexpr (ClassIOAttr<T>::kIsConstSize) {
+    ret.record_bytes = T::NumBytes();
+  } else {
+    ret.record_bytes = ClassIOAttr<T>::kSizeNumberBytes;
+  }
+  ret.items_per_index = items_per_index;
+  return ret;
+}
+
+// throws if the file cannot be read as T by this binary
+template <class T>
+void CheckFileHeader(const FileHeader& header, bool compressed) {
+  header.CheckBuild();
+  FileHeader expected = MakeFileHeader<T>(compressed, 0);
+  if ((header.flags & FileHeader::kCompressed) != (expected.flags & FileHeader::kCompressed)) {
+    throw std::runtime_error("file compression mismatch");
+  }
+  if ((header.flags & ~FileHeader::kBlockChecksum) != expected.flags || header.record_bytes != expected.record_bytes ||
+      (header.record_type && expected.record_type && header.record_type != expected.record_type)) {
+    throw std::runtime_error("file record type mismatch");
+  }
+}
+
 template <class T>
 class ClassWriterImpl {
  protected:
@@ -90,6 +374,7 @@ class ClassWriterImpl {
   size_t current_written_size;
   std::ofstream fout;
   std::ofstream fout_ind;
+  FileHeader header;
   bool moved;
 
   void Flush() {
@@ -100,6 +385,15 @@ class ClassWriterImpl {
     buf.clear();
   }
 
+  void WriteHeader() {
+    uint8_t out[FileHeader::kSize];
+    header.GetBytes(out);
+    fout.seekp(0);
+    if (!fout.write(reinterpret_cast<const char*>(out), sizeof(out))) {
+      throw std::runtime_error("write failed");
+    }
+  }
+
   void FlushIndex() {
     if (!HasIndex()) return;
     std::vector<uint8_t> out(inds.size() * sizeof(uint64_t));
@@ -112,12 +406,16 @@ class ClassWriterImpl {
     }
   }
  public:
-  ClassWriterImpl(const std::string& fname, size_t items_per_index) :
-      current(0), items_per_index(items_per_index), current_written_size(0), moved(false) {
+  ClassWriterImpl(const std::string& fname, size_t items_per_index, bool compressed = false) :
+      current(0), items_per_index(items_per_index), current_written_size(0),
+      header(MakeFileHeader<T>(compressed, items_per_index)), moved(false) {
     static_assert(kIsConstSize || (kSizeNumberBytes >= 1 && kSizeNumberBytes <= 8));
     MkdirForFile(fname);
     fout.open(fname, std::ios_base::out | std::ios_base::trunc);
     if (!fout.is_open()) throw std::runtime_error("cannot open file");
+    // record count is filled in on close
+    WriteHeader();
+    current_written_size = FileHeader::kSize;
     if (HasIndex()) {
       fout_ind.open(fname + ".index", std::ios_base::out | std::ios_base::trunc);
       if (!fout_ind.is_open()) throw std::runtime_error("cannot open index file");
@@ -130,14 +428,21 @@ class ClassWriterImpl {
       buf(std::move(x.buf)), inds(std::move(x.inds)),
       current(x.current), items_per_index(x.items_per_index),
       current_written_size(x.current_written_size),
-      fout(std::move(x.fout)), fout_ind(std::move(x.fout_ind)), moved(false) {
+      fout(std::move(x.fout)), fout_ind(std::move(x.fout_ind)), header(std::move(x.header)), moved(false) {
     x.moved = true;
   }
 
+  // records the file this one is derived from; see SetFileSource
+  void SetSource(const std::string& source_fname, const std::string& stamp_fname) {
+    if (!SetFileSource(header, source_fname, stamp_fname)) throw std::runtime_error("source file not found");
+  }
+
   ~ClassWriterImpl() {
     if (moved) return;
     Flush();
     FlushIndex();
+    header.record_count = current;
+    WriteHeader();
   }
 
   bool HasIndex() const {
@@ -166,6 +471,9 @@ class ClassReaderImpl {
   bool eof;
   std::ifstream fin;
   std::ifstream fin_index;
+  std::optional<FileHeader> header;
+  // byte offset of the first record (header size, or 0 for headerless files)
+  size_t data_offset;
 
   void ReadUntilSize(size_t sz, size_t buf_size) {
     if (!fin) return;
@@ -177,12 +485,23 @@ class ClassReaderImpl {
     buf.resize(old_sz + fin.gcount());
   }
  public:
-  ClassReaderImpl(const std::string& fname, bool check_index) :
-      current(0), items_per_index(0), eof(false) {
+  ClassReaderImpl(const std::string& fname, bool check_index, bool compressed = false) :
+      current(0), items_per_index(0), eof(false), data_offset(0) {
     static_assert(kIsConstSize || (kSizeNumberBytes >= 1 && kSizeNumberBytes <= 8));
     fin.rdbuf()->pubsetbuf(nullptr, 0);
     fin.open(fname);
     if (!fin.is_open()) throw std::runtime_error("cannot open file");
+    uint8_t header_buf[FileHeader::kSize];
+    if (fin.read(reinterpret_cast<char*>(header_buf), sizeof(header_buf))) {
+      header = FileHeader::Parse(header_buf);
+    }
+    if (header) {
+      CheckFileHeader<T>(*header, compressed);
+      data_offset = FileHeader::kSize;
+    } else {
+      fin.clear();
+      fin.seekg(0);
+    }
     uint8_t sz_buf[8] = {};
     if (check_index) {
       fin_index.rdbuf()->pubsetbuf(nullptr, 0);
@@ -206,6 +525,17 @@ class ClassReaderImpl {
   size_t Position() const {
     return current;
   }
+
+  // nullopt for headerless files
+  const std::optional<FileHeader>& Header() const {
+    return header;
+  }
+
+  // number of records if recorded in the header
+  std::optional<size_t> Size() const {
+    if (!header || header->record_count == FileHeader::kUnknownCount) return std::nullopt;
+    return header->record_count;
+  }
 };
 
 } // namespace io_internal
@@ -251,7 +581,7 @@ class ClassWriter : public io_internal::ClassWriterImpl<T> {
     if (!kIsConstSize && SizeRangeOverflow<kSizeNumberBytes>(sz)) {
       throw std::out_of_range("output size too large");
     }
-    io_internal::WriteToBuf(buf, item);
+    io_internal::WriteToBuf(buf, item, sz);
     if (buf.size() >= kBufferSize) Flush();
   }
 
@@ -276,6 +606,7 @@ class ClassReader : public io_internal::ClassReaderImpl<T> {
   using io_internal::ClassReaderImpl<T>::fin;
   using io_internal::ClassReaderImpl<T>::fin_index;
   using io_internal::ClassReaderImpl<T>::items_per_index;
+  using io_internal::ClassReaderImpl<T>::data_offset;
 
   size_t current_offset;
 
@@ -296,6 +627,8 @@ class ClassReader : public io_internal::ClassReaderImpl<T> {
  public:
   using io_internal::ClassReaderImpl<T>::HasIndex;
   using io_internal::ClassReaderImpl<T>::Position;
+  using io_internal::ClassReaderImpl<T>::Header;
+  using io_internal::ClassReaderImpl<T>::Size;
 
   ClassReader(const std::string& fname) :
       io_internal::ClassReaderImpl<T>(fname, !kIsConstSize), current_offset(0) {}
@@ -360,7 +693,7 @@ class ClassReader : public io_internal::ClassReaderImpl<T> {
         buf.clear();
         eof = false;
         fin.clear();
-        fin.seekg(T::NumBytes() * location);
+        fin.seekg(data_offset + T::NumBytes() * location);
         current_offset = 0;
       }
       current = location;
@@ -388,7 +721,7 @@ class ClassReader : public io_internal::ClassReaderImpl<T> {
     } else if (location < current) {
       buf.clear();
       fin.clear();
-      fin.seekg(0);
+      fin.seekg(data_offset);
       current = 0;
       current_offset = 0;
     }
@@ -409,15 +742,22 @@ class CompressedClassWriter : public io_internal::ClassWriterImpl<T> {
   using io_internal::ClassWriterImpl<T>::buf;
   using io_internal::ClassWriterImpl<T>::items_per_index;
   using io_internal::ClassWriterImpl<T>::moved;
+  using io_internal::ClassWriterImpl<T>::header;
 
   std::unique_ptr<CompressorBase> compressor;
+  std::string fname;
   std::vector<uint8_t> compress_buf;
+  // original sizes of the blocks submitted to compressor but not yet written
+  std::deque<size_t> pending_sizes;
 
   void PushCompressedBlock(const std::vector<uint8_t>& vec) {
     size_t old_size = buf.size();
     buf.resize(old_size + vec.size());
     memcpy(buf.data() + old_size, vec.data(), vec.size());
+    inds.push_back(XXHash64(vec.data(), vec.size()));
+    inds.push_back(pending_sizes.front());
     inds.push_back(ByteSize());
+    pending_sizes.pop_front();
     if (buf.size() >= kBufferSize) Flush();
   }
 
@@ -435,11 +775,23 @@ class CompressedClassWriter : public io_internal::ClassWriterImpl<T> {
     }
   }
 
+  void Init() {
+    header.flags |= FileHeader::kBlockChecksum;
+    inds[0] |= io_internal::BlockIndex::kChecksumFlag;
+    inds.push_back(ByteSize());
+    // a stale dictionary would be picked up by readers
+    std::filesystem::remove(io_internal::DictPath(fname));
+  }
+
   void DoCompress() {
-    inds.push_back(compress_buf.size());
+    pending_sizes.push_back(compress_buf.size());
     compressor->CompressBlock(std::move(compress_buf));
     compress_buf.clear();
     GetCompressResults();
+    // bound the memory used by blocks in flight
+    while (compressor->RemainingBlocks() >= compressor->MaxPendingBlocks()) {
+      PushCompressedBlock(compressor->GetResultBlock());
+    }
   }
  public:
   using io_internal::ClassWriterImpl<T>::HasIndex;
@@ -447,32 +799,45 @@ class CompressedClassWriter : public io_internal::ClassWriterImpl<T> {
   using io_internal::ClassWriterImpl<T>::Size;
 
   CompressedClassWriter(const std::string& fname, size_t items_per_index = 1024, int compress_level = -4) :
-      io_internal::ClassWriterImpl<T>(fname, items_per_index == 0 ? 1 : items_per_index),
-      compressor(std::make_unique<DefaultZstdCompressor>(compress_level)) {
-    inds.push_back(0);
+      io_internal::ClassWriterImpl<T>(fname, items_per_index == 0 ? 1 : items_per_index, true),
+      compressor(std::make_unique<DefaultZstdCompressor>(compress_level)), fname(fname) {
+    Init();
   }
   CompressedClassWriter(const std::string& fname, size_t items_per_index, std::unique_ptr<CompressorBase>&& compressor) :
-      io_internal::ClassWriterImpl<T>(fname, items_per_index == 0 ? 1 : items_per_index),
-      compressor(std::move(compressor)) {
-    inds.push_back(0);
+      io_internal::ClassWriterImpl<T>(fname, items_per_index == 0 ? 1 : items_per_index, true),
+      compressor(std::move(compressor)), fname(fname) {
+    Init();
   }
   CompressedClassWriter(const CompressedClassWriter&) = delete;
   CompressedClassWriter(CompressedClassWriter&& x) :
       io_internal::ClassWriterImpl<T>(std::move(x)),
-      compressor(std::move(x.compressor)), compress_buf(std::move(x.compress_buf)) {}
+      compressor(std::move(x.compressor)), fname(std::move(x.fname)), compress_buf(std::move(x.compress_buf)),
+      pending_sizes(std::move(x.pending_sizes)) {}
   ~CompressedClassWriter() {
     if (moved) return;
     if (compress_buf.size()) DoCompress();
     GetCompressResults(true);
   }
 
+  // compress all blocks with a trained dictionary, which is stored next to the index
+  // must be called before the first block is completed
+  void SetDictionary(const std::vector<uint8_t>& dict) {
+    if (current >= items_per_index) throw std::logic_error("dictionary must be set before writing");
+    std::ofstream fout_dict(io_internal::DictPath(fname), std::ios_base::out | std::ios_base::trunc);
+    if (!fout_dict.is_open()) throw std::runtime_error("cannot open dictionary file");
+    if (!fout_dict.write(reinterpret_cast<const char*>(dict.data()), dict.size())) {
+      throw std::runtime_error("write failed");
+    }
+    compressor->SetDictionary(dict);
+  }
+
   void Write(const T& item) {
     current++;
     size_t sz = item.NumBytes();
     if (!kIsConstSize && SizeRangeOverflow<kSizeNumberBytes>(sz)) {
       throw std::out_of_range("output size too large");
     }
-    io_internal::WriteToBuf(compress_buf, item);
+    io_internal::WriteToBuf(compress_buf, item, sz);
     if (current % items_per_index == 0) {
       DoCompress();
       if (inds.size() >= kIndexBufferSize) FlushIndex();
@@ -503,6 +868,28 @@ class CompressedClassWriter : public io_internal::ClassWriterImpl<T> {
   void WriteRaw(const std::vector<std::vector<uint8_t>>& items) {
     for (auto& i : items) WriteRaw(i);
   }
+
+  // items already in the file format (see io_internal::WriteToBuf); each run of items up to the end of
+  // a block is appended with one copy
+  void WriteSerialized(const uint8_t* data, size_t bytes) {
+    const uint8_t* end = data + bytes;
+    while (data < end) {
+      const uint8_t* run_end = data;
+      size_t items = 0, block_left = items_per_index - current % items_per_index;
+      for (; items < block_left && run_end < end; items++) {
+        auto [sz, sz_bytes] = io_internal::GetNextSize<T>(run_end);
+        run_end += sz_bytes + sz;
+      }
+      if (run_end > end) throw std::out_of_range("truncated item");
+      compress_buf.insert(compress_buf.end(), data, run_end);
+      current += items;
+      data = run_end;
+      if (current % items_per_index == 0) {
+        DoCompress();
+        if (inds.size() >= kIndexBufferSize) FlushIndex();
+      }
+    }
+  }
 };
 
 template <class T>
@@ -510,68 +897,156 @@ class CompressedClassReader : public io_internal::ClassReaderImpl<T> {
   using io_internal::ClassReaderImpl<T>::kIsConstSize;
   using io_internal::ClassReaderImpl<T>::kSizeNumberBytes;
   using io_internal::ClassReaderImpl<T>::kBufferSize;
-  static constexpr size_t kIndexBufferSize = 131072;
 
   using io_internal::ClassReaderImpl<T>::ReadUntilSize;
   using io_internal::ClassReaderImpl<T>::buf;
   using io_internal::ClassReaderImpl<T>::eof;
   using io_internal::ClassReaderImpl<T>::current;
   using io_internal::ClassReaderImpl<T>::fin;
-  using io_internal::ClassReaderImpl<T>::fin_index;
   using io_internal::ClassReaderImpl<T>::items_per_index;
+  using io_internal::ClassReaderImpl<T>::data_offset;
 
   /*
    * buf                                     [may partial]
    *   buf_start_bytes                         fin.tallg() (bytes)
    *                       block_start                     (item idx)
-   *   0               [infer from ind_buf]     buf.size() (buf idx)
+   *   0               [infer from index]       buf.size() (buf idx)
    *   |----------------------->********<............|
    *
-   * ind_buf                                 [may partial]
-   *   ind_start           block_start=ind_start+ind_offset/2 (item idx)
-   *   0                   ind_offset        ind_buf.size()   (ind_buf idx)
-   *   |----------------------->*****<...............|
-   *                             len=3
-   * block_buf
+   * index (shared by all readers of the file)
+   *   block_idx = block_start / items_per_index
+   *
+   * block_buf (or cached_block if using block_cache)
    *   block_start       current              [always full] (item idx)
    *   0                 block_offset                       (block_buf idx)
    *   |------------------->*********<...............|
+   *
+   * In mmap mode, buf is unused.
+   *
+   * read_ahead_buf (mmap or direct I/O mode; reading & decompressing on read_ahead_pool)
+   *   read_ahead_start                 +read_ahead_buf.size() (block idx)
+   *   |********************************|
    */
+  std::string fname;
   std::unique_ptr<ZSTD_DCtx, size_t(*)(ZSTD_DCtx*)> zstd_ctx;
-  size_t buf_start_bytes, ind_start, ind_offset, block_start, block_offset;
+  std::shared_ptr<const io_internal::BlockIndex> index;
+  // the current block, or the next block to load if no block is loaded
+  size_t block_idx;
+  size_t buf_start_bytes, block_start, block_offset;
   std::vector<uint8_t> block_buf;
-  std::vector<uint64_t> ind_buf;
+  BlockCache* block_cache;
+  BlockCache::Block cached_block;
+  std::shared_ptr<io_internal::MappedFile> mapped;
+  std::shared_ptr<io_internal::DirectFile> direct;
+  ZstdDDictPtr ddict;
+  BS::thread_pool* read_ahead_pool;
+  size_t read_ahead_blocks, read_ahead_start;
+  std::deque<std::future<std::vector<uint8_t>>> read_ahead_buf;
+
+  const std::vector<uint8_t>& CurrentBlock() const {
+    return cached_block ? *cached_block : block_buf;
+  }
+  void ClearBlock() {
+    block_buf.clear();
+    cached_block.reset();
+  }
 
-  void ReadIndUntilSize(size_t sz, size_t buf_size) {
-    size_t old_sz = ind_buf.size();
-    sz = std::max(sz, buf_size);
-    if (sz <= old_sz) return;
-    std::vector<char> tmp((sz - old_sz) * 8);
-    fin_index.read(tmp.data(), tmp.size());
-    tmp.resize(fin_index.gcount());
-    if (tmp.size() % 8 != 0) throw std::runtime_error("unexpected index file size");
-    size_t new_count = tmp.size() / 8;
-    ind_buf.reserve(old_sz + new_count);
-    for (size_t i = 0; i < new_count; i++) {
-      ind_buf.push_back(BytesToInt<uint64_t>(reinterpret_cast<const uint8_t*>(tmp.data() + i * 8)));
+  void DecompressBlock(const uint8_t* src, size_t src_size, size_t orig_size) {
+    cached_block.reset();
+    index->CheckBlock(block_idx, src, src_size);
+    io_internal::ZstdDecompress(zstd_ctx.get(), block_buf, src, src_size, orig_size, ddict.get());
+    block_start = current;
+    block_offset = 0;
+  }
+
+  void CachedBlock(size_t idx) {
+    cached_block = block_cache->Get(index, idx, [&]() {
+      auto [start, orig, end] = MappedBlock(idx);
+      std::vector<uint8_t> ret;
+      index->CheckBlock(idx, mapped->data() + start, end - start);
+      io_internal::ZstdDecompress(zstd_ctx.get(), ret, mapped->data() + start, end - start, orig, ddict.get());
+      return ret;
+    });
+    block_start = current;
+    block_offset = 0;
+  }
+
+  // returns (start_byte, orig_size, end_byte)
+  std::tuple<uint64_t, uint64_t, uint64_t> MappedBlock(size_t idx) const {
+    auto [start, orig, end] = index->Block(idx);
+    if (start > end || end > mapped->size()) throw std::runtime_error("invalid index file");
+    return {start, orig, end};
+  }
+
+  void PushReadAhead() {
+    size_t idx = read_ahead_start + read_ahead_buf.size();
+    if (direct) {
+      auto [start, orig, end] = index->Block(idx);
+      if (start > end || end > direct->size()) throw std::runtime_error("invalid index file");
+      read_ahead_buf.push_back(read_ahead_pool->submit(
+          [direct=direct,ddict=ddict,index=index,idx,start=start,orig=orig,end=end]() {
+        thread_local std::unique_ptr<ZSTD_DCtx, size_t(*)(ZSTD_DCtx*)> ctx(ZSTD_createDCtx(), ZSTD_freeDCtx);
+        if (!ctx) throw std::runtime_error("zstd initialize failed");
+        std::vector<uint8_t> ret;
+        direct->Read(start, end, [&](const uint8_t* data) {
+          index->CheckBlock(idx, data, end - start);
+          io_internal::ZstdDecompress(ctx.get(), ret, data, end - start, orig, ddict.get());
+        });
+        return ret;
+      }));
+      return;
     }
+    auto [start, orig, end] = MappedBlock(idx);
+    read_ahead_buf.push_back(read_ahead_pool->submit(
+        [mapped=mapped,ddict=ddict,index=index,idx,start=start,orig=orig,end=end]() {
+      thread_local std::unique_ptr<ZSTD_DCtx, size_t(*)(ZSTD_DCtx*)> ctx(ZSTD_createDCtx(), ZSTD_freeDCtx);
+      if (!ctx) throw std::runtime_error("zstd initialize failed");
+      std::vector<uint8_t> ret;
+      index->CheckBlock(idx, mapped->data() + start, end - start);
+      io_internal::ZstdDecompress(ctx.get(), ret, mapped->data() + start, end - start, orig, ddict.get());
+      return ret;
+    }));
+  }
+
+  void ReadAheadBlock(size_t idx) {
+    if (idx < read_ahead_start || idx >= read_ahead_start + read_ahead_buf.size()) {
+      // pending tasks hold their own reference to the file, so they can be safely abandoned
+      read_ahead_buf.clear();
+      read_ahead_start = idx;
+    }
+    for (; read_ahead_start < idx; read_ahead_start++) read_ahead_buf.pop_front();
+    size_t end_block = std::min(index->NumBlocks(), idx + read_ahead_blocks + 1);
+    while (read_ahead_start + read_ahead_buf.size() < end_block) PushReadAhead();
+    block_buf = read_ahead_buf.front().get();
+    read_ahead_buf.pop_front();
+    read_ahead_start++;
+    block_start = current;
+    block_offset = 0;
   }
 
   // if false, the offsets are in invalid state
-  bool MoveToNextBlock(size_t buf_size, size_t ind_buf_size) {
+  bool MoveToNextBlock(size_t buf_size) {
     if (eof) return false;
-    if (block_buf.size()) ind_offset += 2;
-    // ind_buf[ind_offset:ind_offset+3] = [start_byte, orig_size, end_byte]
-    if (ind_offset + 3 >= ind_buf.size()) {
-      for (size_t i = ind_offset; i < ind_buf.size(); i++) ind_buf[i - ind_offset] = ind_buf[i];
-      ind_buf.resize(ind_buf.size() - ind_offset);
-      ind_start += (ind_offset / 2) * items_per_index;
-      ind_offset = 0;
-      ReadIndUntilSize(3, ind_buf_size);
-      if (ind_buf.size() < 3) return false;
-    }
-    size_t start_offset = ind_buf[ind_offset] - buf_start_bytes;
-    size_t end_offset = ind_buf[ind_offset + 2] - buf_start_bytes;
+    if (CurrentBlock().size()) block_idx++;
+    if (block_idx >= index->NumBlocks()) return false;
+    if (direct) {
+      ReadAheadBlock(block_idx);
+      return true;
+    }
+    if (mapped) {
+      if (block_cache) {
+        CachedBlock(block_idx);
+      } else if (read_ahead_blocks) {
+        ReadAheadBlock(block_idx);
+      } else {
+        auto [start, orig, end] = MappedBlock(block_idx);
+        DecompressBlock(mapped->data() + start, end - start, orig);
+      }
+      return true;
+    }
+    auto [start, orig, end] = index->Block(block_idx);
+    size_t start_offset = start - buf_start_bytes;
+    size_t end_offset = end - buf_start_bytes;
     if (end_offset >= buf.size()) {
       for (size_t i = start_offset; i < buf.size(); i++) buf[i - start_offset] = buf[i];
       buf.resize(buf.size() - start_offset);
@@ -581,29 +1056,22 @@ class CompressedClassReader : public io_internal::ClassReaderImpl<T> {
     }
     ReadUntilSize(end_offset, buf_size);
     if (buf.size() < end_offset) return false;
-    block_buf.resize(ind_buf[ind_offset + 1]);
-    size_t ret = ZSTD_decompressDCtx(
-        zstd_ctx.get(), block_buf.data(), block_buf.size(), buf.data() + start_offset, end_offset - start_offset);
-    if (ZSTD_isError(ret)) throw std::runtime_error("zstd decompress failed");
-    if (ret != block_buf.size()) throw std::runtime_error("decompress: unexpected data length");
-    block_start = current;
-    block_offset = 0;
+    DecompressBlock(buf.data() + start_offset, end_offset - start_offset, orig);
     return true;
   }
 
-  uint64_t GetNextSize(size_t buf_size, size_t ind_buf_size) {
-    if (block_offset == block_buf.size()) {
-      if (!MoveToNextBlock(buf_size, ind_buf_size)) {
+  uint64_t GetNextSize(size_t buf_size) {
+    if (block_offset == CurrentBlock().size()) {
+      if (!MoveToNextBlock(buf_size)) {
         eof = true;
         throw ReadError("no more elements");
       }
     }
-    return io_internal::GetNextSize<T>(block_buf.data() + block_offset).first;
+    return io_internal::GetNextSize<T>(CurrentBlock().data() + block_offset).first;
   }
 
-  void ParseBufSize(size_t& buf_size, size_t& ind_buf_size) {
+  void ParseBufSize(size_t& buf_size) {
     if (buf_size == std::string::npos) buf_size = kBufferSize;
-    if (ind_buf_size == std::string::npos) ind_buf_size = kIndexBufferSize;
   }
 
   void SeekBuf(size_t start_bytes) {
@@ -618,10 +1086,10 @@ class CompressedClassReader : public io_internal::ClassReaderImpl<T> {
     }
   }
 
-  size_t ReadOneCommon(size_t buf_size, size_t ind_buf_size) {
-    ParseBufSize(buf_size, ind_buf_size);
-    uint64_t sz = GetNextSize(buf_size, ind_buf_size);
-    if (block_buf.size() < block_offset + kSizeNumberBytes + sz) {
+  size_t ReadOneCommon(size_t buf_size) {
+    ParseBufSize(buf_size);
+    uint64_t sz = GetNextSize(buf_size);
+    if (CurrentBlock().size() < block_offset + kSizeNumberBytes + sz) {
       if constexpr (kIsConstSize) {
         eof = true;
         throw ReadError("no more elements");
@@ -635,104 +1103,309 @@ class CompressedClassReader : public io_internal::ClassReaderImpl<T> {
  public:
   using io_internal::ClassReaderImpl<T>::HasIndex;
   using io_internal::ClassReaderImpl<T>::Position;
-
-  CompressedClassReader(const std::string& fname) :
-      io_internal::ClassReaderImpl<T>(fname, true),
+  using io_internal::ClassReaderImpl<T>::Header;
+  using io_internal::ClassReaderImpl<T>::Size;
+
+  // use_mmap: map the data file and decompress blocks directly from the mapping;
+  //   buf_size is ignored in this mode
+  // ind_buf_size arguments are kept for compatibility; the index is always fully shared
+  CompressedClassReader(const std::string& fname, bool use_mmap = false) :
+      io_internal::ClassReaderImpl<T>(fname, false, true), fname(fname),
       zstd_ctx(ZSTD_createDCtx(), ZSTD_freeDCtx),
-      buf_start_bytes(0), ind_start(0), ind_offset(0), block_start(0), block_offset(0) {
-    if (items_per_index == 0) throw std::runtime_error("index file not found");
+      index(io_internal::GetBlockIndex(fname + ".index")), block_idx(0),
+      buf_start_bytes(data_offset), block_start(0), block_offset(0),
+      block_cache(nullptr), ddict(io_internal::LoadDDict(fname)),
+      read_ahead_pool(nullptr), read_ahead_blocks(0), read_ahead_start(0) {
     if (!zstd_ctx) throw std::runtime_error("zstd initialize failed");
+    items_per_index = index->ItemsPerIndex();
+    if (use_mmap) mapped = std::make_shared<io_internal::MappedFile>(fname);
   }
   CompressedClassReader(const CompressedClassReader&) = delete;
   CompressedClassReader(CompressedClassReader&& x) :
-      io_internal::ClassReaderImpl<T>(std::move(x)), zstd_ctx(std::move(x.zstd_ctx)),
-      buf_start_bytes(x.buf_start_bytes), ind_start(x.ind_start), ind_offset(x.ind_offset),
-      block_start(x.block_start), block_offset(x.block_offset),
-      block_buf(std::move(x.block_buf)), ind_buf(std::move(x.ind_buf)) {}
-
-  void SkipOne(size_t buf_size = std::string::npos, size_t ind_buf_size = std::string::npos) {
-    ParseBufSize(buf_size, ind_buf_size);
-    uint64_t sz = GetNextSize(buf_size, ind_buf_size);
+      io_internal::ClassReaderImpl<T>(std::move(x)), fname(std::move(x.fname)), zstd_ctx(std::move(x.zstd_ctx)),
+      index(std::move(x.index)), block_idx(x.block_idx),
+      buf_start_bytes(x.buf_start_bytes), block_start(x.block_start), block_offset(x.block_offset),
+      block_buf(std::move(x.block_buf)), block_cache(x.block_cache), cached_block(std::move(x.cached_block)),
+      mapped(std::move(x.mapped)), direct(std::move(x.direct)), ddict(std::move(x.ddict)),
+      read_ahead_pool(x.read_ahead_pool), read_ahead_blocks(x.read_ahead_blocks),
+      read_ahead_start(x.read_ahead_start), read_ahead_buf(std::move(x.read_ahead_buf)) {}
+
+  size_t ItemsPerIndex() const { return items_per_index; }
+  size_t NumBlocks() const { return index->NumBlocks(); }
+
+  // keep the next `blocks` blocks decompressed in background on `pool` (mmap mode only)
+  void SetReadAhead(BS::thread_pool& pool, size_t blocks) {
+    if (!mapped) throw std::logic_error("read-ahead requires mmap mode");
+    read_ahead_buf.clear();
+    read_ahead_start = 0;
+    read_ahead_pool = &pool;
+    read_ahead_blocks = blocks;
+  }
+
+  // read blocks with O_DIRECT on `pool`, keeping `in_flight` blocks read & decompressed ahead;
+  // meant for sequential scans that should not evict other data from the page cache
+  void SetDirectIO(BS::thread_pool& pool, size_t in_flight) {
+    if (mapped) throw std::logic_error("direct I/O cannot be used in mmap mode");
+    direct = std::make_shared<io_internal::DirectFile>(fname);
+    read_ahead_buf.clear();
+    read_ahead_start = 0;
+    read_ahead_pool = &pool;
+    read_ahead_blocks = std::max(in_flight, (size_t)1);
+  }
+
+  // share decompressed blocks with other readers through `cache` (mmap mode only)
+  void SetBlockCache(BlockCache& cache) {
+    if (!mapped) throw std::logic_error("block cache requires mmap mode");
+    block_cache = &cache;
+  }
+
+  void SkipOne(size_t buf_size = std::string::npos, size_t = std::string::npos) {
+    ParseBufSize(buf_size);
+    uint64_t sz = GetNextSize(buf_size);
     block_offset += kSizeNumberBytes + sz;
     current++;
   }
 
-  T ReadOne(size_t buf_size = std::string::npos, size_t ind_buf_size = std::string::npos) {
-    uint64_t sz = ReadOneCommon(buf_size, ind_buf_size);
-    T ret(static_cast<const uint8_t*>(block_buf.data() + (block_offset + kSizeNumberBytes)), sz);
+  T ReadOne(size_t buf_size = std::string::npos, size_t = std::string::npos) {
+    uint64_t sz = ReadOneCommon(buf_size);
+    T ret(static_cast<const uint8_t*>(CurrentBlock().data() + (block_offset + kSizeNumberBytes)), sz);
     block_offset += kSizeNumberBytes + sz;
     return ret;
   }
 
   // the destruction should be handled by caller
-  void ReadOne(T* ret, size_t buf_size = std::string::npos, size_t ind_buf_size = std::string::npos) {
-    uint64_t sz = ReadOneCommon(buf_size, ind_buf_size);
-    new(ret) T(static_cast<const uint8_t*>(block_buf.data() + (block_offset + kSizeNumberBytes)), sz);
+  void ReadOne(T* ret, size_t buf_size = std::string::npos, size_t = std::string::npos) {
+    uint64_t sz = ReadOneCommon(buf_size);
+    new(ret) T(static_cast<const uint8_t*>(CurrentBlock().data() + (block_offset + kSizeNumberBytes)), sz);
     block_offset += kSizeNumberBytes + sz;
   }
 
-  std::vector<T> ReadBatch(size_t num, size_t buf_size = std::string::npos, size_t ind_buf_size = std::string::npos) {
-    ParseBufSize(buf_size, ind_buf_size);
+  std::vector<T> ReadBatch(size_t num, size_t buf_size = std::string::npos, size_t = std::string::npos) {
+    ParseBufSize(buf_size);
     std::vector<T> ret;
     ret.reserve(num);
     try {
-      for (size_t i = 0; i < num; i++) ret.push_back(ReadOne(buf_size, ind_buf_size));
+      for (size_t i = 0; i < num; i++) ret.push_back(ReadOne(buf_size));
     } catch (ReadError&) {}
     return ret;
   }
 
   // the destruction should be handled by caller
-  size_t ReadBatch(T* ret, size_t num, size_t buf_size = std::string::npos, size_t ind_buf_size = std::string::npos) {
-    ParseBufSize(buf_size, ind_buf_size);
+  size_t ReadBatch(T* ret, size_t num, size_t buf_size = std::string::npos, size_t = std::string::npos) {
+    ParseBufSize(buf_size);
     size_t i = 0;
     try {
-      for (; i < num; i++) ReadOne(ret + i, buf_size, ind_buf_size);
+      for (; i < num; i++) ReadOne(ret + i, buf_size);
     } catch (ReadError&) {}
     return i;
   }
 
-  void Seek(size_t location, size_t buf_size = std::string::npos, size_t ind_buf_size = std::string::npos) {
-    ParseBufSize(buf_size, ind_buf_size);
+  void Seek(size_t location, size_t buf_size = std::string::npos, size_t = std::string::npos) {
+    ParseBufSize(buf_size);
     if (!eof && block_start <= location && location < block_start + items_per_index) {
       // same block
       if (location < current) {
         block_offset = 0;
         current = block_start;
-        eof = false;
       }
-    } else if (!eof && ind_buf.size() && ind_start <= location &&
-               location < ind_start + (ind_buf.size() - 1) / 2 * items_per_index) {
-      // different block, but in range of ind_buf
-      size_t block_idx_offset = (location - ind_start) / items_per_index;
-      ind_offset = block_idx_offset * 2;
-      block_start = ind_start + block_idx_offset * items_per_index;
-      block_buf.clear();
-      block_offset = 0;
-      current = block_start;
-      SeekBuf(ind_buf[ind_offset]);
     } else {
-      // out of ind_buf
-      size_t block_idx = location / items_per_index;
-      ind_buf.clear();
-      ind_start = block_idx * items_per_index;
-      ind_offset = 0;
-      block_buf.clear();
-      block_start = ind_start;
+      // blocks are loaded lazily by GetNextSize
+      block_idx = location / items_per_index;
+      if (!mapped && !direct && block_idx < index->NumBlocks()) SeekBuf(std::get<0>(index->Block(block_idx)));
+      ClearBlock();
+      block_start = block_idx * items_per_index;
       block_offset = 0;
-      current = ind_start;
-      fin_index.clear();
-      fin_index.seekg((block_idx * 2 + 1) * 8);
-      ReadIndUntilSize(3, ind_buf_size);
-      if (ind_buf.size() < 3) {
-        eof = true;
-        return;
-      }
-      SeekBuf(ind_buf[0]);
+      current = block_start;
+      eof = false;
     }
-    while (location > current) SkipOne(buf_size, ind_buf_size);
+    while (location > current) SkipOne(buf_size);
   }
 };
 
+struct ScanOptions {
+  // threads reading (and decompressing) chunks
+  size_t io_threads = 1;
+  // threads running the callback in unordered mode; 0 runs it on the reading threads
+  size_t workers = 0;
+  // call back batches one at a time in increasing order of position, on the reading threads
+  bool ordered = false;
+  // batches read but not yet called back; 0 means 4 per thread
+  size_t max_batches = 0;
+  // used by ParallelScan only: batches never split a group of `unit` items (counted from 0),
+  // and the readers use SetReadAhead / SetDirectIO with these settings
+  size_t unit = 1;
+  size_t read_ahead = 0;
+  bool direct_io = false;
+};
+
+/*
+ * Splits [begin, end) into chunks at multiples of `align` (usually the items per block, so that
+ * every chunk starts at a block boundary) and reads each chunk on one of the io threads.
+ * For each chunk, make_reader(chunk_begin) returns a function `read(num)` that produces the next
+ * `num` items as one batch object; func(batch_begin, Batch&&) is then called for every batch.
+ * Batches start at `begin`, at chunk boundaries, or `batch` items after the previous one.
+ * At most max_batches batches are held in memory; the first exception thrown is rethrown.
+ */
+template <class MakeReader, class Func>
+void ParallelScanChunks(size_t begin, size_t end, size_t align, size_t batch,
+                        MakeReader&& make_reader, Func&& func, const ScanOptions& opts = {}) {
+  using Reader = std::invoke_result_t<MakeReader&, size_t>;
+  using Batch = std::invoke_result_t<Reader&, size_t>;
+  if (begin >= end) return;
+  if (!align || !batch) throw std::invalid_argument("align and batch must be positive");
+
+  size_t io_threads = std::max(opts.io_threads, (size_t)1);
+  size_t workers = opts.ordered ? 0 : opts.workers;
+  size_t max_batches = opts.max_batches ? opts.max_batches : 4 * (io_threads + workers);
+  // about 4 chunks per reading thread for load balancing
+  size_t num_aligned = (end - 1) / align - begin / align + 1;
+  size_t chunk_items = std::max(num_aligned / (4 * io_threads), (size_t)1) * align;
+  std::vector<size_t> bounds = {begin}, first_seq = {0};
+  for (size_t x = (begin / chunk_items + 1) * chunk_items; x < end; x += chunk_items) bounds.push_back(x);
+  bounds.push_back(end);
+  for (size_t i = 0; i + 1 < bounds.size(); i++) {
+    first_seq.push_back(first_seq.back() + (bounds[i + 1] - bounds[i] + batch - 1) / batch);
+  }
+
+  std::mutex mtx;
+  std::condition_variable cv;
+  size_t next_chunk = 0, in_flight = 0;
+  std::exception_ptr error;
+  // ordered mode: batches read but not yet called back, by sequence number
+  std::map<size_t, std::pair<size_t, Batch>> ready;
+  size_t next_seq = 0;
+  bool dispatching = false;
+
+  auto SetError = [&]() {
+    std::lock_guard lck(mtx);
+    if (!error) error = std::current_exception();
+    cv.notify_all();
+  };
+  auto Finish = [&]() {
+    std::lock_guard lck(mtx);
+    in_flight--;
+    cv.notify_all();
+  };
+  // called with mtx held
+  auto Dispatch = [&](std::unique_lock<std::mutex>& lck) {
+    if (dispatching) return;
+    dispatching = true;
+    for (auto it = ready.begin(); !error && it != ready.end() && it->first == next_seq; it = ready.begin()) {
+      auto [pos, items] = std::move(it->second);
+      ready.erase(it);
+      lck.unlock();
+      try {
+        func(pos, std::move(items));
+      } catch (...) {
+        lck.lock();
+        dispatching = false;
+        throw;
+      }
+      lck.lock();
+      next_seq++;
+      in_flight--;
+      cv.notify_all();
+    }
+    dispatching = false;
+  };
+
+  std::optional<BS::thread_pool> worker_pool;
+  if (workers) worker_pool.emplace(workers);
+  BS::thread_pool io_pool(std::min(io_threads, bounds.size() - 1));
+  for (size_t t = 0; t < io_pool.get_thread_count(); t++) {
+    io_pool.push_task([&]() {
+      try {
+        while (true) {
+          size_t chunk;
+          {
+            std::lock_guard lck(mtx);
+            if (error || next_chunk + 1 == bounds.size()) return;
+            chunk = next_chunk++;
+          }
+          Reader read = make_reader(bounds[chunk]);
+          size_t seq = first_seq[chunk];
+          for (size_t pos = bounds[chunk]; pos < bounds[chunk + 1]; pos += batch, seq++) {
+            {
+              // in ordered mode, the batch to be called back next is always allowed, so this cannot deadlock
+              std::unique_lock lck(mtx);
+              cv.wait(lck, [&]{
+                return error || (opts.ordered ? seq < next_seq + max_batches : in_flight < max_batches);
+              });
+              if (error) return;
+              in_flight++;
+            }
+            Batch items = read(std::min(batch, bounds[chunk + 1] - pos));
+            if (opts.ordered) {
+              std::unique_lock lck(mtx);
+              ready.emplace(seq, std::make_pair(pos, std::move(items)));
+              Dispatch(lck);
+            } else if (worker_pool) {
+              worker_pool->push_task(make_copyable_function([&,pos,items=std::move(items)]() mutable {
+                try {
+                  bool skip;
+                  {
+                    std::lock_guard lck(mtx);
+                    skip = (bool)error;
+                  }
+                  if (!skip) func(pos, std::move(items));
+                } catch (...) {
+                  SetError();
+                }
+                Finish();
+              }));
+            } else {
+              func(pos, std::move(items));
+              Finish();
+            }
+          }
+        }
+      } catch (...) {
+        SetError();
+      }
+    });
+  }
+  io_pool.wait_for_tasks();
+  if (worker_pool) worker_pool->wait_for_tasks();
+  if (error) std::rethrow_exception(error);
+}
+
+// scan items [begin, end) of a compressed file in parallel; func(batch_begin, std::vector<T>& items)
+// chunks start at block boundaries, so every reader only decompresses the blocks it uses
+template <class T, class Func>
+void ParallelScan(const std::string& fname, size_t begin, size_t end, size_t batch,
+                  Func&& func, const ScanOptions& opts = {}) {
+  if (!opts.unit || begin % opts.unit || batch % opts.unit) throw std::invalid_argument("unaligned scan");
+  size_t align = std::lcm(io_internal::GetBlockIndex(fname + ".index")->ItemsPerIndex(), opts.unit);
+  // declared before the readers so that it outlives them
+  // direct I/O always reads ahead, since nothing is cached by the kernel
+  size_t read_ahead = opts.direct_io ? std::max(opts.read_ahead, (size_t)4) : opts.read_ahead;
+  std::optional<BS::thread_pool> read_ahead_pool;
+  if (read_ahead) read_ahead_pool.emplace(read_ahead);
+  ParallelScanChunks(begin, end, align, batch, [&](size_t chunk_begin) {
+    auto reader = std::make_shared<CompressedClassReader<T>>(fname, !opts.direct_io);
+    if (opts.direct_io) {
+      reader->SetDirectIO(*read_ahead_pool, read_ahead);
+    } else if (read_ahead_pool) {
+      reader->SetReadAhead(*read_ahead_pool, read_ahead);
+    }
+    reader->Seek(chunk_begin);
+    return [reader](size_t num) {
+      std::vector<T> items;
+      if constexpr (std::is_trivially_destructible_v<T>) {
+        // read in place; ReadBatch constructs over the default-constructed items
+        items.resize(num);
+        if (reader->ReadBatch(items.data(), num) != num) throw std::runtime_error("read failure");
+      } else {
+        items = reader->ReadBatch(num);
+        if (items.size() != num) throw std::runtime_error("read failure");
+      }
+      return items;
+    };
+  }, [&](size_t pos, std::vector<T>&& items) {
+    func(pos, items);
+  }, opts);
+}
+
 template <class T>
 std::vector<uint8_t> Serialize(const T& val) {
   std::vector<uint8_t> ret(val.NumBytes());
@@ -1,8 +1,10 @@
 #pragma once
 
+#include <array>
 #include <fstream>
 #include <optional>
 #include "io.h"
+#include "hash.h"
 
 template <class Key, class Val, class Hash = std::hash<Key>>
 void WriteHashMap(const std::string& fname, std::vector<std::pair<Key, Val>>&& vals, size_t num_buckets) {
@@ -103,3 +105,346 @@ class HashMapReader {
     return std::nullopt;
   }
 };
+
+/*
+ * Minimal perfect hash map from keys to their index in a key vector (PTHash-style).
+ * Keys are distributed to buckets with a skewed hash; every bucket stores a 16-bit pilot that moves
+ * all of its keys to free table slots. The table has ~2% more slots than keys, and keys placed past
+ * the end are remapped into the holes, so every slot holds exactly one (value, fingerprint) pair.
+ * A lookup costs one read of the pilot and one read of the slot; the 32-bit fingerprint rejects
+ * absent keys except with probability 2^-32.
+ *
+ *   0 magic[8]     16 num_buckets    32 seed
+ *   8 num_keys     24 table_size     40 pilots (u16[num_buckets]), remap (u32[table_size - num_keys]),
+ *                                       slots ((u32 value, u32 fingerprint)[num_keys]), each 8-byte aligned
+ */
+namespace io_internal {
+
+// calls f(bytes, size) with the serialized key
+template <class Key, class Func>
+inline auto WithKeyBytes(const Key& k, Func&& f) {
+  if constexpr (Key::kIsConstSize) {
+    uint8_t buf[Key::NumBytes()];
+    k.GetBytes(buf);
+    return f(buf, sizeof(buf));
+  } else {
+    std::vector<uint8_t> buf(k.NumBytes());
+    k.GetBytes(buf.data());
+    return f(buf.data(), buf.size());
+  }
+}
+
+struct PerfectHashLayout {
+  static constexpr char kMagic[8] = {'B', 'T', 'T', 'B', 'M', 'P', 'H', 'F'};
+  static constexpr size_t kHeaderSize = 40;
+  static constexpr uint64_t kSkewKeys = 0x9999999999999999; // 60% of the keys...
+  static constexpr double kSkewBuckets = 0.3;                // ...go to 30% of the buckets
+
+  uint64_t num_keys = 0, num_buckets = 0, table_size = 0, seed = 0;
+
+  static size_t Align8(size_t x) { return (x + 7) & ~(size_t)7; }
+  size_t PilotOffset() const { return kHeaderSize; }
+  size_t RemapOffset() const { return PilotOffset() + Align8(num_buckets * sizeof(uint16_t)); }
+  size_t SlotOffset() const { return RemapOffset() + Align8((table_size - num_keys) * sizeof(uint32_t)); }
+  size_t FileSize() const { return SlotOffset() + num_keys * 2 * sizeof(uint32_t); }
+
+  static uint64_t Reduce(uint64_t x, uint64_t n) {
+    return (unsigned __int128)x * n >> 64;
+  }
+  static uint64_t Mix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccd;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53;
+    x ^= x >> 33;
+    return x;
+  }
+  uint64_t Bucket(uint64_t h1) const {
+    uint64_t dense = std::max<uint64_t>(1, num_buckets * kSkewBuckets);
+    uint64_t x = (h1 << 32) | (h1 >> 32);
+    if (h1 < kSkewKeys || dense >= num_buckets) return Reduce(x, std::min(dense, num_buckets));
+    return dense + Reduce(x, num_buckets - dense);
+  }
+  uint64_t Position(uint64_t h2, uint16_t pilot) const {
+    return Reduce(Mix(h2 ^ Mix(pilot + seed)), table_size);
+  }
+  static uint32_t Fingerprint(uint64_t h1, uint64_t h2) {
+    return Mix(h1 + h2 * 0x9e3779b185ebca87) >> 32;
+  }
+
+  template <class Key>
+  std::pair<uint64_t, uint64_t> KeyHash(const Key& k) const {
+    return WithKeyBytes(k, [&](const uint8_t* buf, size_t sz) {
+      return std::make_pair(XXHash64(buf, sz, seed), XXHash64(buf, sz, ~seed));
+    });
+  }
+};
+
+} // namespace io_internal
+
+// maps keys[i] to i; keys must be distinct
+template <class Key>
+void WritePerfectHashMap(const std::string& fname, const std::vector<Key>& keys) {
+  constexpr int kMaxSeeds = 8;
+  constexpr size_t kMaxPilot = 65535;
+  if (keys.size() >= (1ll << 32)) throw std::range_error("too many keys");
+  io_internal::PerfectHashLayout layout;
+  layout.num_keys = keys.size();
+  if (keys.size()) {
+    // ~5n / log2(n) buckets, as in PTHash
+    layout.num_buckets = std::max<uint64_t>(1, 5 * keys.size() / std::max(1, 64 - clz<uint64_t>(keys.size())));
+    layout.table_size = std::max<uint64_t>(keys.size(), keys.size() / 0.98);
+  }
+
+  struct Entry {
+    uint64_t h2;
+    uint32_t bucket, value, fingerprint;
+  };
+  std::vector<Entry> entries(keys.size());
+  std::vector<uint16_t> pilots;
+  std::vector<std::pair<uint32_t, uint32_t>> table; // (value, fingerprint); value = -1 if empty
+  for (int attempt = 0;; attempt++) {
+    if (attempt == kMaxSeeds) throw std::runtime_error("perfect hash construction failed (duplicate keys?)");
+    layout.seed = Hash(attempt, keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+      auto [h1, h2] = layout.KeyHash(keys[i]);
+      entries[i] = {h2, (uint32_t)layout.Bucket(h1), (uint32_t)i, layout.Fingerprint(h1, h2)};
+    }
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+      return a.bucket != b.bucket ? a.bucket < b.bucket : a.h2 < b.h2;
+    });
+    // keys with the same bucket and h2 can never be separated
+    bool ok = true;
+    for (size_t i = 1; i < entries.size() && ok; i++) {
+      if (entries[i].bucket == entries[i-1].bucket && entries[i].h2 == entries[i-1].h2) ok = false;
+    }
+    if (!ok) continue;
+
+    // (size, start) of each bucket; larger buckets are placed first
+    std::vector<std::pair<uint32_t, size_t>> buckets;
+    for (size_t i = 0, j = 0; i < entries.size(); i = j) {
+      while (j < entries.size() && entries[j].bucket == entries[i].bucket) j++;
+      buckets.push_back({j - i, i});
+    }
+    std::stable_sort(buckets.begin(), buckets.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+
+    pilots.assign(layout.num_buckets, 0);
+    table.assign(layout.table_size, {(uint32_t)-1, 0});
+    // occupancy bitmap; much smaller than the table, so probing pilots stays in cache
+    std::vector<uint64_t> taken((layout.table_size + 63) / 64);
+    std::vector<uint64_t> pos;
+    for (auto& [size, start] : buckets) {
+      bool placed = false;
+      for (size_t pilot = 0; pilot <= kMaxPilot && !placed; pilot++) {
+        pos.clear();
+        placed = true;
+        for (size_t i = start; i < start + size && placed; i++) {
+          uint64_t p = layout.Position(entries[i].h2, pilot);
+          if ((taken[p / 64] >> (p % 64) & 1) || std::find(pos.begin(), pos.end(), p) != pos.end()) placed = false;
+          pos.push_back(p);
+        }
+        if (!placed) continue;
+        pilots[entries[start].bucket] = pilot;
+        for (size_t i = 0; i < size; i++) {
+          taken[pos[i] / 64] |= 1ull << (pos[i] % 64);
+          table[pos[i]] = {entries[start + i].value, entries[start + i].fingerprint};
+        }
+      }
+      if (!placed) {
+        ok = false;
+        break;
+      }
+    }
+    if (ok) break;
+  }
+  entries.clear();
+  entries.shrink_to_fit();
+
+  std::vector<uint8_t> buf(layout.FileSize());
+  memcpy(buf.data(), layout.kMagic, sizeof(layout.kMagic));
+  IntToBytes<uint64_t>(layout.num_keys, buf.data() + 8);
+  IntToBytes<uint64_t>(layout.num_buckets, buf.data() + 16);
+  IntToBytes<uint64_t>(layout.table_size, buf.data() + 24);
+  IntToBytes<uint64_t>(layout.seed, buf.data() + 32);
+  for (size_t i = 0; i < pilots.size(); i++) {
+    IntToBytes<uint16_t>(pilots[i], buf.data() + layout.PilotOffset() + i * sizeof(uint16_t));
+  }
+  // move the slots past num_keys into the holes before it
+  size_t hole = 0;
+  for (size_t p = layout.num_keys; p < layout.table_size; p++) {
+    if (table[p].first == (uint32_t)-1) continue;
+    while (table[hole].first != (uint32_t)-1) hole++;
+    table[hole] = table[p];
+    IntToBytes<uint32_t>(hole, buf.data() + layout.RemapOffset() + (p - layout.num_keys) * sizeof(uint32_t));
+  }
+  for (size_t i = 0; i < layout.num_keys; i++) {
+    uint8_t* ptr = buf.data() + layout.SlotOffset() + i * 2 * sizeof(uint32_t);
+    IntToBytes<uint32_t>(table[i].first, ptr);
+    IntToBytes<uint32_t>(table[i].second, ptr + sizeof(uint32_t));
+  }
+
+  std::ofstream fout(fname, std::ios_base::binary);
+  if (!fout.write(reinterpret_cast<const char*>(buf.data()), buf.size())) {
+    throw std::runtime_error("write failed");
+  }
+}
+
+// mmap-backed reader of WritePerfectHashMap; lookups are const and thread-safe
+template <class Key>
+class PerfectHashMapReader {
+  io_internal::MappedFile file;
+  io_internal::PerfectHashLayout layout;
+ public:
+  PerfectHashMapReader(const std::string& fname) : file(fname) {
+    if (file.size() < layout.kHeaderSize || memcmp(file.data(), layout.kMagic, sizeof(layout.kMagic)) != 0) {
+      throw std::runtime_error("invalid perfect hash file");
+    }
+    layout.num_keys = BytesToInt<uint64_t>(file.data() + 8);
+    layout.num_buckets = BytesToInt<uint64_t>(file.data() + 16);
+    layout.table_size = BytesToInt<uint64_t>(file.data() + 24);
+    layout.seed = BytesToInt<uint64_t>(file.data() + 32);
+    if (layout.table_size < layout.num_keys || (layout.num_keys && !layout.num_buckets) ||
+        file.size() != layout.FileSize()) {
+      throw std::runtime_error("invalid perfect hash file");
+    }
+  }
+
+  size_t size() const { return layout.num_keys; }
+
+  std::optional<uint32_t> operator[](const Key& k) const {
+    if (!layout.num_keys) return std::nullopt;
+    auto [h1, h2] = layout.KeyHash(k);
+    uint64_t bucket = layout.Bucket(h1);
+    uint16_t pilot = BytesToInt<uint16_t>(file.data() + layout.PilotOffset() + bucket * sizeof(uint16_t));
+    uint64_t pos = layout.Position(h2, pilot);
+    if (pos >= layout.num_keys) {
+      pos = BytesToInt<uint32_t>(file.data() + layout.RemapOffset() + (pos - layout.num_keys) * sizeof(uint32_t));
+    }
+    const uint8_t* slot = file.data() + layout.SlotOffset() + pos * 2 * sizeof(uint32_t);
+    if (BytesToInt<uint32_t>(slot + sizeof(uint32_t)) != layout.Fingerprint(h1, h2)) return std::nullopt;
+    return BytesToInt<uint32_t>(slot);
+  }
+};
+
+/*
+ * Xor filter with 8-bit fingerprints (Graf & Lemire): ~1.23 bytes per key, no false negatives and
+ * ~0.4% false positives. Every key maps to one slot in each third of the table, and the xor of the
+ * three slots equals its fingerprint.
+ *
+ *   0 magic[8]    8 num_keys    16 seed    24 block_length    32 fingerprints (u8[3 * block_length])
+ */
+template <class Key>
+class XorFilter {
+  static constexpr char kMagic[8] = {'B', 'T', 'T', 'B', 'X', 'O', 'R', '8'};
+  static constexpr size_t kHeaderSize = 32;
+
+  uint64_t num_keys = 0, seed = 0, block_length = 0;
+  std::vector<uint8_t> fingerprints;
+
+  uint64_t KeyHash(const Key& k) const {
+    return io_internal::WithKeyBytes(k, [&](const uint8_t* buf, size_t sz) { return XXHash64(buf, sz, seed); });
+  }
+  std::array<uint64_t, 3> Slots(uint64_t h) const {
+    std::array<uint64_t, 3> ret;
+    for (int i = 0; i < 3; i++) {
+      uint64_t x = i ? (h << (21 * i)) | (h >> (64 - 21 * i)) : h;
+      ret[i] = i * block_length + io_internal::PerfectHashLayout::Reduce(x, block_length);
+    }
+    return ret;
+  }
+  static uint8_t Fingerprint(uint64_t h) { return h ^ (h >> 32); }
+
+  XorFilter() = default;
+ public:
+  XorFilter(const std::string& fname) {
+    std::ifstream fin(fname, std::ios_base::binary);
+    if (!fin.is_open()) throw std::runtime_error("cannot open file");
+    uint8_t buf[kHeaderSize];
+    if (!fin.read(reinterpret_cast<char*>(buf), kHeaderSize) || memcmp(buf, kMagic, sizeof(kMagic)) != 0) {
+      throw std::runtime_error("invalid filter file");
+    }
+    num_keys = BytesToInt<uint64_t>(buf + 8);
+    seed = BytesToInt<uint64_t>(buf + 16);
+    block_length = BytesToInt<uint64_t>(buf + 24);
+    fingerprints.resize(block_length * 3);
+    if (!fin.read(reinterpret_cast<char*>(fingerprints.data()), fingerprints.size()) || fin.peek() != EOF) {
+      throw std::runtime_error("invalid filter file");
+    }
+  }
+
+  // keys must be distinct
+  static XorFilter Build(const std::vector<Key>& keys) {
+    constexpr int kMaxSeeds = 64;
+    XorFilter ret;
+    ret.num_keys = keys.size();
+    ret.block_length = (32 + keys.size() * 123 / 100) / 3;
+    size_t size = ret.block_length * 3;
+    std::vector<uint64_t> hashes(keys.size());
+    std::vector<uint64_t> xor_mask(size);
+    std::vector<uint32_t> count(size);
+    std::vector<uint64_t> queue;
+    std::vector<std::pair<uint64_t, uint64_t>> stack; // (hash, slot it is assigned to)
+    for (int attempt = 0;; attempt++) {
+      if (attempt == kMaxSeeds) throw std::runtime_error("xor filter construction failed (duplicate keys?)");
+      ret.seed = Hash(attempt, keys.size());
+      std::fill(xor_mask.begin(), xor_mask.end(), 0);
+      std::fill(count.begin(), count.end(), 0);
+      for (size_t i = 0; i < keys.size(); i++) {
+        hashes[i] = ret.KeyHash(keys[i]);
+        for (uint64_t slot : ret.Slots(hashes[i])) {
+          xor_mask[slot] ^= hashes[i];
+          count[slot]++;
+        }
+      }
+      // peel the slots that hold a single key
+      queue.clear();
+      stack.clear();
+      for (size_t i = 0; i < size; i++) {
+        if (count[i] == 1) queue.push_back(i);
+      }
+      while (queue.size()) {
+        uint64_t slot = queue.back();
+        queue.pop_back();
+        if (count[slot] != 1) continue;
+        uint64_t h = xor_mask[slot];
+        stack.push_back({h, slot});
+        for (uint64_t other : ret.Slots(h)) {
+          xor_mask[other] ^= h;
+          if (--count[other] == 1) queue.push_back(other);
+        }
+      }
+      if (stack.size() == keys.size()) break;
+    }
+    ret.fingerprints.assign(size, 0);
+    for (size_t i = stack.size(); i--;) {
+      auto [h, slot] = stack[i];
+      uint8_t fp = Fingerprint(h);
+      for (uint64_t other : ret.Slots(h)) fp ^= ret.fingerprints[other];
+      ret.fingerprints[slot] = fp;
+    }
+    return ret;
+  }
+
+  void Write(const std::string& fname) const {
+    uint8_t buf[kHeaderSize];
+    memcpy(buf, kMagic, sizeof(kMagic));
+    IntToBytes<uint64_t>(num_keys, buf + 8);
+    IntToBytes<uint64_t>(seed, buf + 16);
+    IntToBytes<uint64_t>(block_length, buf + 24);
+    std::ofstream fout(fname, std::ios_base::binary);
+    if (!fout.write(reinterpret_cast<const char*>(buf), kHeaderSize) ||
+        !fout.write(reinterpret_cast<const char*>(fingerprints.data()), fingerprints.size())) {
+      throw std::runtime_error("write failed");
+    }
+  }
+
+  size_t size() const { return num_keys; }
+
+  // false if the key is definitely absent
+  bool MayContain(const Key& k) const {
+    if (!num_keys) return false;
+    uint64_t h = KeyHash(k);
+    auto [s0, s1, s2] = Slots(h);
+    return (uint8_t)(fingerprints[s0] ^ fingerprints[s1] ^ fingerprints[s2]) == Fingerprint(h);
+  }
+};
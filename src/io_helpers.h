@@ -5,6 +5,7 @@
 #include <array>
 #include <vector>
 #include <stdexcept>
+#include "file_header.h"
 #include "constexpr_helpers.h"
 
 template <size_t size_bytes, class T, class Func>
@@ -58,6 +59,32 @@ inline size_t SimpleVecInput(std::vector<T>& vec, const uint8_t data[], size_t b
   return sizeof(T) * vec.size();
 }
 
+// unsigned LEB128
+constexpr size_t VarintSize(uint64_t x) {
+  size_t ret = 1;
+  for (; x >= 0x80; x >>= 7) ret++;
+  return ret;
+}
+
+inline size_t VarintOutput(uint64_t x, uint8_t data[]) {
+  size_t ind = 0;
+  for (; x >= 0x80; x >>= 7) data[ind++] = (x & 0x7f) | 0x80;
+  data[ind++] = x;
+  return ind;
+}
+
+inline size_t VarintInput(uint64_t& x, const uint8_t data[]) {
+  x = 0;
+  size_t ind = 0;
+  for (int shift = 0;; shift += 7) {
+    if (shift >= 64) throw std::runtime_error("invalid varint");
+    uint8_t byte = data[ind++];
+    x |= (uint64_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) break;
+  }
+  return ind;
+}
+
 template <class T, size_t sz>
 struct SimpleIOArray : public std::array<T, sz> {
   using std::array<T, sz>::array;
@@ -9,9 +9,11 @@
 #include "prune.h"
 #include "config.h"
 #include "server.h"
+#include "dictionary.h"
 #include "inspect.h"
 #include "evaluate.h"
 #include "simulate.h"
+#include "verify.h"
 #include "board_set.h"
 #include "sample_svd.h"
 #include "sample_train.h"
@@ -140,6 +142,15 @@ int main(int argc, char** argv) {
       .metavar("N")
       .scan<'i', int>()
       .default_value(4);
+    parser.add_argument("--read-ahead")
+      .help("Number of blocks each reader keeps decompressed ahead in background (0 to disable)")
+      .metavar("N")
+      .scan<'i', int>()
+      .default_value(0);
+    parser.add_argument("--direct-io")
+      .help("Read edge files with O_DIRECT, bypassing the page cache (--read-ahead sets reads in flight, at least 4)")
+      .default_value(false)
+      .implicit_value(true);
   };
   auto ResumeArg = [](ArgumentParser& parser) {
     parser.add_argument("-r", "--resume")
@@ -155,6 +166,12 @@ int main(int argc, char** argv) {
       .scan<'i', int>()
       .default_value(0);
   };
+  auto HalfValuesArg = [](ArgumentParser& parser) {
+    parser.add_argument("--half")
+      .help("Keep values as half floats in memory (halves memory usage, about 3 significant digits)")
+      .default_value(false)
+      .implicit_value(true);
+  };
   auto NumSamplesArg = [](ArgumentParser& parser) {
     parser.add_argument("-n", "--num-samples-per-group").required()
       .help("Number of samples for each group")
@@ -192,6 +209,13 @@ int main(int argc, char** argv) {
       .default_value(false)
       .implicit_value(true);
   };
+  auto BlockCacheArg = [](ArgumentParser& parser) {
+    parser.add_argument("--block-cache")
+      .help("Size of the shared cache of decompressed blocks in MiB (0 to disable)")
+      .metavar("MB")
+      .scan<'i', int>()
+      .default_value(256);
+  };
   auto ServerArgs = [](ArgumentParser& parser) {
     parser.add_argument("-b", "--bind")
       .help("Server bind address")
@@ -212,6 +236,12 @@ int main(int argc, char** argv) {
   ParallelArg(preprocess);
   preprocess.add_argument("board_file")
     .help("Board file");
+  preprocess.add_argument("-m", "--memory-limit")
+    .help("Sort in runs and merge them on disk, holding at most this many MiB of boards in memory "
+          "(sort buffers and merge read buffers included; 0 to sort in memory)")
+    .metavar("MB")
+    .scan<'i', long>()
+    .default_value(0l);
 
   ArgumentParser board_map("board-map", "", default_arguments::help);
   board_map.add_description("Generate board map");
@@ -226,6 +256,27 @@ int main(int argc, char** argv) {
     .help("The groups to build (0-" + std::to_string(kGroups - 1) + ", comma-separated, support Python-like range)")
     .metavar("GROUP")
     .default_value("0:" + std::to_string(kGroups));
+  build_edges.add_argument("-c", "--concurrent-groups")
+    .help("Number of groups built at the same time (each keeps a board map in memory and uses parallel/N threads)")
+    .metavar("N")
+    .scan<'i', int>()
+    .default_value(1);
+
+  ArgumentParser add_boards("add-boards", "", default_arguments::help);
+  add_boards.add_description("Add boards to a preprocessed board set and update its edges");
+  DataDirArg(add_boards);
+  ParallelArg(add_boards);
+  add_boards.add_argument("board_file")
+    .help("Board file");
+
+  ArgumentParser fixed_edges("fixed-edges", "", default_arguments::help);
+  fixed_edges.add_description("Convert evaluate edges to the pre-decoded fixed layout used in place by evaluate / move");
+  DataDirArg(fixed_edges);
+  ParallelArg(fixed_edges);
+  fixed_edges.add_argument("-g", "--groups")
+    .help("The groups to convert (0-" + std::to_string(kGroups - 1) + ", comma-separated, support Python-like range)")
+    .metavar("GROUP")
+    .default_value("0:" + std::to_string(kGroups));
 
   ArgumentParser evaluate("evaluate", "", default_arguments::help);
   evaluate.add_description("Calculate values of every board");
@@ -239,6 +290,10 @@ int main(int argc, char** argv) {
     .help("Store sampled values (must have sample file available)")
     .default_value(false)
     .implicit_value(true);
+  evaluate.add_argument("--half")
+    .help("Store values as half floats in memory and in checkpoints (halves memory usage, about 3 significant digits)")
+    .default_value(false)
+    .implicit_value(true);
 
   ArgumentParser move_cal("move", "", default_arguments::help);
   move_cal.add_description("Calculate moves of every board");
@@ -247,6 +302,7 @@ int main(int argc, char** argv) {
   IOThreadsArg(move_cal);
   ResumeArg(move_cal);
   UntilArg(move_cal);
+  HalfValuesArg(move_cal);
 
   ArgumentParser move_merge("move-merge", "", default_arguments::help);
   move_merge.add_description("Merge moves");
@@ -261,6 +317,7 @@ int main(int argc, char** argv) {
   IOThreadsArg(threshold_cal);
   ResumeArg(threshold_cal);
   UntilArg(threshold_cal);
+  HalfValuesArg(threshold_cal);
   threshold_cal.add_argument("-b", "--buckets").required()
     .help("Threshold file (contains base value of each lines)")
     .scan<'i', int>();
@@ -283,6 +340,31 @@ int main(int argc, char** argv) {
   threshold_merge.add_argument("name").required()
     .help("Name of this threshold");
 
+  ArgumentParser train_dict("train-dict", "", default_arguments::help);
+  train_dict.add_description("Train zstd dictionaries and recompress files with them");
+  DataDirArg(train_dict);
+  ParallelArg(train_dict);
+  train_dict.add_argument("type").required()
+    .help("Record type (moves/threshold/edges)")
+    .metavar("moves/threshold/edges");
+  train_dict.add_argument("-n", "--name")
+    .help("Name of the threshold (for threshold)")
+    .default_value("");
+  train_dict.add_argument("--dict-size")
+    .help("Dictionary size in bytes")
+    .scan<'i', long>()
+    .default_value(112640l);
+  train_dict.add_argument("--samples")
+    .help("Number of sampled blocks per file")
+    .scan<'i', long>()
+    .default_value(1024l);
+  train_dict.add_argument("--block-items")
+    .help("Items per block after recompression (0 to keep)")
+    .metavar("N")
+    .scan<'i', long>()
+    .default_value(0l);
+  SeedArg(train_dict);
+
   ArgumentParser mask_threshold("mask-threshold", "", default_arguments::help);
   mask_threshold.add_description("Get prune mask from values");
   DataDirArg(mask_threshold);
@@ -290,6 +372,7 @@ int main(int argc, char** argv) {
   IOThreadsArg(mask_threshold);
   ResumeArg(mask_threshold);
   UntilArg(mask_threshold);
+  HalfValuesArg(mask_threshold);
   mask_threshold.add_argument("-f", "--start-mask-file")
     .help("Start mask file")
     .default_value("");
@@ -351,11 +434,13 @@ int main(int argc, char** argv) {
   ArgumentParser fceux_server("fceux-server", "", default_arguments::help);
   fceux_server.add_description("Server for FCEUX");
   ServerArgs(fceux_server);
+  BlockCacheArg(fceux_server);
   DataDirArg(fceux_server);
 
   ArgumentParser board_server("board-server", "", default_arguments::help);
   board_server.add_description("Server for boards");
   ServerArgs(board_server);
+  BlockCacheArg(board_server);
   DataDirArg(board_server);
   board_server.add_argument("name").required()
     .help("Name of the threshold");
@@ -364,6 +449,7 @@ int main(int argc, char** argv) {
   simulate.add_description("Simulate games");
   DataDirArg(simulate);
   ParallelArg(simulate);
+  BlockCacheArg(simulate);
   simulate.add_argument("-f", "--seed-file")
     .help("File containing seeds")
     .default_value("-");
@@ -375,6 +461,11 @@ int main(int argc, char** argv) {
     .default_value(false)
     .implicit_value(true);
 
+  ArgumentParser verify("verify", "", default_arguments::help);
+  verify.add_description("Check headers, indexes and block checksums of all data files");
+  DataDirArg(verify);
+  ParallelArg(verify);
+
   ArgumentParser inspect("inspect", "", default_arguments::help);
   inspect.add_description("Inspect files");
 
@@ -433,11 +524,14 @@ int main(int argc, char** argv) {
   program.add_subparser(preprocess);
   program.add_subparser(board_map);
   program.add_subparser(build_edges);
+  program.add_subparser(add_boards);
+  program.add_subparser(fixed_edges);
   program.add_subparser(evaluate);
   program.add_subparser(move_cal);
   program.add_subparser(move_merge);
   program.add_subparser(threshold_cal);
   program.add_subparser(threshold_merge);
+  program.add_subparser(train_dict);
   program.add_subparser(mask_threshold);
   program.add_subparser(sample_svd);
   program.add_subparser(svd);
@@ -445,6 +539,7 @@ int main(int argc, char** argv) {
   program.add_subparser(fceux_server);
   program.add_subparser(board_server);
   program.add_subparser(simulate);
+  program.add_subparser(verify);
   program.add_subparser(inspect);
 
   try {
@@ -457,6 +552,10 @@ int main(int argc, char** argv) {
       std::cerr << board_map;
     } else if (program.is_subcommand_used("build-edges")) {
       std::cerr << build_edges;
+    } else if (program.is_subcommand_used("add-boards")) {
+      std::cerr << add_boards;
+    } else if (program.is_subcommand_used("fixed-edges")) {
+      std::cerr << fixed_edges;
     } else if (program.is_subcommand_used("evaluate")) {
       std::cerr << evaluate;
     } else if (program.is_subcommand_used("move")) {
@@ -467,6 +566,8 @@ int main(int argc, char** argv) {
       std::cerr << threshold_cal;
     } else if (program.is_subcommand_used("threshold-merge")) {
       std::cerr << threshold_merge;
+    } else if (program.is_subcommand_used("train-dict")) {
+      std::cerr << train_dict;
     } else if (program.is_subcommand_used("mask-threshold")) {
       std::cerr << mask_threshold;
     } else if (program.is_subcommand_used("sample-svd")) {
@@ -479,6 +580,8 @@ int main(int argc, char** argv) {
       std::cerr << fceux_server;
     } else if (program.is_subcommand_used("simulate")) {
       std::cerr << simulate;
+    } else if (program.is_subcommand_used("verify")) {
+      std::cerr << verify;
     } else if (program.is_subcommand_used("inspect")) {
       auto& subparser = program.at<ArgumentParser>("inspect");
       if (subparser.is_subcommand_used("board")) {
@@ -512,6 +615,11 @@ int main(int argc, char** argv) {
   };
   auto SetIOThreads = [&](const ArgumentParser& args) {
     kIOThreads = args.get<int>("--io-threads");
+    kReadAhead = args.get<int>("--read-ahead");
+    kDirectIO = args.get<bool>("--direct-io");
+  };
+  auto SetBlockCache = [&](const ArgumentParser& args) {
+    kBlockCacheMB = args.get<int>("--block-cache");
   };
   auto GetGroup = [](const ArgumentParser& args) {
     return args.get<int>("--group");
@@ -541,7 +649,7 @@ int main(int argc, char** argv) {
       SetParallel(args);
       SetDataDir(args);
       std::filesystem::path board_file = args.get<std::string>("board_file");
-      SplitBoards(board_file);
+      SplitBoards(board_file, (size_t)args.get<long>("--memory-limit") << 20);
     } else if (program.is_subcommand_used("board-map")) {
       auto& args = program.at<ArgumentParser>("board-map");
       SetParallel(args);
@@ -552,7 +660,19 @@ int main(int argc, char** argv) {
       SetParallel(args);
       SetDataDir(args);
       auto groups = ParseIntList<int>(args.get<std::string>("--groups"));
-      BuildEdges(groups);
+      BuildEdges(groups, args.get<int>("--concurrent-groups"));
+    } else if (program.is_subcommand_used("add-boards")) {
+      auto& args = program.at<ArgumentParser>("add-boards");
+      SetParallel(args);
+      SetDataDir(args);
+      std::filesystem::path board_file = args.get<std::string>("board_file");
+      AddBoards(board_file);
+    } else if (program.is_subcommand_used("fixed-edges")) {
+      auto& args = program.at<ArgumentParser>("fixed-edges");
+      SetParallel(args);
+      SetDataDir(args);
+      auto groups = ParseIntList<int>(args.get<std::string>("--groups"));
+      ConvertFixedEdges(groups);
     } else if (program.is_subcommand_used("evaluate")) {
       auto& args = program.at<ArgumentParser>("evaluate");
       SetParallel(args);
@@ -561,7 +681,8 @@ int main(int argc, char** argv) {
       int resume = GetResume(args);
       auto checkpoints = ParseIntList<int>(args.get<std::string>("--checkpoints"));
       bool sample = args.get<bool>("--store-sample");
-      RunEvaluate(resume, checkpoints, sample);
+      bool half = args.get<bool>("--half");
+      RunEvaluate(resume, checkpoints, sample, half);
     } else if (program.is_subcommand_used("move")) {
       auto& args = program.at<ArgumentParser>("move");
       SetParallel(args);
@@ -569,7 +690,7 @@ int main(int argc, char** argv) {
       SetIOThreads(args);
       int resume = GetResume(args);
       int until = args.get<int>("--until");
-      RunCalculateMoves(resume, until);
+      RunCalculateMoves(resume, until, args.get<bool>("--half"));
     } else if (program.is_subcommand_used("move-merge")) {
       auto& args = program.at<ArgumentParser>("move-merge");
       SetParallel(args);
@@ -598,7 +719,8 @@ int main(int argc, char** argv) {
       float end_ratio = args.get<float>("--ratio-high");
       int buckets = args.get<int>("--buckets");
       buckets = std::max(3, std::min(255, buckets));
-      RunCalculateThreshold(resume, until, name, threshold_path, start_ratio, end_ratio, buckets);
+      RunCalculateThreshold(resume, until, name, threshold_path, start_ratio, end_ratio, buckets,
+                            args.get<bool>("--half"));
     } else if (program.is_subcommand_used("threshold-merge")) {
       auto& args = program.at<ArgumentParser>("threshold-merge");
       SetParallel(args);
@@ -615,6 +737,25 @@ int main(int argc, char** argv) {
       } else {
         throw std::runtime_error("start / end not given");
       }
+    } else if (program.is_subcommand_used("train-dict")) {
+      auto& args = program.at<ArgumentParser>("train-dict");
+      SetParallel(args);
+      SetDataDir(args);
+      std::string type = args.get<std::string>("type");
+      std::string name = args.get<std::string>("--name");
+      DictionaryTarget target;
+      if (type == "moves") {
+        target = DictionaryTarget::kMoves;
+      } else if (type == "threshold") {
+        if (name.empty()) throw std::runtime_error("threshold name not given");
+        target = DictionaryTarget::kThreshold;
+      } else if (type == "edges") {
+        target = DictionaryTarget::kEdges;
+      } else {
+        throw std::runtime_error("invalid record type");
+      }
+      TrainDictionaries(target, name, args.get<long>("--dict-size"), args.get<long>("--samples"),
+                        args.get<long>("--block-items"), GetSeed(args));
     } else if (program.is_subcommand_used("mask-threshold")) {
       auto& args = program.at<ArgumentParser>("mask-threshold");
       SetParallel(args);
@@ -627,7 +768,7 @@ int main(int argc, char** argv) {
       float threshold = args.get<float>("--threshold");
       ThresholdMask(
           start_mask_path == "" ? SameValueMask(kAllZeroValue) : ReadMask(start_mask_path),
-          resume, until, threshold, mask_path);
+          resume, until, threshold, mask_path, args.get<bool>("--half"));
     } else if (program.is_subcommand_used("sample-svd")) {
       auto& args = program.at<ArgumentParser>("sample-svd");
       SetParallel(args);
@@ -662,6 +803,7 @@ int main(int argc, char** argv) {
     } else if (program.is_subcommand_used("fceux-server")) {
       auto& args = program.at<ArgumentParser>("fceux-server");
       SetDataDir(args);
+      SetBlockCache(args);
       int port = args.get<int>("--port");
       std::string addr = args.get<std::string>("--bind");
       bool one_conn = args.get<bool>("--exclusive");
@@ -669,6 +811,7 @@ int main(int argc, char** argv) {
     } else if (program.is_subcommand_used("board-server")) {
       auto& args = program.at<ArgumentParser>("board-server");
       SetDataDir(args);
+      SetBlockCache(args);
       int port = args.get<int>("--port");
       std::string addr = args.get<std::string>("--bind");
       std::string threshold_name = args.get<std::string>("name");
@@ -678,10 +821,16 @@ int main(int argc, char** argv) {
       auto& args = program.at<ArgumentParser>("simulate");
       SetParallel(args);
       SetDataDir(args);
+      SetBlockCache(args);
       std::string seed_file = args.get<std::string>("--seed-file");
       std::string output_file = args.get<std::string>("--output-file");
       bool gym_rng = args.get<bool>("--gym-rng");
       OutputSimulate(seed_file, output_file, gym_rng);
+    } else if (program.is_subcommand_used("verify")) {
+      auto& args = program.at<ArgumentParser>("verify");
+      SetParallel(args);
+      SetDataDir(args);
+      if (!VerifyDataFiles()) return 1;
     } else if (program.is_subcommand_used("inspect")) {
       auto& subparser = program.at<ArgumentParser>("inspect");
       if (subparser.is_subcommand_used("board")) {
@@ -13,6 +13,7 @@
 #include <tsl/hopscotch_map.h>
 #include "config.h"
 #include "evaluate.h"
+#include "edge_fixed.h"
 #include "board_set.h"
 #include "thread_queue.h"
 
@@ -69,12 +70,12 @@ inline void NodeMoveIndexFromVec(NodeMoveIndex& ret, __m256i v) {
   for (size_t i = 0; i < kPieces; i++) ret[i] = idx[i];
 }
 
-template <bool calculate_moves>
+template <bool calculate_moves, class Edges, class Value>
 void CalculateBlock(
-    const EvaluateNodeEdgesFast* edges, size_t edges_size,
-    const std::vector<MoveEval>& prev,
+    const Edges* edges, size_t edges_size,
+    const std::vector<Value>& prev,
     int base_lines,
-    MoveEval out[], NodeMoveIndex out_idx[] = nullptr) {
+    Value out[], NodeMoveIndex out_idx[] = nullptr) {
   if (!edges_size) return;
   if (edges_size % kPieces != 0) throw std::logic_error("unexpected: not multiples of 7");
   size_t boards = edges_size / kPieces;
@@ -86,11 +87,8 @@ void CalculateBlock(
     for (size_t piece = 0; piece < kPieces; piece++) {
       auto& item = edges[b * kPieces + piece];
       if (!item.next_ids_size) continue;
-      for (size_t i = 0; i < item.next_ids_size; i++) {
-        auto& [next, lines] = item.next_ids[i];
-        local_val[i] = prev[next];
-        local_val[i] += Score(base_lines, lines);
-      }
+      GatherValues(prev.data(), item.next_ids, item.next_ids_size, local_val);
+      for (size_t i = 0; i < item.next_ids_size; i++) local_val[i] += Score(base_lines, item.next_ids[i].second);
       __m256 probs = _mm256_load_ps(kTransitionProb[piece]);
       __m256i res_idx = _mm256_setzero_si256();
       float mx_ev = 0.;
@@ -156,96 +154,51 @@ void CalculateBlock(
   }
 }
 
-template <bool calculate_moves>
+// write the move indices of a finished range in the background, after the previous range
+void StartIndexWriter(
+    CompressedClassWriter<NodeMoveIndex>* idx_writer_ptr, std::vector<NodeMoveIndex>&& out_idx,
+    std::optional<std::thread>& writer_thread) {
+  if (writer_thread) {
+    writer_thread.value().join();
+    writer_thread = std::nullopt;
+  }
+  writer_thread = std::thread([idx_writer_ptr,out_idx=std::move(out_idx)]() {
+    idx_writer_ptr->Write(out_idx);
+  });
+}
+
+template <bool calculate_moves, class Value>
 void CalculateSameLines(
-    int group, size_t start, size_t end, const std::vector<MoveEval>& prev, int lines,
-    MoveEval out[], CompressedClassWriter<NodeMoveIndex>* idx_writer_ptr,
+    int group, size_t start, size_t end, const std::vector<Value>& prev, int lines,
+    Value out[], CompressedClassWriter<NodeMoveIndex>* idx_writer_ptr,
     std::optional<std::thread>& writer_thread) {
   constexpr size_t kBatchSize = 1024;
-  constexpr size_t kBlockSize = 524288;
 
   int level = GetLevelByLines(lines);
-  auto fname = EvaluateEdgePath(group, GetLevelSpeed(level));
-  using Result = std::pair<size_t, size_t>;
-
   std::vector<NodeMoveIndex> out_idx;
   if constexpr (calculate_moves) {
     out_idx.resize((end - start) * kPieces);
   }
 
-  BS::thread_pool io_pool(kIOThreads);
-  auto thread_queue = MakeThreadQueue<Result>(kParallel,
-      [&](Result range) {
-        /* collect stats */
+  ScanEvaluateEdges(group, GetLevelSpeed(level), start * kPieces, end * kPieces, kBatchSize * kPieces,
+      [&](size_t pos, auto& edges) {
+        size_t batch_l = pos / kPieces;
+        auto out_ptr = calculate_moves ? out_idx.data() + (batch_l - start) * kPieces : nullptr;
+        CalculateBlock<calculate_moves>(edges.data(), edges.size(), prev, lines, out + batch_l, out_ptr);
       });
-
-  std::mutex mtx;
-  std::condition_variable cv;
-  size_t unfinished = 0;
-  std::deque<std::function<Result()>> works;
-
-  std::vector<std::thread> thrs;
-  for (size_t block_start = start; block_start < end; block_start += kBlockSize) {
-    size_t block_end = std::min(end, block_start + kBlockSize);
-    unfinished++;
-    io_pool.push_task([&fname,&thread_queue,&works,&unfinished,&cv,&mtx,block_start,block_end,start,&prev,lines,out,&out_idx]() {
-      CompressedClassReader<EvaluateNodeEdgesFast> reader(fname);
-      reader.Seek(block_start * kPieces);
-      for (size_t batch_l = block_start; batch_l < block_end; batch_l += kBatchSize) {
-        size_t batch_r = std::min(block_end, batch_l + kBatchSize);
-        size_t num_to_read = (batch_r - batch_l) * kPieces;
-        std::unique_ptr<EvaluateNodeEdgesFast[]> edges(new EvaluateNodeEdgesFast[num_to_read]);
-        if (num_to_read != reader.ReadBatch(edges.get(), num_to_read)) throw std::runtime_error("read failure");
-        {
-          std::lock_guard lck(mtx);
-          works.push_back(make_copyable_function([
-                edges=std::move(edges),&works,&unfinished,&cv,&mtx,num_to_read,start,batch_l,batch_r,&prev,lines,out,&out_idx
-          ]() {
-            auto out_ptr = calculate_moves ? out_idx.data() + (batch_l - start) * kPieces : nullptr;
-            CalculateBlock<calculate_moves>(edges.get(), num_to_read, prev, lines, out + batch_l, out_ptr);
-            return std::make_pair(batch_l, batch_r);
-          }));
-        }
-        cv.notify_one();
-      }
-      {
-        std::lock_guard lck(mtx);
-        unfinished--;
-      }
-      cv.notify_one();
-    });
-  }
-  {
-    std::unique_lock lck(mtx);
-    while (unfinished) {
-      cv.wait(lck, [&]{ return unfinished == 0 || works.size(); });
-      while (works.size()) {
-        thread_queue.Push(std::move(works.front()));
-        works.pop_front();
-      }
-    }
-  }
-  io_pool.wait_for_tasks();
-  thread_queue.WaitAll();
-  if constexpr (calculate_moves) {
-    if (writer_thread) {
-      writer_thread.value().join();
-      writer_thread = std::nullopt;
-    };
-    writer_thread = std::thread([idx_writer_ptr,out_idx=std::move(out_idx)]() {
-      idx_writer_ptr->Write(out_idx);
-    });
-  }
+  if constexpr (calculate_moves) StartIndexWriter(idx_writer_ptr, std::move(out_idx), writer_thread);
 }
 
-template <bool calculate_moves>
-std::vector<MoveEval> CalculatePieceMoves(
-    int pieces, const std::vector<MoveEval>& prev, const std::vector<size_t>& offsets) {
+template <bool calculate_moves, class Value>
+std::vector<Value> CalculatePieceMoves(
+    int pieces, const std::vector<Value>& prev, const std::vector<size_t>& offsets) {
   int group = GetGroupByPieces(pieces);
-  std::vector<MoveEval> ret(offsets.back());
+  std::vector<Value> ret(offsets.back());
   std::unique_ptr<CompressedClassWriter<NodeMoveIndex>> writer;
   if constexpr (calculate_moves) {
-    writer.reset(new CompressedClassWriter<NodeMoveIndex>(MoveIndexPath(pieces), 4096 * kPieces));
+    // compression runs alongside the calculation of the next lines, so use io threads
+    writer.reset(new CompressedClassWriter<NodeMoveIndex>(
+        MoveIndexPath(pieces), 4096 * kPieces, std::make_unique<ParallelZstdCompressor>(kIOThreads)));
   }
 
   std::optional<std::thread> writer_thread;
@@ -272,7 +225,7 @@ std::vector<MoveEval> CalculatePieceMoves(
     int lines = cells / 10;
     if (lines >= kLineCap) {
       // lines will decrease as i increase, so this only happen at the start of the loop
-      memset(ret.data() + start, 0x0, (offsets[i + 1] - start) * sizeof(MoveEval));
+      memset(ret.data() + start, 0x0, (offsets[i + 1] - start) * sizeof(Value));
       if constexpr (calculate_moves) {
         WaitWriter();
         writer->Write(NodeMoveIndex{}, (offsets[i + 1] - start) * kPieces);
@@ -292,7 +245,7 @@ std::vector<MoveEval> CalculatePieceMoves(
     CalculateSameLines<calculate_moves>(group, start, last, prev, cur_lines, ret.data(), writer.get(), writer_thread);
   }
   if (last < offsets.back()) {
-    memset(ret.data() + last, 0x0, (offsets.back() - last) * sizeof(MoveEval));
+    memset(ret.data() + last, 0x0, (offsets.back() - last) * sizeof(Value));
     if constexpr (calculate_moves) {
       WaitWriter();
       writer->Write(NodeMoveIndex{}, (offsets.back() - last) * kPieces);
@@ -305,41 +258,73 @@ std::vector<MoveEval> CalculatePieceMoves(
   return ret;
 }
 
+// items produced by one read of the merge / threshold passes
+constexpr size_t kScanBatch = 2048 * kPieces;
+
+// ordered scans reading with all threads; the Merge*Ranges drivers merge one group at a time, since each
+// merge already uses all of them
+ScanOptions OrderedScanOptions() {
+  return ScanOptions{.io_threads = (size_t)kParallel, .ordered = true};
+}
+
+size_t ItemsPerIndex(const std::string& fname) {
+  return io_internal::GetBlockIndex(fname + ".index")->ItemsPerIndex();
+}
+
 template <class OneClass, class PartialClass, class OneFilenameFunc, class PartialFilenameFunc>
 void MergeRanges(int group, int pieces_l, int pieces_r, const std::vector<size_t>& offset, bool delete_after,
                  OneFilenameFunc&& one_filename_func, PartialFilenameFunc&& partial_filename_func, size_t index_size) {
   spdlog::info("Merging group {}: {} - {}", group, pieces_l, pieces_r);
   int orig_pieces_l = pieces_l;
   while (GetGroupByPieces(pieces_l) != group) pieces_l++;
-  std::vector<CompressedClassReader<OneClass>> readers;
+  std::vector<std::string> fnames;
   for (int pieces = pieces_l; pieces < pieces_r; pieces += kGroups) {
-    readers.emplace_back(one_filename_func(pieces));
+    fnames.push_back(one_filename_func(pieces));
   }
-  if (readers.empty()) return;
-  CompressedClassWriter<PartialClass> writer(
-      partial_filename_func(orig_pieces_l, pieces_r, group), index_size, -2);
-  std::vector<OneClass> buf(readers.size());
-  for (size_t i = 0; i < offset.size() - 1; i++) {
+  if (fnames.empty()) return;
+  // (start_lines_idx, begin, end) of the boards in offset range i
+  auto GetRange = [&](size_t i) {
     int start_cells = pieces_l * 4 - GetCellsByGroupOffset(i, group);
     if (start_cells % 10 != 0) throw std::logic_error("unexpected");
     int start_lines = start_cells / 10;
     uint8_t start_lines_idx = (uint32_t)start_lines / kGroupLineInterval;
     size_t begin = 0;
-    size_t end = std::min(buf.size(), (size_t)(kLineCap - start_lines + kGroupLineInterval - 1) / kGroupLineInterval);
+    size_t end = std::min(fnames.size(), (size_t)(kLineCap - start_lines + kGroupLineInterval - 1) / kGroupLineInterval);
     if (start_lines < 0) {
       start_lines_idx = 0;
       begin = (-start_lines + 1) / kGroupLineInterval;
     }
-    for (size_t x = 0; x < (offset[i + 1] - offset[i]) * kPieces; x++) {
-      for (size_t j = 0; j < readers.size(); j++) readers[j].ReadOne(&buf[j]);
-      writer.Write(PartialClass(buf.begin() + begin, buf.begin() + end, start_lines_idx));
+    return std::make_tuple(start_lines_idx, begin, end);
+  };
+  CompressedClassWriter<PartialClass> writer(
+      partial_filename_func(orig_pieces_l, pieces_r, group), index_size,
+      std::make_unique<ParallelZstdCompressor>(kParallel, -2));
+  ParallelScanChunks(0, offset.back() * kPieces, ItemsPerIndex(fnames[0]), kScanBatch, [&](size_t chunk_begin) {
+    auto readers = std::make_shared<std::vector<CompressedClassReader<OneClass>>>();
+    for (auto& fname : fnames) {
+      readers->emplace_back(fname);
+      readers->back().Seek(chunk_begin);
     }
-  }
+    return [&,readers,pos=chunk_begin](size_t num) mutable {
+      std::vector<PartialClass> ret;
+      ret.reserve(num);
+      std::vector<OneClass> buf(readers->size());
+      for (size_t batch_end = pos + num; pos < batch_end;) {
+        size_t i = std::upper_bound(offset.begin(), offset.end(), pos / kPieces) - offset.begin() - 1;
+        auto [start_lines_idx, begin, end] = GetRange(i);
+        for (size_t range_end = std::min(batch_end, offset[i + 1] * kPieces); pos < range_end; pos++) {
+          for (size_t j = 0; j < readers->size(); j++) (*readers)[j].ReadOne(&buf[j]);
+          ret.emplace_back(buf.begin() + begin, buf.begin() + end, start_lines_idx);
+        }
+      }
+      return ret;
+    };
+  }, [&](size_t, std::vector<PartialClass>&& items) {
+    writer.Write(items);
+  }, OrderedScanOptions());
   spdlog::info("Group {} merged", group);
   if (delete_after) {
-    readers.clear();
-    for (int pieces = pieces_l; pieces < pieces_r; pieces += kGroups) {
-      std::string fname = one_filename_func(pieces);
+    for (auto& fname : fnames) {
       std::filesystem::remove(fname);
       std::filesystem::remove(fname + ".index");
     }
@@ -347,50 +332,61 @@ void MergeRanges(int group, int pieces_l, int pieces_r, const std::vector<size_t
 }
 
 void MergeFullMoveRanges(int group, const std::vector<int>& sections, bool delete_after) {
-  std::vector<CompressedClassReader<PositionNodeEdges>> pos_readers;
-  std::vector<CompressedClassReader<NodeMoveIndexRange>> readers;
-  CompressedClassWriter<NodeMovePositionRange> writer(MovePath(group), 256 * kPieces, -2);
-  for (int i = 0; i < kLevels; i++) {
-    pos_readers.emplace_back(PositionEdgePath(group, i));
-  }
+  std::vector<std::string> fnames;
   for (size_t i = 0; i < sections.size() - 1; i++) {
-    readers.emplace_back(MoveRangePath(sections[i], sections[i+1], group));
+    fnames.push_back(MoveRangePath(sections[i], sections[i+1], group));
   }
-  PositionNodeEdges ed[kLevels];
+  CompressedClassWriter<NodeMovePositionRange> writer(
+      MovePath(group), 256 * kPieces, std::make_unique<ParallelZstdCompressor>(kParallel, -2));
   size_t n_boards = GetBoardCountOffset(group).back();
-  for (size_t i = 0; i < n_boards * kPieces; i++) {
-    NodeMovePositionRange range;
-    for (int lvl = 0; lvl < kLevels; lvl++) ed[lvl] = pos_readers[lvl].ReadOne();
-    for (auto& move_reader : readers) {
-      for (auto& move : move_reader.ReadOne().ranges) {
-        // exploit the fact that transitions are all at even number of lines
-        // for perfect play: lines always multiples of 4 so still okay
-        static_assert(std::all_of(kLevelSpeedLines, kLevelSpeedLines + kLevels, [](int x){ return x % 2 == 0; }));
-        Level start_level = GetLevelSpeedByLines(move.start * kGroupLineInterval);
-        Level end_level = GetLevelSpeedByLines((move.end - 1) * kGroupLineInterval);
-        for (int lvl = static_cast<int>(start_level); lvl <= static_cast<int>(end_level); lvl++) {
-          uint8_t start_idx = std::max((kLevelSpeedLines[lvl] + kGroupLineInterval - 1) / kGroupLineInterval, (int)move.start);
-          uint8_t end_idx = move.end;
-          if (lvl != kLevels - 1) {
-            end_idx = std::min((kLevelSpeedLines[lvl + 1] + kGroupLineInterval - 1) / kGroupLineInterval, (int)end_idx);
-          }
-          MovePositionRange item{start_idx, end_idx, {}};
-          if (ed[lvl].nexts.size()) {
-            for (size_t j = 0; j < kPieces; j++) item.pos[j] = ed[lvl].nexts[move.idx[j]];
-          } else {
-            for (size_t j = 0; j < kPieces; j++) item.pos[j] = Position::Invalid;
+  ParallelScanChunks(0, n_boards * kPieces, ItemsPerIndex(fnames[0]), kScanBatch, [&](size_t chunk_begin) {
+    auto pos_readers = std::make_shared<std::vector<CompressedClassReader<PositionNodeEdges>>>();
+    auto readers = std::make_shared<std::vector<CompressedClassReader<NodeMoveIndexRange>>>();
+    for (int i = 0; i < kLevels; i++) {
+      pos_readers->emplace_back(PositionEdgePath(group, i));
+      pos_readers->back().Seek(chunk_begin);
+    }
+    for (auto& fname : fnames) {
+      readers->emplace_back(fname);
+      readers->back().Seek(chunk_begin);
+    }
+    return [pos_readers,readers](size_t num) {
+      std::vector<NodeMovePositionRange> ret(num);
+      PositionNodeEdges ed[kLevels];
+      for (auto& range : ret) {
+        for (int lvl = 0; lvl < kLevels; lvl++) ed[lvl] = (*pos_readers)[lvl].ReadOne();
+        for (auto& move_reader : *readers) {
+          for (auto& move : move_reader.ReadOne().ranges) {
+            // exploit the fact that transitions are all at even number of lines
+            // for perfect play: lines always multiples of 4 so still okay
+            static_assert(std::all_of(kLevelSpeedLines, kLevelSpeedLines + kLevels, [](int x){ return x % 2 == 0; }));
+            Level start_level = GetLevelSpeedByLines(move.start * kGroupLineInterval);
+            Level end_level = GetLevelSpeedByLines((move.end - 1) * kGroupLineInterval);
+            for (int lvl = static_cast<int>(start_level); lvl <= static_cast<int>(end_level); lvl++) {
+              uint8_t start_idx = std::max((kLevelSpeedLines[lvl] + kGroupLineInterval - 1) / kGroupLineInterval, (int)move.start);
+              uint8_t end_idx = move.end;
+              if (lvl != kLevels - 1) {
+                end_idx = std::min((kLevelSpeedLines[lvl + 1] + kGroupLineInterval - 1) / kGroupLineInterval, (int)end_idx);
+              }
+              MovePositionRange item{start_idx, end_idx, {}};
+              if (ed[lvl].nexts.size()) {
+                for (size_t j = 0; j < kPieces; j++) item.pos[j] = ed[lvl].nexts[move.idx[j]];
+              } else {
+                for (size_t j = 0; j < kPieces; j++) item.pos[j] = Position::Invalid;
+              }
+              range <<= item;
+            }
           }
-          range <<= item;
         }
       }
-    }
-    writer.Write(range);
-  }
+      return ret;
+    };
+  }, [&](size_t, std::vector<NodeMovePositionRange>&& items) {
+    writer.Write(items);
+  }, OrderedScanOptions());
   spdlog::info("Group {} merged", group);
   if (delete_after) {
-    readers.clear();
-    for (size_t i = 0; i < sections.size() - 1; i++) {
-      std::string fname = MoveRangePath(sections[i], sections[i+1], group);
+    for (auto& fname : fnames) {
       std::filesystem::remove(fname);
       std::filesystem::remove(fname + ".index");
     }
@@ -398,33 +394,44 @@ void MergeFullMoveRanges(int group, const std::vector<int>& sections, bool delet
 }
 
 void MergeFullThresholdRanges(const std::string& name, int group, const std::vector<int>& sections, bool delete_after) {
-  std::vector<CompressedClassReader<NodePartialThreshold>> readers;
-  CompressedClassWriter<NodeThreshold> writer(ThresholdPath(name, group), 256 * kPieces, -2);
+  std::vector<std::string> fnames;
   for (size_t i = 0; i < sections.size() - 1; i++) {
-    readers.emplace_back(ThresholdRangePath(name, sections[i], sections[i+1], group));
+    fnames.push_back(ThresholdRangePath(name, sections[i], sections[i+1], group));
   }
+  CompressedClassWriter<NodeThreshold> writer(
+      ThresholdPath(name, group), 256 * kPieces, std::make_unique<ParallelZstdCompressor>(kParallel, -2));
   size_t n_boards = GetBoardCountOffset(group).back();
-  for (size_t i = 0; i < n_boards * kPieces; i++) {
-    NodeThreshold range = {};
-    for (auto& reader : readers) {
-      auto threshold = reader.ReadOne();
-      memcpy(range.data() + threshold.start, threshold.levels.data(), threshold.levels.size());
+  ParallelScanChunks(0, n_boards * kPieces, ItemsPerIndex(fnames[0]), kScanBatch, [&](size_t chunk_begin) {
+    auto readers = std::make_shared<std::vector<CompressedClassReader<NodePartialThreshold>>>();
+    for (auto& fname : fnames) {
+      readers->emplace_back(fname);
+      readers->back().Seek(chunk_begin);
     }
-    writer.Write(range);
-  }
+    return [readers](size_t num) {
+      std::vector<NodeThreshold> ret(num, NodeThreshold{});
+      for (auto& range : ret) {
+        for (auto& reader : *readers) {
+          auto threshold = reader.ReadOne();
+          memcpy(range.data() + threshold.start, threshold.levels.data(), threshold.levels.size());
+        }
+      }
+      return ret;
+    };
+  }, [&](size_t, std::vector<NodeThreshold>&& items) {
+    writer.Write(items);
+  }, OrderedScanOptions());
   spdlog::info("Group {} merged", group);
   if (delete_after) {
-    readers.clear();
-    for (size_t i = 0; i < sections.size() - 1; i++) {
-      std::string fname = ThresholdRangePath(name, sections[i], sections[i+1], group);
+    for (auto& fname : fnames) {
       std::filesystem::remove(fname);
       std::filesystem::remove(fname + ".index");
     }
   }
 }
 
-std::vector<MoveEval> LoadValues(int& start_pieces, const std::vector<size_t> offsets[]) {
-  std::vector<MoveEval> values;
+template <class Value>
+std::vector<Value> LoadValues(int& start_pieces, const std::vector<size_t> offsets[]) {
+  std::vector<Value> values;
   if (start_pieces == -1) {
     size_t max_cells = 0;
     for (int i = 0; i < kGroups; i++) {
@@ -433,10 +440,10 @@ std::vector<MoveEval> LoadValues(int& start_pieces, const std::vector<size_t> of
     start_pieces = (kLineCap * 10 + max_cells + 3) / 4;
     int start_group = GetGroupByPieces(start_pieces);
     values.resize(offsets[start_group].back());
-    memset(values.data(), 0x0, values.size() * sizeof(MoveEval));
+    memset(values.data(), 0x0, values.size() * sizeof(Value));
   } else {
     int start_group = GetGroupByPieces(start_pieces);
-    values = ReadValuesEvOnly(start_pieces, offsets[start_group].back());
+    values = ReadValuesEvOnly<Value>(start_pieces, offsets[start_group].back());
     if (values.size() != offsets[start_group].back()) throw std::length_error("initial value file incorrect");
   }
   return values;
@@ -456,37 +463,79 @@ std::vector<int> GetSections(const std::vector<std::pair<int, int>>& ranges) {
   return sections;
 }
 
-void WriteThreshold(int pieces, const std::vector<size_t>& offset, const std::vector<MoveEval>& values,
+template <class Value>
+void WriteThreshold(int pieces, const std::vector<size_t>& offset, const std::vector<Value>& values,
                     const std::string& name, const std::vector<float> threshold,
                     float start_ratio, float end_ratio, uint8_t buckets) {
   spdlog::info("Writing threshold of piece {}", pieces);
   int group = GetGroupByPieces(pieces);
-  CompressedClassWriter<BasicIOType<uint8_t>> writer(ThresholdOnePath(name, pieces), 65536 * kPieces);
-  for (size_t i = 0; i < offset.size() - 1; i++) {
-    int cells = pieces * 4 - GetCellsByGroupOffset(i, group);
-    std::vector<BasicIOType<uint8_t>> out((offset[i+1] - offset[i]) * kPieces, BasicIOType<uint8_t>{});
-    if (cells % 10) throw std::logic_error("unexpected: cells incorrect");
-    int lines = cells / 10;
-    if (cells >= 0 && lines < kLineCap) {
-      float thresh_low = threshold[lines] * start_ratio;
-      float thresh_high = threshold[lines] * end_ratio;
-      //  0 <-|-> 1 2 3 ... buckets-3 buckets-2 <-|-> buckets-1
-      // thresh_low                          thresh_high
-      // bucket(val) = floor( (val-thresh_low)/(thresh_high-thresh_low)*(bucket-2) + 1 )
-      //             = floor( (val-thresh_low)*multiplier + 1 )
-      //             = floor( val*multiplier + (1-thresh_low*multiplier) )
-      float multiplier = (buckets - 2) / (thresh_high - thresh_low);
-      float bias = 1 - thresh_low * multiplier;
-      float mx = buckets - 1;
-      for (size_t idx = offset[i]; idx < offset[i+1]; idx++) {
-        __m256 bucket = _mm256_fmadd_ps(values[idx].ev_vec, _mm256_set1_ps(multiplier), _mm256_set1_ps(bias));
-        bucket = _mm256_min_ps(_mm256_set1_ps(mx), _mm256_max_ps(_mm256_setzero_ps(), bucket));
-        alignas(32) float val[8];
-        _mm256_store_ps(val, bucket);
-        for (size_t j = 0; j < kPieces; j++) out[(idx - offset[i]) * kPieces + j] = val[j];
+  size_t index_size = 65536 * kPieces;
+  CompressedClassWriter<BasicIOType<uint8_t>> writer(
+      ThresholdOnePath(name, pieces), index_size, std::make_unique<ParallelZstdCompressor>(kParallel));
+  // batches are aligned to boards, since index_size and kScanBatch are multiples of kPieces
+  ParallelScanChunks(0, offset.back() * kPieces, index_size, kScanBatch, [&](size_t chunk_begin) {
+    return [&,pos=chunk_begin](size_t num) mutable {
+      std::vector<BasicIOType<uint8_t>> out(num, BasicIOType<uint8_t>{});
+      for (size_t batch_end = (pos + num) / kPieces, idx = pos / kPieces; idx < batch_end;) {
+        size_t i = std::upper_bound(offset.begin(), offset.end(), idx) - offset.begin() - 1;
+        size_t range_end = std::min(batch_end, offset[i + 1]);
+        int cells = pieces * 4 - GetCellsByGroupOffset(i, group);
+        if (cells % 10) throw std::logic_error("unexpected: cells incorrect");
+        int lines = cells / 10;
+        if (cells < 0 || lines >= kLineCap) {
+          idx = range_end;
+          continue;
+        }
+        float thresh_low = threshold[lines] * start_ratio;
+        float thresh_high = threshold[lines] * end_ratio;
+        //  0 <-|-> 1 2 3 ... buckets-3 buckets-2 <-|-> buckets-1
+        // thresh_low                          thresh_high
+        // bucket(val) = floor( (val-thresh_low)/(thresh_high-thresh_low)*(bucket-2) + 1 )
+        //             = floor( (val-thresh_low)*multiplier + 1 )
+        //             = floor( val*multiplier + (1-thresh_low*multiplier) )
+        float multiplier = (buckets - 2) / (thresh_high - thresh_low);
+        float bias = 1 - thresh_low * multiplier;
+        float mx = buckets - 1;
+        for (; idx < range_end; idx++) {
+          __m256 bucket = _mm256_fmadd_ps(MoveEval(values[idx]).ev_vec, _mm256_set1_ps(multiplier), _mm256_set1_ps(bias));
+          bucket = _mm256_min_ps(_mm256_set1_ps(mx), _mm256_max_ps(_mm256_setzero_ps(), bucket));
+          alignas(32) float val[8];
+          _mm256_store_ps(val, bucket);
+          for (size_t j = 0; j < kPieces; j++) out[(idx * kPieces - pos) + j] = val[j];
+        }
       }
-    }
-    writer.Write(out);
+      pos += num;
+      return out;
+    };
+  }, [&](size_t, std::vector<BasicIOType<uint8_t>>&& items) {
+    writer.Write(items);
+  }, OrderedScanOptions());
+}
+
+template <class Value>
+void RunCalculateMovesImpl(int start_pieces, int end_pieces) {
+  std::vector<size_t> offsets[kGroups];
+  for (int i = 0; i < kGroups; i++) offsets[i] = GetBoardCountOffset(i);
+
+  std::vector<Value> values = LoadValues<Value>(start_pieces, offsets);
+  for (int pieces = start_pieces - 1; pieces >= end_pieces; pieces--) {
+    values = CalculatePieceMoves<true>(pieces, values, offsets[GetGroupByPieces(pieces)]);
+  }
+}
+
+template <class Value>
+void RunCalculateThresholdImpl(
+    int start_pieces, int end_pieces,
+    const std::string& name, const std::vector<float>& threshold,
+    float start_ratio, float end_ratio, uint8_t buckets) {
+  std::vector<size_t> offsets[kGroups];
+  for (int i = 0; i < kGroups; i++) offsets[i] = GetBoardCountOffset(i);
+
+  std::vector<Value> values = LoadValues<Value>(start_pieces, offsets);
+  for (int pieces = start_pieces - 1; pieces >= end_pieces; pieces--) {
+    int group = GetGroupByPieces(pieces);
+    values = CalculatePieceMoves<false>(pieces, values, offsets[group]);
+    WriteThreshold(pieces, offsets[group], values, name, threshold, start_ratio, end_ratio, buckets);
   }
 }
 
@@ -497,47 +546,44 @@ std::vector<MoveEval> CalculatePiece(
   return CalculatePieceMoves<false>(pieces, prev, offsets);
 }
 
-void RunCalculateMoves(int start_pieces, int end_pieces) {
-  std::vector<size_t> offsets[kGroups];
-  for (int i = 0; i < kGroups; i++) offsets[i] = GetBoardCountOffset(i);
+std::vector<MoveEvalPacked> CalculatePiece(
+    int pieces, const std::vector<MoveEvalPacked>& prev, const std::vector<size_t>& offsets) {
+  return CalculatePieceMoves<false>(pieces, prev, offsets);
+}
 
-  std::vector<MoveEval> values = LoadValues(start_pieces, offsets);
-  for (int pieces = start_pieces - 1; pieces >= end_pieces; pieces--) {
-    values = CalculatePieceMoves<true>(pieces, values, offsets[GetGroupByPieces(pieces)]);
+std::vector<MoveEvalHalf> CalculatePiece(
+    int pieces, const std::vector<MoveEvalHalf>& prev, const std::vector<size_t>& offsets) {
+  return CalculatePieceMoves<false>(pieces, prev, offsets);
+}
+
+void RunCalculateMoves(int start_pieces, int end_pieces, bool half) {
+  if (half) {
+    RunCalculateMovesImpl<MoveEvalHalf>(start_pieces, end_pieces);
+  } else {
+    RunCalculateMovesImpl<MoveEvalPacked>(start_pieces, end_pieces);
   }
 }
 
 void MergeMoveRanges(int pieces_l, int pieces_r, bool delete_after) {
-  int threads = std::min(kParallel, kGroups);
-  BS::thread_pool pool(threads);
-  pool.parallelize_loop(0, kGroups, [&](int l, int r){
-    for (int group = l; group < r; group++) {
-      MergeRanges<NodeMoveIndex, NodeMoveIndexRange>(
-          group, pieces_l, pieces_r, GetBoardCountOffset(group), delete_after,
-          MoveIndexPath, MoveRangePath, 4096 * kPieces);
-    }
-  }).get();
+  for (int group = 0; group < kGroups; group++) {
+    MergeRanges<NodeMoveIndex, NodeMoveIndexRange>(
+        group, pieces_l, pieces_r, GetBoardCountOffset(group), delete_after,
+        MoveIndexPath, MoveRangePath, 4096 * kPieces);
+  }
 }
 
 void MergeFullMoveRanges(bool delete_after) {
   auto sections = GetSections(GetAvailableMoveRanges());
   spdlog::info("Start merge ranges {}", sections);
-  int threads = std::min(kParallel, kGroups);
-  BS::thread_pool pool(threads);
-  pool.parallelize_loop(0, kGroups, [&](int l, int r){
-    for (int group = l; group < r; group++) {
-      MergeFullMoveRanges(group, sections, delete_after);
-    }
-  }).get();
+  for (int group = 0; group < kGroups; group++) {
+    MergeFullMoveRanges(group, sections, delete_after);
+  }
 }
 
 void RunCalculateThreshold(
     int start_pieces, int end_pieces,
     const std::string& name, const std::string& threshold_path,
-    float start_ratio, float end_ratio, uint8_t buckets) {
-  std::vector<size_t> offsets[kGroups];
-  for (int i = 0; i < kGroups; i++) offsets[i] = GetBoardCountOffset(i);
-
+    float start_ratio, float end_ratio, uint8_t buckets, bool half) {
   std::vector<float> threshold(kLineCap);
   {
     std::ifstream fin(threshold_path);
@@ -546,38 +592,29 @@ void RunCalculateThreshold(
     }
   }
 
-  std::vector<MoveEval> values = LoadValues(start_pieces, offsets);
-  for (int pieces = start_pieces - 1; pieces >= end_pieces; pieces--) {
-    int group = GetGroupByPieces(pieces);
-    values = CalculatePieceMoves<false>(pieces, values, offsets[group]);
-    WriteThreshold(pieces, offsets[group], values, name, threshold, start_ratio, end_ratio, buckets);
+  if (half) {
+    RunCalculateThresholdImpl<MoveEvalHalf>(start_pieces, end_pieces, name, threshold, start_ratio, end_ratio, buckets);
+  } else {
+    RunCalculateThresholdImpl<MoveEvalPacked>(start_pieces, end_pieces, name, threshold, start_ratio, end_ratio, buckets);
   }
 }
 
 void MergeThresholdRanges(const std::string& name, int pieces_l, int pieces_r, bool delete_after) {
-  int threads = std::min(kParallel, kGroups);
-  BS::thread_pool pool(threads);
-  pool.parallelize_loop(0, kGroups, [&](int l, int r){
-    for (int group = l; group < r; group++) {
-      MergeRanges<BasicIOType<uint8_t>, NodePartialThreshold>(
-          group, pieces_l, pieces_r, GetBoardCountOffset(group), delete_after,
-          [&name](int piece){ return ThresholdOnePath(name, piece); },
-          [&name](int pieces_l, int pieces_r, int group){
-            return ThresholdRangePath(name, pieces_l, pieces_r, group);
-          },
-          65536 * kPieces);
-    }
-  }).get();
+  for (int group = 0; group < kGroups; group++) {
+    MergeRanges<BasicIOType<uint8_t>, NodePartialThreshold>(
+        group, pieces_l, pieces_r, GetBoardCountOffset(group), delete_after,
+        [&name](int piece){ return ThresholdOnePath(name, piece); },
+        [&name](int pieces_l, int pieces_r, int group){
+          return ThresholdRangePath(name, pieces_l, pieces_r, group);
+        },
+        65536 * kPieces);
+  }
 }
 
 void MergeFullThresholdRanges(const std::string& name, bool delete_after) {
   auto sections = GetSections(GetAvailableThresholdRanges(name));
   spdlog::info("Start merge ranges {}", sections);
-  int threads = std::min(kParallel, kGroups);
-  BS::thread_pool pool(threads);
-  pool.parallelize_loop(0, kGroups, [&](int l, int r){
-    for (int group = l; group < r; group++) {
-      MergeFullThresholdRanges(name, group, sections, delete_after);
-    }
-  }).get();
+  for (int group = 0; group < kGroups; group++) {
+    MergeFullThresholdRanges(name, group, sections, delete_after);
+  }
 }
@@ -60,6 +60,7 @@ struct NodeMoveIndexRange {
 
   static constexpr bool kIsConstSize = false;
   static constexpr size_t kSizeNumberBytes = 2;
+  static constexpr uint32_t kRecordTypeId = kRecordNodeMoveIndexRange;
   size_t NumBytes() const {
     return sizeof(MoveIndexRange) * ranges.size();
   }
@@ -102,6 +103,7 @@ struct NodeMovePositionRange {
 
   static constexpr bool kIsConstSize = false;
   static constexpr size_t kSizeNumberBytes = 2;
+  static constexpr uint32_t kRecordTypeId = kRecordNodeMovePositionRange;
   size_t NumBytes() const {
     return kElementSize * ranges.size();
   }
@@ -131,6 +133,7 @@ struct NodeMoveBoardRange {
 
   static constexpr bool kIsConstSize = false;
   static constexpr size_t kSizeNumberBytes = 2;
+  static constexpr uint32_t kRecordTypeId = kRecordNodeMoveBoardRange;
   size_t NumBytes() const {
     return sizeof(MoveBoardRange) * ranges.size() + sizeof(uint32_t) * board_idx.size() + 1;
   }
@@ -144,6 +147,7 @@ struct NodeMoveBoardRange {
 struct NodeMoveBoardRangeFast {
   static constexpr bool kIsConstSize = false;
   static constexpr size_t kSizeNumberBytes = 2;
+  static constexpr uint32_t kRecordTypeId = kRecordNodeMoveBoardRange;
 
   size_t NumBytes() const {
     throw std::runtime_error("should not use in write");
@@ -193,6 +197,7 @@ struct NodePartialThreshold {
 
   static constexpr bool kIsConstSize = false;
   static constexpr size_t kSizeNumberBytes = 1;
+  static constexpr uint32_t kRecordTypeId = kRecordNodePartialThreshold;
   size_t NumBytes() const {
     return levels.size() + 1;
   }
@@ -205,13 +210,14 @@ struct NodePartialThreshold {
 
 using NodeThreshold = SimpleIOArray<uint8_t, (kLineCap + kGroupLineInterval - 1) / kGroupLineInterval>;
 
-void RunCalculateMoves(int start_pieces, int end_pieces);
+// half: keep the values as MoveEvalHalf instead of the lossless MoveEvalPacked
+void RunCalculateMoves(int start_pieces, int end_pieces, bool half = false);
 void MergeMoveRanges(int pieces_l, int pieces_r, bool delete_after);
 void MergeFullMoveRanges(bool delete_after);
 
 void RunCalculateThreshold(
     int start_pieces, int end_pieces,
     const std::string& name, const std::string& threshold_path,
-    float start_ratio, float end_ratio, uint8_t buckets);
+    float start_ratio, float end_ratio, uint8_t buckets, bool half = false);
 void MergeThresholdRanges(const std::string& name, int pieces_l, int pieces_r, bool delete_after);
 void MergeFullThresholdRanges(const std::string& name, bool delete_after);
@@ -37,14 +37,31 @@ class Search {
   PossibleMoves MoveSearch(const std::array<Board, R>& board) const {
     return ::MoveSearch<R, Taps>(level, adj_frame, table_, board);
   }
+
+  void MoveSearchBatch(const std::array<Board, R>* boards, size_t n, PossibleMoves* out) const {
+    constexpr Taps taps{};
+    ::MoveSearchBatch<R>(level, adj_frame, taps.data(), table_, boards, n, out);
+  }
 };
 
+// shared by MoveSearch and MoveSearchBatch
+template <Level level, int R, int adj_frame, class Taps>
+const Search<level, R, adj_frame, Taps>& GetSearch() {
+  static Search<level, R, adj_frame, Taps> search;
+  return search;
+}
+
 } // namespace move_search
 
 template <Level level, int R, int adj_frame, class Taps>
 NOINLINE PossibleMoves MoveSearch(const std::array<Board, R>& board) {
-  static move_search::Search<level, R, adj_frame, Taps> search;
-  return search.MoveSearch(board);
+  return move_search::GetSearch<level, R, adj_frame, Taps>().MoveSearch(board);
+}
+
+// out[j] = MoveSearch<level, R, adj_frame, Taps>(boards[j]) for j < n
+template <Level level, int R, int adj_frame, class Taps>
+NOINLINE void MoveSearchBatch(const std::array<Board, R>* boards, size_t n, PossibleMoves* out) {
+  move_search::GetSearch<level, R, adj_frame, Taps>().MoveSearchBatch(boards, n, out);
 }
 
 template <Level level, int adj_frame, class Taps>
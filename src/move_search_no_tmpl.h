@@ -6,6 +6,7 @@
 
 #include "game.h"
 #include "board.h"
+#include "board_avx.h"
 #include "position.h"
 #include "constexpr_helpers.h"
 
@@ -77,14 +78,6 @@ constexpr int sgn(int x) {
   return x == 0 ? 0 : x > 0 ? 1 : -1;
 }
 
-// Check each bit in mask is set in board
-template <int R>
-constexpr bool Contains4(const std::array<Board, R>& board, const std::array<Board, 4>& mask) {
-  bool ret = true;
-  for (int i = 0; i < R; i++) ret &= (board[i] & mask[i]) == mask[i];
-  return ret;
-}
-
 struct TableEntryNoTmpl {
   uint8_t rot, col, num_taps;
   std::array<Board, 4> masks_nodrop;
@@ -249,9 +242,10 @@ struct Phase1TableNoTmpl {
 using Column = uint32_t;
 using Frames = uint64_t;
 
+// indexed by FramesAVX::Index(col); the guard columns are zero
 template <int R>
 struct FrameMasks {
-  Frames frame[R][10], drop[R][10];
+  alignas(32) Frames frame[R][FramesAVX::kCols], drop[R][FramesAVX::kCols];
 };
 
 constexpr Frames ColumnToNormalFrameMask(Level level, Column col) {
@@ -321,8 +315,9 @@ constexpr int FindLockRow(uint32_t col, int start_row) {
 }
 
 // note: "tuck" here means tucks, spins or spintucks
+// indexed by FramesAVX::Index(col); the guard columns are zero
 template <int R>
-using TuckMask = std::array<std::array<Frames, 10>, R>;
+using TuckMask = std::array<std::array<Frames, FramesAVX::kCols>, R>;
 
 constexpr int TuckTypes(int R) {
   return (R == 1 ? 2 : R == 2 ? 7 : 12) + (kDoubleTuckAllowed ? 2 : 0);
@@ -367,73 +362,70 @@ struct TuckTypeTable {
   }
 };
 
+// 4 columns at a time; a neighbouring column outside the board is a zero guard column, which
+// excludes the tucks that would leave the board
 template <int R>
-constexpr TuckMasks<R> GetTuckMasks(const FrameMasks<R> m) {
+TuckMasks<R> GetTuckMasks(const FrameMasks<R>& m) {
   TuckMasks<R> ret{};
   constexpr int x = kDoubleTuckAllowed ? 2 : 0;
-#pragma GCC unroll 4
+  auto Frame = [&](int rot, int vec, int delta = 0) { return FramesAVX::Load(m.frame[rot], vec, delta); };
+  auto Drop = [&](int rot, int vec, int delta = 0) { return FramesAVX::Load(m.drop[rot], vec, delta); };
   for (int rot = 0; rot < R; rot++) {
-    for (int col = 0; col < 10; col++) {
-      if (col > 0) ret[0][rot][col] = m.frame[rot][col] & m.frame[rot][col-1];
-      if (col < 9) ret[1][rot][col] = m.frame[rot][col] & m.frame[rot][col+1];
+    for (int vec = 0; vec < FramesAVX::kVectors; vec++) {
+      FramesAVX cur = Frame(rot, vec);
+      FramesAVX tuck_l = cur & Frame(rot, vec, -1);
+      FramesAVX tuck_r = cur & Frame(rot, vec, 1);
+      tuck_l.Store(ret[0][rot].data(), vec);
+      tuck_r.Store(ret[1][rot].data(), vec);
 #ifdef DOUBLE_TUCK
-      if (col > 1) ret[2][rot][col] = m.frame[rot][col] & m.drop[rot][col-1] & m.drop[rot][col-1] >> 1 & m.frame[rot][col-2] >> 2;
-      if (col < 8) ret[3][rot][col] = m.frame[rot][col] & m.drop[rot][col+1] & m.drop[rot][col+1] >> 1 & m.frame[rot][col+2] >> 2;
+      (cur & Drop(rot, vec, -1) & Drop(rot, vec, -1) >> 1 & Frame(rot, vec, -2) >> 2).Store(ret[2][rot].data(), vec);
+      (cur & Drop(rot, vec, 1) & Drop(rot, vec, 1) >> 1 & Frame(rot, vec, 2) >> 2).Store(ret[3][rot].data(), vec);
 #endif
-    }
-  }
-  if (R == 1) return ret;
-#pragma GCC unroll 4
-  for (int rot = 0; rot < R; rot++) {
-    int nrot = (rot + 1) % R;
-    for (int col = 0; col < 10; col++) {
-      ret[x+2][rot][col] = m.frame[rot][col] & m.frame[nrot][col];
-      if (col > 0) ret[x+3][rot][col] = ret[0][rot][col] & m.frame[nrot][col-1];
-      if (col < 9) ret[x+4][rot][col] = ret[1][rot][col] & m.frame[nrot][col+1];
-      if (col > 0) ret[x+5][rot][col] = m.frame[rot][col] & (m.drop[nrot][col] | m.drop[rot][col-1]) & m.frame[nrot][col-1] >> 1;
-      if (col < 9) ret[x+6][rot][col] = m.frame[rot][col] & (m.drop[nrot][col] | m.drop[rot][col+1]) & m.frame[nrot][col+1] >> 1;
-    }
-  }
-  if (R == 2) return ret;
-#pragma GCC unroll 4
-  for (int rot = 0; rot < R; rot++) {
-    int nrot = (rot + 3) % R;
-    for (int col = 0; col < 10; col++) {
-      ret[x+7][rot][col] = m.frame[rot][col] & m.frame[nrot][col];
-      if (col > 0) ret[x+8][rot][col] = ret[0][rot][col] & m.frame[nrot][col-1];
-      if (col < 9) ret[x+9][rot][col] = ret[1][rot][col] & m.frame[nrot][col+1];
-      if (col > 0) ret[x+10][rot][col] = m.frame[rot][col] & (m.drop[nrot][col] | m.drop[rot][col-1]) & m.frame[nrot][col-1] >> 1;
-      if (col < 9) ret[x+11][rot][col] = m.frame[rot][col] & (m.drop[nrot][col] | m.drop[rot][col+1]) & m.frame[nrot][col+1] >> 1;
+      if constexpr (R == 1) continue;
+      // spins to nrot; A for the first set, B for the second
+      auto Spins = [&](int nrot, int type) {
+        (cur & Frame(nrot, vec)).Store(ret[type][rot].data(), vec);
+        (tuck_l & Frame(nrot, vec, -1)).Store(ret[type + 1][rot].data(), vec);
+        (tuck_r & Frame(nrot, vec, 1)).Store(ret[type + 2][rot].data(), vec);
+        (cur & (Drop(nrot, vec) | Drop(rot, vec, -1)) & Frame(nrot, vec, -1) >> 1).Store(ret[type + 3][rot].data(), vec);
+        (cur & (Drop(nrot, vec) | Drop(rot, vec, 1)) & Frame(nrot, vec, 1) >> 1).Store(ret[type + 4][rot].data(), vec);
+      };
+      Spins((rot + 1) % R, x + 2);
+      if constexpr (R == 4) Spins((rot + 3) % R, x + 7);
     }
   }
   return ret;
 }
 
+// can_tuck_frame_masks is indexed by FramesAVX::Index(col)
 template <int R>
-NOINLINE constexpr void SearchTucks(
+NOINLINE void SearchTucks(
     Level level,
     const Column cols[R][10],
-    const TuckMasks<R> tuck_masks,
+    const TuckMasks<R>& tuck_masks,
     const Column lock_positions_without_tuck[R][10],
-    const Frames can_tuck_frame_masks[R][10],
+    const Frames can_tuck_frame_masks[R][FramesAVX::kCols],
     int& sz, Position* positions) {
   constexpr TuckTypeTable<R> tucks;
-  Frames tuck_result[R][10] = {};
-  for (int i = 0; i < TuckTypes(R); i++) {
-    const auto& tuck = tucks.table[i];
-    int start_col = std::max(0, -tuck.delta_col);
-    int end_col = std::min(10, 10 - tuck.delta_col);
-    for (int rot = 0; rot < R; rot++) {
-      int nrot = (rot + tuck.delta_rot) % R;
-      for (int col = start_col; col < end_col; col++) {
-        tuck_result[nrot][col + tuck.delta_col] |=
-            (tuck_masks[i][rot][col] & can_tuck_frame_masks[rot][col]) << tuck.delta_frame;
+  // the guard columns of tuck_masks and can_tuck_frame_masks are zero, so no tuck leaves the board;
+  // the results written to guard columns are ignored
+  alignas(32) Frames tuck_result[R][FramesAVX::kCols] = {};
+  for (int rot = 0; rot < R; rot++) {
+    for (int vec = 0; vec < FramesAVX::kVectors; vec++) {
+      FramesAVX result;
+      for (int i = 0; i < TuckTypes(R); i++) {
+        const auto& tuck = tucks.table[i];
+        // the tuck ends at (rot, column of this vector)
+        int orot = (rot + R * 4 - tuck.delta_rot) % R;
+        result |= (FramesAVX::Load(tuck_masks[i][orot].data(), vec, -tuck.delta_col) &
+            FramesAVX::Load(can_tuck_frame_masks[orot], vec, -tuck.delta_col)) << tuck.delta_frame;
       }
+      result.Store(tuck_result[rot], vec);
     }
   }
   for (int rot = 0; rot < R; rot++) {
     for (int col = 0; col < 10; col++) {
-      Column after_tuck_positions = FramesToColumn(level, tuck_result[rot][col]);
+      Column after_tuck_positions = FramesToColumn(level, tuck_result[rot][FramesAVX::Index(col)]);
       Column cur = cols[rot][col];
       Column tuck_lock_positions = (after_tuck_positions + cur) >> 1 & (cur & ~cur >> 1) & ~lock_positions_without_tuck[rot][col];
       while (tuck_lock_positions) {
@@ -450,7 +442,7 @@ constexpr void CheckOneInitial(
     Level level, int adj_frame, const Tap& taps, bool is_adj,
     int total_frames, int initial_frame, const Entry& entry, const Column cols[R][10],
     Column lock_positions_without_tuck[R][10],
-    Frames can_tuck_frame_masks[R][10],
+    Frames can_tuck_frame_masks[R][FramesAVX::kCols],
     int& sz, Position* positions,
     bool& can_adj, bool& phase_2_possible) {
   int start_frame = (entry.num_taps == 0 ? 0 : taps[entry.num_taps - 1]) + initial_frame;
@@ -469,33 +461,58 @@ constexpr void CheckOneInitial(
   int last_tuck_frame = std::min(lock_frame, end_frame);
   lock_positions_without_tuck[entry.rot][entry.col] |= 1 << lock_row;
   if (last_tuck_frame > first_tuck_frame) {
-    can_tuck_frame_masks[entry.rot][entry.col] = (1ll << last_tuck_frame) - (1ll << first_tuck_frame);
+    can_tuck_frame_masks[entry.rot][FramesAVX::Index(entry.col)] = (1ll << last_tuck_frame) - (1ll << first_tuck_frame);
     phase_2_possible = true;
   }
 }
 
 template <int R>
-constexpr FrameMasks<R> GetColsAndFrameMasks(Level level, const std::array<Board, R>& board, Column cols[R][10]) {
+FrameMasks<R> GetColsAndFrameMasks(Level level, const std::array<Board, R>& board, Column cols[R][10]) {
   FrameMasks<R> frame_masks = {};
   for (int rot = 0; rot < R; rot++) {
     for (int col = 0; col < 10; col++) {
       cols[rot][col] = board[rot].Column(col);
       // ColumnToNormalFrameMask<level>(col), ColumnToDropFrameMask<level>(col)
-      frame_masks.frame[rot][col] = ColumnToNormalFrameMask(level, cols[rot][col]);
-      frame_masks.drop[rot][col] = ColumnToDropFrameMask(level, cols[rot][col]);
+      frame_masks.frame[rot][FramesAVX::Index(col)] = ColumnToNormalFrameMask(level, cols[rot][col]);
+      frame_masks.drop[rot][FramesAVX::Index(col)] = ColumnToDropFrameMask(level, cols[rot][col]);
     }
   }
   return frame_masks;
 }
 
+template <int R>
+std::array<BoardAVX, R> ToBoardAVX(const std::array<Board, R>& board) {
+  std::array<BoardAVX, R> ret;
+  for (int i = 0; i < R; i++) ret[i] = BoardAVX(board[i]);
+  return ret;
+}
+
+// can_reach[j * stride + i] = Contains<R>(boards[j], table[i].masks_nodrop)
+// entry-major, so that the masks of each entry are loaded once for the whole batch
+template <int R>
+void Phase1ReachBatch(
+    const std::vector<TableEntryNoTmpl>& table, const std::array<BoardAVX, R>* const boards[], size_t n,
+    bool can_reach[], size_t stride) {
+  for (size_t i = 0; i < table.size(); i++) {
+    BoardAVX masks[R];
+    for (int k = 0; k < R; k++) masks[k] = BoardAVX(table[i].masks_nodrop[k]);
+    for (size_t j = 0; j < n; j++) {
+      bool ret = true;
+      for (int k = 0; k < R; k++) ret &= (*boards[j])[k].Contains(masks[k]);
+      can_reach[j * stride + i] = ret;
+    }
+  }
+}
+
+// reach: Contains<R> of every table entry, if already computed by Phase1ReachBatch
 template <int R>
 int DoOneSearch(
     bool is_adj, int initial_taps, Level level, int adj_frame, const int taps[],
     const std::vector<TableEntryNoTmpl>& table,
-    const std::array<Board, R>& board, const Column cols[R][10],
-    const TuckMasks<R> tuck_masks,
+    const std::array<BoardAVX, R>& board, const Column cols[R][10],
+    const TuckMasks<R>& tuck_masks,
     bool can_adj[],
-    Position* positions) {
+    Position* positions, const bool* reach = nullptr) {
   int total_frames = GetLastFrameOnRow(19, level) + 1;
   int N = table.size();
   int initial_frame = is_adj ? std::max(adj_frame, taps[initial_taps]) : 0;
@@ -503,13 +520,17 @@ int DoOneSearch(
 
   int sz = 0;
   // phase 1
-  Frames can_tuck_frame_masks[R][10] = {}; // frames that can start a tuck
+  Frames can_tuck_frame_masks[R][FramesAVX::kCols] = {}; // frames that can start a tuck
   Column lock_positions_without_tuck[R][10] = {};
 
   bool phase_2_possible = false;
-  bool can_reach[R * 10] = {};
-  for (int i = 0; i < N; i++) {
-    can_reach[i] = Contains4<R>(board, table[i].masks_nodrop);
+  bool can_reach_buf[R * 10] = {};
+  const bool* can_reach = reach;
+  if (!can_reach) {
+    for (int i = 0; i < N; i++) {
+      can_reach_buf[i] = Contains<R>(board, table[i].masks_nodrop);
+    }
+    can_reach = can_reach_buf;
   }
   for (int i = 0; i < N; i++) {
     if (!can_reach[i]) continue;
@@ -530,18 +551,19 @@ inline PossibleMoves MoveSearchInternal(
     const std::array<Board, R>& board) {
   Column cols[R][10] = {};
   auto tuck_masks = GetTuckMasks<R>(GetColsAndFrameMasks<R>(level, board, cols));
+  auto board_avx = ToBoardAVX<R>(board);
   bool can_adj[R * 10] = {}; // whether adjustment starting from this (rot, col) is possible
 
   PossibleMoves ret;
   Position buf[256];
   ret.non_adj.assign(buf, buf + DoOneSearch<R>(
-      false, 0, level, adj_frame, taps, table.initial, board, cols, tuck_masks, can_adj, buf));
+      false, 0, level, adj_frame, taps, table.initial, board_avx, cols, tuck_masks, can_adj, buf));
 
   for (size_t i = 0; i < table.initial.size(); i++) {
     auto& entry = table.initial[i];
     if (!can_adj[i]) continue;
     int x = DoOneSearch<R>(
-        true, entry.num_taps, level, adj_frame, taps, table.adj[i], board, cols, tuck_masks, can_adj, buf);
+        true, entry.num_taps, level, adj_frame, taps, table.adj[i], board_avx, cols, tuck_masks, can_adj, buf);
     if (x) {
       int row = GetRow(std::max(adj_frame, taps[entry.num_taps]), level);
       ret.adj.emplace_back(Position{entry.rot, row, entry.col}, std::vector<Position>(buf, buf + x));
@@ -550,6 +572,60 @@ inline PossibleMoves MoveSearchInternal(
   return ret;
 }
 
+// same results as MoveSearchInternal for each board; the phase-1 table lookups are done for the batch at once
+// (tuck search works on per-board masks only, so it stays per board)
+template <int R>
+inline void MoveSearchBatchInternal(
+    Level level, int adj_frame, const int taps[], const Phase1TableNoTmpl& table,
+    const std::array<Board, R>* boards, size_t n, PossibleMoves* out) {
+  constexpr size_t kBatch = 8;
+  constexpr size_t kStride = R * 10;
+  Column cols[kBatch][R][10];
+  TuckMasks<R> tuck_masks[kBatch];
+  bool can_adj[kBatch][kStride];
+  bool reach[kBatch * kStride];
+  std::array<BoardAVX, R> boards_avx[kBatch];
+  const std::array<BoardAVX, R>* cur[kBatch];
+  size_t cur_idx[kBatch];
+  Position buf[256];
+  for (size_t base = 0; base < n; base += kBatch) {
+    size_t m = std::min(kBatch, n - base);
+    for (size_t j = 0; j < m; j++) {
+      boards_avx[j] = ToBoardAVX<R>(boards[base + j]);
+      cur[j] = boards_avx + j;
+      tuck_masks[j] = GetTuckMasks<R>(GetColsAndFrameMasks<R>(level, boards[base + j], cols[j]));
+      std::fill(can_adj[j], can_adj[j] + kStride, false);
+    }
+    Phase1ReachBatch<R>(table.initial, cur, m, reach, kStride);
+    for (size_t j = 0; j < m; j++) {
+      auto& ret = out[base + j];
+      ret.non_adj.assign(buf, buf + DoOneSearch<R>(
+          false, 0, level, adj_frame, taps, table.initial, boards_avx[j], cols[j], tuck_masks[j], can_adj[j],
+          buf, reach + j * kStride));
+      ret.adj.clear();
+    }
+    for (size_t i = 0; i < table.initial.size(); i++) {
+      auto& entry = table.initial[i];
+      size_t num = 0;
+      for (size_t j = 0; j < m; j++) {
+        if (!can_adj[j][i]) continue;
+        cur[num] = boards_avx + j;
+        cur_idx[num++] = j;
+      }
+      if (!num) continue;
+      Phase1ReachBatch<R>(table.adj[i], cur, num, reach, kStride);
+      int row = GetRow(std::max(adj_frame, taps[entry.num_taps]), level);
+      for (size_t k = 0; k < num; k++) {
+        size_t j = cur_idx[k];
+        int x = DoOneSearch<R>(
+            true, entry.num_taps, level, adj_frame, taps, table.adj[i], *cur[k], cols[j], tuck_masks[j], can_adj[j],
+            buf, reach + k * kStride);
+        if (x) out[base + j].adj.emplace_back(Position{entry.rot, row, entry.col}, std::vector<Position>(buf, buf + x));
+      }
+    }
+  }
+}
+
 } // namespace move_search
 
 using PrecomputedTable = move_search::Phase1TableNoTmpl;
@@ -561,6 +637,14 @@ NOINLINE PossibleMoves MoveSearch(
   return move_search::MoveSearchInternal<R>(level, adj_frame, taps, table, board);
 }
 
+// out[j] = MoveSearch(..., boards[j]) for j < n
+template <int R>
+NOINLINE void MoveSearchBatch(
+    Level level, int adj_frame, const int taps[], const PrecomputedTable& table,
+    const std::array<Board, R>* boards, size_t n, PossibleMoves* out) {
+  move_search::MoveSearchBatchInternal<R>(level, adj_frame, taps, table, boards, n, out);
+}
+
 template <int R>
 NOINLINE PossibleMoves MoveSearch(
     Level level, int adj_frame, const int taps[], const std::array<Board, R>& board) {
@@ -1,25 +1,56 @@
 #pragma once
 
+#include <spdlog/spdlog.h>
 #include "move.h"
+#include "config.h"
 #include "tetris.h"
 #include "io_hash.h"
+#include "board_index.h"
 #include "board_set.h"
 #include "io_helpers.h"
+#include "block_cache.h"
+
+// decompressed blocks shared by all lookups in the process; nullptr if disabled
+inline BlockCache* GlobalBlockCache() {
+  if (kBlockCacheMB <= 0) return nullptr;
+  static BlockCache cache((size_t)kBlockCacheMB << 20);
+  return &cache;
+}
+
+inline void LogBlockCacheStats() {
+  auto cache = GlobalBlockCache();
+  if (!cache) return;
+  auto stats = cache->GetStats();
+  spdlog::info("Block cache: {} hits, {} misses, hit rate {:.2f}%",
+      stats.hits, stats.misses, stats.HitRate() * 100);
+}
 
 class Play {
-  std::vector<HashMapReader<CompactBoard, BasicIOType<uint32_t>>> board_hash;
+  // perfect hash index per group if board-map was run; otherwise boards are searched in the sorted board file
+  std::vector<std::unique_ptr<PerfectHashMapReader<CompactBoard>>> board_hash;
+  std::vector<std::unique_ptr<SortedBoardIndex>> board_index;
+  // in RAM, so that most boards outside the tablebase are rejected without touching the disk
+  std::vector<std::unique_ptr<XorFilter<CompactBoard>>> board_filter;
   std::vector<CompressedClassReader<NodeMovePositionRange>> move_readers;
+
+  // xor filter (if present), then the perfect hash index (.mphf) if board-map was run, otherwise a search
+  // in the sorted board file (SortedBoardIndex); the old bucketed .map files are never read
+  std::optional<uint32_t> FindBoard(int group, const CompactBoard& board) {
+    if (board_filter[group] && !board_filter[group]->MayContain(board)) return std::nullopt;
+    if (board_hash[group]) return (*board_hash[group])[board];
+    return (*board_index[group])[board];
+  }
  public:
   size_t GetID(const CompactBoard& board) {
     int group = GetGroupByCells(board.Count());
-    auto idx = board_hash[group][board];
+    auto idx = FindBoard(group, board);
     if (!idx) return std::string::npos;
     return idx.value();
   }
 
   std::array<Position, 7> GetStrat(const CompactBoard& board, int now_piece, int lines, size_t* move_idx_ptr = nullptr) {
     int group = GetGroupByCells(board.Count());
-    auto idx = board_hash[group][board];
+    auto idx = FindBoard(group, board);
     if (!idx) return {Position::Invalid}; // actually {}, since Invalid is (0,0,0)
     size_t move_idx = (size_t)idx.value() * kPieces + now_piece;
     if (move_idx_ptr) *move_idx_ptr = move_idx;
@@ -41,8 +72,19 @@ class Play {
 
   Play() {
     for (int i = 0; i < kGroups; i++) {
-      board_hash.emplace_back(BoardMapPath(i));
-      move_readers.emplace_back(MovePath(i));
+      if (std::filesystem::exists(BoardHashPath(i))) {
+        board_hash.push_back(std::make_unique<PerfectHashMapReader<CompactBoard>>(BoardHashPath(i)));
+        board_index.emplace_back();
+      } else {
+        board_hash.emplace_back();
+        board_index.push_back(std::make_unique<SortedBoardIndex>(i));
+      }
+      board_filter.emplace_back();
+      if (std::filesystem::exists(BoardFilterPath(i))) {
+        board_filter.back() = std::make_unique<XorFilter<CompactBoard>>(BoardFilterPath(i));
+      }
+      move_readers.emplace_back(MovePath(i), true);
+      if (auto cache = GlobalBlockCache()) move_readers.back().SetBlockCache(*cache);
     }
   }
 };
@@ -21,6 +21,7 @@ struct PruneMask : public PruneMaskBase {
 
   static constexpr bool kIsConstSize = false;
   static constexpr size_t kSizeNumberBytes = 8;
+  static constexpr uint32_t kRecordTypeId = kRecordPruneMask;
   size_t NumBytes() const {
     size_t sz = 0;
     for (auto& i : *this) sz += i.size();
@@ -37,5 +38,6 @@ constexpr uint8_t kAllOneValue = (1 << kPieces) - 1;
 
 PruneMask SameValueMask(uint8_t x);
 PruneMask ReadMask(const std::string& path);
+// half: keep the values as MoveEvalHalf instead of the lossless MoveEvalPacked
 void ThresholdMask(
-    PruneMask&& mask, int start_pieces, int end_pieces, float threshold, const std::string& path);
+    PruneMask&& mask, int start_pieces, int end_pieces, float threshold, const std::string& path, bool half = false);
@@ -182,6 +182,7 @@ class FCEUXConnection : public std::enable_shared_from_this<FCEUXConnection>, pu
     } catch (std::exception& e) {
       spdlog::warn("{}", e.what());
     }
+    LogBlockCacheStats();
   }
 };
 
@@ -195,7 +196,10 @@ class BoardConnection : public std::enable_shared_from_this<BoardConnection>, pu
   void DoWork() {
     Play play;
     std::vector<CompressedClassReader<NodeThreshold>> readers;
-    for (int i = 0; i < kGroups; i++) readers.emplace_back(ThresholdPath(threshold_name, i));
+    for (int i = 0; i < kGroups; i++) {
+      readers.emplace_back(ThresholdPath(threshold_name, i), true);
+      if (auto cache = GlobalBlockCache()) readers.back().SetBlockCache(*cache);
+    }
     // receive: 25 bytes board + 1 byte current piece + 2 bytes lines
     constexpr size_t kReceiveSize = 28;
     // send: 21 bytes position ((r,x,y)*7) + 1 byte threshold
@@ -239,6 +243,7 @@ class BoardConnection : public std::enable_shared_from_this<BoardConnection>, pu
     } catch (std::exception& e) {
       spdlog::warn("{}", e.what());
     }
+    LogBlockCacheStats();
   }
 };
 
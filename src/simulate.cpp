@@ -5,6 +5,7 @@
 #include <iostream>
 #include <algorithm>
 #include <type_traits>
+#include <spdlog/spdlog.h>
 #include "play.h"
 #include "config.h"
 #include "thread_pool.hpp"
@@ -162,6 +163,7 @@ void OutputSimulate(const std::string& seed_file, const std::string& out_file, b
     seeds = InputSeed(&fin);
   }
   auto res = Simulate(seeds, gym_rng);
+  LogBlockCacheStats();
   if (out_file == "-") {
     OutputResult(&std::cout, res);
   } else {
@@ -0,0 +1,222 @@
+#include "verify.h"
+
+#include <mutex>
+#include <memory>
+#include <algorithm>
+#include <filesystem>
+#include <spdlog/spdlog.h>
+
+#include "io.h"
+#include "config.h"
+#include "checksum.h"
+#include "file_header.h"
+#include "thread_pool.hpp"
+
+namespace {
+
+namespace fs = std::filesystem;
+
+// compressed blocks checked by one task
+constexpr size_t kBlocksPerTask = 64;
+
+struct DataFile {
+  std::string fname;
+  FileHeader header;
+  std::shared_ptr<io_internal::MappedFile> data;
+  std::shared_ptr<io_internal::BlockIndex> index; // compressed files only
+  ZstdDDictPtr ddict;
+};
+
+// files under kDataDir that may be written by ClassWriter / CompressedClassWriter / FixedEdgeWriter
+std::vector<std::string> ListDataFiles() {
+  std::vector<std::string> ret;
+  for (auto dir : {"boards", "edges", "values", "moves", "threshold"}) {
+    fs::path path = kDataDir / dir;
+    if (!fs::is_directory(path)) continue;
+    for (auto const& entry : fs::recursive_directory_iterator{path}) {
+      if (!entry.is_regular_file()) continue;
+      auto ext = entry.path().extension();
+      if (ext == ".index" || ext == ".dict") continue;
+      ret.push_back(entry.path().string());
+    }
+  }
+  std::sort(ret.begin(), ret.end());
+  return ret;
+}
+
+class Verifier {
+  std::vector<DataFile> files;
+  std::mutex mtx;
+  // (file name, block index + 1 or 0 for the whole file, message)
+  std::vector<std::tuple<std::string, size_t, std::string>> problems;
+  size_t unchecked_blocks = 0;
+
+  void Report(const std::string& fname, const std::string& msg, size_t block_key = 0) {
+    std::lock_guard lck(mtx);
+    problems.push_back({fname, block_key, msg});
+  }
+
+  // [items_per_index, offset of record 0, offset of record items_per_index, ..., end offset]
+  void CheckOffsetIndex(const DataFile& file) {
+    io_internal::MappedFile index(file.fname + ".index");
+    size_t words = index.size() / sizeof(uint64_t);
+    auto Word = [&](size_t i) { return BytesToInt<uint64_t>(index.data() + i * sizeof(uint64_t)); };
+    if (index.size() % sizeof(uint64_t) || words < 2 || !Word(0)) {
+      Report(file.fname, "invalid index file");
+      return;
+    }
+    size_t items_per_index = Word(0);
+    if (words != (file.header.record_count + items_per_index - 1) / items_per_index + 2) {
+      Report(file.fname, "index does not match the record count");
+      return;
+    }
+    uint64_t prev = FileHeader::kSize;
+    for (size_t i = 1; i < words; i++) {
+      uint64_t offset = Word(i);
+      if (offset < prev || offset > file.data->size()) {
+        Report(file.fname, "invalid index entry " + std::to_string(i));
+        return;
+      }
+      prev = offset;
+    }
+    if (prev != file.data->size()) Report(file.fname, "file size does not match the index");
+  }
+
+  void CheckUncompressed(const DataFile& file) {
+    if (file.header.flags & FileHeader::kConstSize) {
+      if (file.data->size() != FileHeader::kSize + file.header.record_count * file.header.record_bytes) {
+        Report(file.fname, "file size does not match the record count");
+      }
+    } else if (fs::exists(file.fname + ".index")) {
+      CheckOffsetIndex(file);
+    }
+  }
+
+  // returns false if the file cannot be checked block by block
+  bool CheckCompressedLayout(const DataFile& file) {
+    auto& index = *file.index;
+    size_t items_per_index = index.ItemsPerIndex();
+    if (index.NumBlocks() != (file.header.record_count + items_per_index - 1) / items_per_index) {
+      Report(file.fname, "index does not match the record count");
+      return false;
+    }
+    if (!index.NumBlocks()) return true;
+    if (std::get<0>(index.Block(0)) != FileHeader::kSize) {
+      Report(file.fname, "invalid index file");
+      return false;
+    }
+    uint64_t end = std::get<2>(index.Block(index.NumBlocks() - 1));
+    if (end < file.data->size()) Report(file.fname, "trailing data after the last block");
+    if (end > file.data->size()) Report(file.fname, "file truncated");
+    if (!index.HasChecksums()) {
+      std::lock_guard lck(mtx);
+      unchecked_blocks += index.NumBlocks();
+    }
+    return true;
+  }
+
+  void CheckBlocks(const DataFile& file, size_t begin, size_t end) {
+    thread_local std::unique_ptr<ZSTD_DCtx, size_t(*)(ZSTD_DCtx*)> ctx(ZSTD_createDCtx(), ZSTD_freeDCtx);
+    if (!ctx) throw std::runtime_error("zstd initialize failed");
+    std::vector<uint8_t> out;
+    auto& index = *file.index;
+    bool const_size = file.header.flags & FileHeader::kConstSize;
+    for (size_t i = begin; i < end; i++) {
+      auto [start, orig, block_end] = index.Block(i);
+      std::string prefix = "block " + std::to_string(i) + " (bytes " + std::to_string(start) + "-" +
+          std::to_string(block_end) + "): ";
+      if (start > block_end || block_end > file.data->size()) {
+        Report(file.fname, prefix + "out of file range", i + 1);
+        continue;
+      }
+      const uint8_t* src = file.data->data() + start;
+      if (index.HasChecksums() && XXHash64(src, block_end - start) != index.Checksum(i)) {
+        Report(file.fname, prefix + "checksum mismatch", i + 1);
+        continue;
+      }
+      try {
+        io_internal::ZstdDecompress(ctx.get(), out, src, block_end - start, orig, file.ddict.get());
+      } catch (std::runtime_error& e) {
+        Report(file.fname, prefix + e.what(), i + 1);
+        continue;
+      }
+      if (const_size) {
+        size_t items = i + 1 == index.NumBlocks() ?
+            file.header.record_count - i * index.ItemsPerIndex() : index.ItemsPerIndex();
+        if (orig != items * file.header.record_bytes) Report(file.fname, prefix + "unexpected block size", i + 1);
+      }
+    }
+  }
+ public:
+  bool Run() {
+    auto fnames = ListDataFiles();
+    size_t headerless = 0;
+    // (file, begin block, end block); the block range is ignored for uncompressed files
+    std::vector<std::tuple<size_t, size_t, size_t>> tasks;
+    for (auto& fname : fnames) {
+      try {
+        auto header = ReadFileHeader(fname);
+        if (!header) {
+          headerless++;
+          continue;
+        }
+        if (header->record_count == FileHeader::kUnknownCount) {
+          Report(fname, "incomplete file (writer did not finish)");
+          continue;
+        }
+        header->CheckBuild();
+        DataFile file{fname, *header, std::make_shared<io_internal::MappedFile>(fname), nullptr, nullptr};
+        size_t idx = files.size();
+        if (header->flags & FileHeader::kCompressed) {
+          file.index = std::make_shared<io_internal::BlockIndex>(fname + ".index");
+          file.ddict = io_internal::LoadDDict(fname);
+          if (!CheckCompressedLayout(file)) continue;
+          for (size_t i = 0; i < file.index->NumBlocks(); i += kBlocksPerTask) {
+            tasks.push_back({idx, i, std::min(i + kBlocksPerTask, file.index->NumBlocks())});
+          }
+        } else {
+          tasks.push_back({idx, 0, 0});
+        }
+        files.push_back(std::move(file));
+      } catch (std::exception& e) {
+        Report(fname, e.what());
+      }
+    }
+    spdlog::info("Verifying {} files ({} without header skipped) with {} threads",
+                 files.size(), headerless, kParallel);
+
+    // one pool task per entry, so large files are spread over all threads
+    BS::thread_pool pool(std::max(1, std::min(kParallel, (int)tasks.size())));
+    pool.parallelize_loop(0, tasks.size(), [&](size_t l, size_t r){
+      for (size_t i = l; i < r; i++) {
+        auto [idx, begin, end] = tasks[i];
+        auto& file = files[idx];
+        try {
+          if (file.index) {
+            CheckBlocks(file, begin, end);
+          } else {
+            CheckUncompressed(file);
+          }
+        } catch (std::exception& e) {
+          Report(file.fname, e.what());
+        }
+      }
+    }, tasks.size()).get();
+
+    if (unchecked_blocks) spdlog::warn("{} blocks have no checksum; only decompression is checked", unchecked_blocks);
+    std::sort(problems.begin(), problems.end());
+    for (auto& [fname, block_key, msg] : problems) spdlog::error("{}: {}", fname, msg);
+    if (problems.size()) {
+      spdlog::error("Verification failed: {} problems found", problems.size());
+      return false;
+    }
+    spdlog::info("All {} files verified", files.size());
+    return true;
+  }
+};
+
+} // namespace
+
+bool VerifyDataFiles() {
+  return Verifier().Run();
+}
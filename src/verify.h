@@ -0,0 +1,6 @@
+#pragma once
+
+// check every board, edge, value, move and threshold file under kDataDir on kParallel threads:
+// headers, index consistency, block checksums, and that every compressed block decompresses
+// every problem found is logged; returns false if there is any
+bool VerifyDataFiles();
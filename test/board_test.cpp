@@ -1,6 +1,9 @@
 #include <random>
 #include <string_view>
+#include <unordered_map>
 #include <gtest/gtest.h>
+#include "../src/board_avx.h"
+#include "../src/board_map.h"
 #include "test_boards.h"
 #include "naive_functions.h"
 
@@ -101,6 +104,63 @@ TEST_F(BoardTest, ColumnHeights) {
   }
 }
 
+TEST_F(BoardTest, FlatBoardMap) {
+  FlatBoardMap mp;
+  std::vector<Board> boards;
+  for (int seed = 0; seed < kSeedMax * 20; seed++) {
+    SetUp(0, 1, seed);
+    boards.push_back(Board(byteboard));
+  }
+  // half of the boards are inserted; the map grows from its minimum size
+  std::unordered_map<Board, uint32_t> ref;
+  for (size_t i = 0; i < boards.size(); i += 2) {
+    mp.Insert(boards[i], i);
+    ref[boards[i]] = i;
+  }
+  mp.Insert(boards[0], 12345);
+  ref[boards[0]] = 12345;
+  ASSERT_EQ(mp.size(), ref.size());
+  std::vector<uint64_t> ids(boards.size());
+  mp.FindBatch(boards.data(), boards.size(), ids.data());
+  for (size_t i = 0; i < boards.size(); i++) {
+    auto it = ref.find(boards[i]);
+    uint64_t expected = it == ref.end() ? FlatBoardMap::kNotFound : it->second;
+    ASSERT_EQ(mp.Find(boards[i]), expected);
+    ASSERT_EQ(ids[i], expected);
+  }
+}
+
+TEST_F(BoardTest, BoardAVX) {
+  for (int seed = 0; seed < kSeedMax; seed++) {
+    SetUp(0, 1, seed);
+    Board a(byteboard);
+    SetUp(0, 1, seed + kSeedMax);
+    Board b(byteboard);
+    BoardAVX va(a), vb(b);
+    ASSERT_EQ(va.ToBoard(), a);
+    ASSERT_EQ((va & vb).ToBoard(), a & b);
+    ASSERT_EQ((va | vb).ToBoard(), a | b);
+    ASSERT_EQ(va.Contains(va & vb), true);
+    ASSERT_EQ(va.Contains(vb), (a & b) == b);
+    ASSERT_EQ(va == vb, a == b);
+  }
+}
+
+TEST_F(BoardTest, FramesAVX) {
+  alignas(32) uint64_t cols[FramesAVX::kCols] = {}, out[FramesAVX::kCols] = {};
+  for (int col = 0; col < 10; col++) cols[FramesAVX::Index(col)] = 0x100ull * (col + 1) | 0xf;
+  for (int vec = 0; vec < FramesAVX::kVectors; vec++) {
+    for (int delta = -FramesAVX::kPad; delta <= FramesAVX::kPad; delta++) {
+      (FramesAVX::Load(cols, vec, delta) >> 4 << 1).Store(out, vec);
+      for (int i = 0; i < FramesAVX::kWidth; i++) {
+        int col = vec * FramesAVX::kWidth + i;
+        uint64_t src = cols[FramesAVX::Index(col + delta)];
+        ASSERT_EQ(out[FramesAVX::Index(col)], src >> 4 << 1);
+      }
+    }
+  }
+}
+
 class BoardTestParam : public BoardTest, public testing::WithParamInterface<int> {};
 TEST_P(BoardTestParam, TestBoardMap) {
   int piece = GetParam();
@@ -141,6 +201,28 @@ TEST_P(BoardTestParam, TestPiecePlace) {
   }
 }
 
+TEST_P(BoardTestParam, Predecessor) {
+  int piece = GetParam();
+  std::mt19937_64 gen(piece);
+  for (int seed = 0; seed < kSeedMax / 50; seed++) {
+    SetUp(0.5, 0.95, seed);
+    // boards never contain full rows
+    Board board = Board(byteboard).ClearLines().second;
+    auto map_board = board.PieceMap(piece);
+    for (size_t r = 0; r < map_board.size(); r++) {
+      for (int i = 0; i < 20; i++) {
+        for (int j = 0; j < 10; j++) {
+          if (!map_board[r].Cell(i, j) || gen() % 4) continue;
+          auto next = board.Place(piece, r, i, j).ClearLines().second;
+          bool found = false;
+          ForEachPredecessor(next, [&](const Board& prev) { found |= prev == board; });
+          ASSERT_TRUE(found) << board.ToString() << piece << ' ' << r << ' ' << i << ' ' << j;
+        }
+      }
+    }
+  }
+}
+
 INSTANTIATE_TEST_SUITE_P(Board, BoardTestParam,
     testing::Values(0, 1, 2, 3, 4, 5, 6));
 
@@ -6,6 +6,7 @@
 #include <gtest/gtest.h>
 #include "../src/io.h"
 #include "../src/edge.h"
+#include "../src/edge_fixed.h"
 #include "../src/move_search.h"
 #include "test_boards.h"
 
@@ -105,6 +106,81 @@ TEST_F(EdgeTest, EvaluateSerializeFast) {
   }
 }
 
+TEST_F(EdgeTest, EvaluateSerializeDelta) {
+  for (auto& m : moves) {
+    auto edges = GenEdges(m).first;
+    std::vector<uint8_t> plain_buf(edges.NumBytes());
+    for (auto& i : edges.next_ids) i.first >>= 12;
+    std::sort(edges.next_ids.begin(), edges.next_ids.end());
+    std::vector<uint8_t> buf(edges.NumBytes());
+    edges.GetBytes(buf.data());
+    if (edges.next_ids.empty()) continue;
+    ASSERT_TRUE(buf[1] & EvaluateNodeEdges::kFlagDeltaIds);
+    ASSERT_LT(buf.size(), plain_buf.size());
+    ASSERT_EQ(EvaluateNodeEdges(buf.data(), buf.size()), edges);
+    ASSERT_EQ(EvaluateNodeEdgesFastTmpl<4096>(buf.data(), buf.size()), edges);
+
+    edges.CalculateSubset();
+    edges.use_subset = true;
+    buf.resize(edges.NumBytes());
+    edges.GetBytes(buf.data());
+    edges.adj.clear();
+    ASSERT_EQ(EvaluateNodeEdges(buf.data(), buf.size()), edges);
+    ASSERT_EQ(EvaluateNodeEdgesFastTmpl<4096>(buf.data(), buf.size()), edges);
+  }
+}
+
+TEST_F(EdgeTest, EvaluateFixedFile) {
+  std::vector<EvaluateNodeEdges> expected;
+  {
+    FixedEdgeWriter writer(kTestFile, 3);
+    for (auto& m : moves) {
+      auto edges = GenEdges(m).first;
+      for (int subset = 0; subset < 2; subset++) {
+        if (subset) {
+          edges.CalculateSubset();
+          edges.use_subset = true;
+          edges.adj.clear();
+        }
+        std::vector<uint8_t> buf(edges.NumBytes());
+        edges.GetBytes(buf.data());
+        auto fast = EvaluateNodeEdgesFastTmpl<4096>(buf.data(), buf.size());
+        writer.Write(fast);
+        expected.push_back(edges);
+      }
+    }
+    writer.Close();
+  }
+  FixedEdgeFile file(kTestFile);
+  ASSERT_EQ(file.Size(), expected.size());
+  std::vector<EvaluateNodeEdgesFixed> records(expected.size());
+  for (size_t start = 0; start <= expected.size(); start += 2) {
+    size_t num = file.Read(start, records.data(), expected.size());
+    ASSERT_EQ(num, expected.size() - start);
+    for (size_t i = 0; i < num; i++) {
+      ASSERT_EQ(reinterpret_cast<uintptr_t>(records[i].base_ptr) % EvaluateNodeEdgesFixed::kAlign, 0);
+      ASSERT_EQ(records[i], expected[start + i]);
+    }
+  }
+  std::vector<uint8_t> seen(expected.size());
+  ParallelScan(file, 0, expected.size(), 4, [&](size_t pos, std::vector<EvaluateNodeEdgesFixed>& items) {
+    for (size_t i = 0; i < items.size(); i++) {
+      ASSERT_EQ(items[i], expected[pos + i]);
+      seen[pos + i]++;
+    }
+  }, {.workers = 3, .unit = 2});
+  ASSERT_EQ(std::count(seen.begin(), seen.end(), 1), (long)expected.size());
+  // the source is not recorded
+  ASSERT_FALSE(file.IsConvertedFrom(kTestFile));
+  {
+    // not closed: the record count is unknown
+    FixedEdgeWriter writer(kTestFile, 3);
+  }
+  ASSERT_THROW(FixedEdgeFile{kTestFile}, std::runtime_error);
+  std::filesystem::remove(kTestFile);
+  std::filesystem::remove(kTestIndexFile);
+}
+
 TEST_F(EdgeTest, EvaluateSubset) {
   for (auto& m : moves) {
     auto edges = GenEdges(m).first;
@@ -1,4 +1,5 @@
 #include <gtest/gtest.h>
+#include <cmath>
 #include <random>
 #include "../src/evaluate.h"
 
@@ -37,6 +38,27 @@ TEST_F(NodeEvalTest, Serialize) {
   }
 }
 
+TEST_F(NodeEvalTest, Half) {
+  std::mt19937_64 gen;
+  for (size_t i = 0; i < 100; i++) {
+    Vec ev_in, var_in, ev_out, var_out;
+    for (auto& j : ev_in) j = rrand(0, 2e+6)(gen);
+    for (auto& j : var_in) j = rrand(0, 1e+12)(gen);
+    NodeEvalHalf v(NodeEval(ev_in.data(), var_in.data()));
+    ASSERT_EQ(sizeof(NodeEvalHalf), 32);
+    ASSERT_EQ(v.NumBytes(), 28); // 2 * 14
+    uint8_t buf[28];
+    v.GetBytes(buf);
+    NodeEval v2 = NodeEvalHalf(buf, 28);
+    v2.GetEv(ev_out.data());
+    v2.GetVar(var_out.data());
+    for (size_t j = 0; j < 7; j++) {
+      ASSERT_NEAR(ev_out[j], ev_in[j], ev_in[j] / 1024 + 64);
+      ASSERT_NEAR(std::sqrt(var_out[j]), std::sqrt(var_in[j]), std::sqrt(var_in[j]) / 1024 + 64);
+    }
+  }
+}
+
 TEST_F(NodeEvalTest, MaxWith) {
   Vec ev1  = {{0, 1, 0, 1, 0, 0, 0}};
   Vec ev2  = {{1, 0, 1, 0, 1, 1, 1}};
@@ -143,4 +165,34 @@ TEST_F(MoveEvalTest, MaxWithMask) {
   }
 }
 
+TEST_F(MoveEvalTest, Packed) {
+  std::mt19937_64 gen;
+  std::vector<Vec> vals(100);
+  std::vector<MoveEvalPacked> packed;
+  std::vector<MoveEvalHalf> half;
+  for (auto& v : vals) {
+    for (auto& j : v) j = rrand(0, 2e+6)(gen);
+    packed.emplace_back(MoveEval(v.data()));
+    half.emplace_back(MoveEval(v.data()));
+  }
+  ASSERT_EQ(sizeof(MoveEvalPacked), 28);
+  ASSERT_EQ(sizeof(MoveEvalHalf), 16);
+  std::vector<std::pair<uint32_t, uint8_t>> next_ids;
+  for (size_t i = 0; i < 30; i++) next_ids.push_back({std::uniform_int_distribution<uint32_t>(0, 99)(gen), 0});
+  MoveEval out_packed[30], out_half[30];
+  GatherValues(packed.data(), next_ids.data(), next_ids.size(), out_packed);
+  GatherValues(half.data(), next_ids.data(), next_ids.size(), out_half);
+  for (size_t i = 0; i < next_ids.size(); i++) {
+    auto& expected = vals[next_ids[i].first];
+    alignas(32) float lanes[8];
+    _mm256_store_ps(lanes, out_packed[i].ev_vec);
+    ASSERT_EQ(lanes[7], 0);
+    Vec out;
+    out_packed[i].GetEv(out.data());
+    ASSERT_EQ(out, expected);
+    out_half[i].GetEv(out.data());
+    for (size_t j = 0; j < 7; j++) ASSERT_NEAR(out[j], expected[j], expected[j] / 1024 + 64);
+  }
+}
+
 } // namespace
@@ -1,11 +1,14 @@
 #include <array>
 #include <random>
+#include <chrono>
 #include <filesystem>
 #include <unordered_set>
 #include <gtest/gtest.h>
 #include "../src/io.h"
 #include "../src/hash.h"
+#include "../src/checksum.h"
 #include "../src/io_hash.h"
+#include "../src/board_index.h"
 #include "../src/io_helpers.h"
 
 namespace {
@@ -76,6 +79,7 @@ class IOTest : public ::testing::Test {
   void TearDown() override {
     std::filesystem::remove(kTestFile);
     std::filesystem::remove(kTestIndexFile);
+    std::filesystem::remove(kTestFile + ".dict");
   }
 
   template <class Reader, class T, class... Args>
@@ -114,11 +118,16 @@ class IOTestConstSize : public IOTest {
 class IOTestVarSize : public IOTest {
  protected:
   std::vector<VarSizeStruct> vec;
-  void SetUp(size_t len, size_t items_per_index, bool compressed = false, size_t max_elem = 255) {
+  void SetUp(size_t len, size_t items_per_index, bool compressed = false, size_t max_elem = 255,
+             int parallel = 0) {
     gen.seed(0);
     vec.clear();
     for (size_t i = 0; i < len; i++) vec.emplace_back(gen, 0, max_elem, true);
-    if (compressed) {
+    if (compressed && parallel) {
+      CompressedClassWriter<VarSizeStruct> writer(
+          kTestFile, items_per_index, std::make_unique<ParallelZstdCompressor>(parallel, -4, 3));
+      writer.Write(vec);
+    } else if (compressed) {
       CompressedClassWriter<VarSizeStruct> writer(kTestFile, items_per_index);
       writer.Write(vec);
     } else {
@@ -191,6 +200,46 @@ TEST_F(IOTestConstSize, SeekCompressed) {
   TestSeek(10000, reader, vec, 0, 0);
 }
 
+TEST_F(IOTestConstSize, Header) {
+  SetUp(1000, true);
+  auto header = ReadFileHeader(kTestFile);
+  ASSERT_TRUE(header.has_value());
+  ASSERT_EQ(header->record_count, 1000);
+  ASSERT_EQ(header->items_per_index, 64);
+  ASSERT_EQ(header->record_bytes, 64);
+  ASSERT_EQ(header->flags, FileHeader::kCompressed | FileHeader::kConstSize | FileHeader::kBlockChecksum);
+  ASSERT_EQ(header->line_cap, kLineCap);
+  CompressedClassReader<ConstSizeStruct> reader(kTestFile);
+  ASSERT_EQ(reader.Size(), 1000);
+  // uncompressed reader on compressed file
+  ASSERT_THROW(ClassReader<ConstSizeStruct>{kTestFile}, std::runtime_error);
+}
+
+TEST_F(IOTestConstSize, HeaderMismatch) {
+  SetUp(1000);
+  {
+    std::fstream f(kTestFile, std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+    f.seekp(24);
+    uint8_t line_cap[4] = {};
+    IntToBytes<uint32_t>(kLineCap + 1, line_cap);
+    f.write(reinterpret_cast<const char*>(line_cap), 4);
+  }
+  ASSERT_THROW(ClassReader<ConstSizeStruct>{kTestFile}, std::runtime_error);
+}
+
+TEST_F(IOTestConstSize, Headerless) {
+  SetUp(1000);
+  {
+    std::ofstream fout(kTestFile, std::ios_base::out | std::ios_base::trunc | std::ios_base::binary);
+    for (auto& i : vec) fout.write(reinterpret_cast<const char*>(i.arr.data()), 64);
+  }
+  ASSERT_FALSE(ReadFileHeader(kTestFile).has_value());
+  ClassReader<ConstSizeStruct> reader(kTestFile);
+  ASSERT_FALSE(reader.Size().has_value());
+  ASSERT_EQ(reader.ReadBatch(1000), vec);
+  TestSeek(1000, reader, vec);
+}
+
 TEST_F(IOTestVarSize, ReadWrite) {
   for (size_t index : {0, 256}) {
     TearDown();
@@ -226,6 +275,28 @@ TEST_F(IOTestVarSize, ReadWriteCompressed) {
   }
 }
 
+TEST_F(IOTestVarSize, WriteSerialized) {
+  auto ReadFile = [](const std::string& fname) {
+    std::ifstream fin(fname, std::ios::binary);
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(fin), {});
+  };
+  SetUp(1000, 256, true);
+  std::vector<uint8_t> orig = ReadFile(kTestFile), orig_index = ReadFile(kTestIndexFile);
+  {
+    // uneven runs, so that runs span block boundaries
+    CompressedClassWriter<VarSizeStruct> writer(kTestFile, 256);
+    for (size_t i = 0; i < vec.size();) {
+      std::vector<uint8_t> buf;
+      size_t n = std::min(vec.size() - i, (size_t)gen() % 300);
+      for (size_t j = 0; j < n; j++) io_internal::WriteToBuf(buf, vec[i + j]);
+      writer.WriteSerialized(buf.data(), buf.size());
+      i += n;
+    }
+  }
+  ASSERT_EQ(ReadFile(kTestFile), orig);
+  ASSERT_EQ(ReadFile(kTestIndexFile), orig_index);
+}
+
 TEST_F(IOTestVarSize, Seek) {
   for (size_t index : {0, 256}) {
     SetUp(100000, index);
@@ -242,6 +313,218 @@ TEST_F(IOTestVarSize, SeekCompressed) {
   TestSeek(10000, reader, vec, 512, 512);
 }
 
+TEST_F(IOTestConstSize, SeekCompressedMmap) {
+  SetUp(100000, true);
+  CompressedClassReader<ConstSizeStruct> reader(kTestFile, true);
+  ASSERT_EQ(reader.ReadBatch(100000), vec);
+  ASSERT_EQ(0, reader.ReadBatch(1).size());
+  TestSeek(1000, reader, vec);
+}
+
+TEST_F(IOTestVarSize, SeekCompressedMmap) {
+  SetUp(100000, 64, true);
+  CompressedClassReader<VarSizeStruct> reader(kTestFile, true);
+  ASSERT_EQ(reader.ReadBatch(100000), vec);
+  ASSERT_EQ(0, reader.ReadBatch(1).size());
+  TestSeek(1000, reader, vec);
+}
+
+TEST_F(IOTestVarSize, SeekCompressedParallel) {
+  SetUp(100000, 64, true, 255, 4);
+  CompressedClassReader<VarSizeStruct> reader(kTestFile);
+  ASSERT_EQ(reader.ReadBatch(100000), vec);
+  ASSERT_EQ(0, reader.ReadBatch(1).size());
+  TestSeek(1000, reader, vec);
+}
+
+TEST_F(IOTestVarSize, SeekCompressedReadAhead) {
+  SetUp(100000, 64, true);
+  BS::thread_pool pool(2);
+  CompressedClassReader<VarSizeStruct> reader(kTestFile, true);
+  reader.SetReadAhead(pool, 4);
+  ASSERT_EQ(reader.ReadBatch(100000), vec);
+  ASSERT_EQ(0, reader.ReadBatch(1).size());
+  TestSeek(1000, reader, vec);
+}
+
+TEST_F(IOTestVarSize, SeekCompressedDictionary) {
+  SetUp(20000, 64);
+  std::vector<uint8_t> samples;
+  std::vector<size_t> sample_sizes;
+  for (size_t i = 0; i < vec.size(); i += 64) {
+    size_t old_size = samples.size();
+    for (size_t j = i; j < std::min(i + 64, vec.size()); j++) io_internal::WriteToBuf(samples, vec[j]);
+    sample_sizes.push_back(samples.size() - old_size);
+  }
+  auto dict = TrainZstdDictionary(samples, sample_sizes, 4096);
+  {
+    CompressedClassWriter<VarSizeStruct> writer(kTestFile, 64, std::make_unique<ParallelZstdCompressor>(2));
+    writer.SetDictionary(dict);
+    writer.Write(vec);
+  }
+  ASSERT_NE(io_internal::LoadDDict(kTestFile), nullptr);
+  ASSERT_EQ(io_internal::LoadDDict(kTestFile), io_internal::LoadDDict(kTestFile));
+  for (bool use_mmap : {false, true}) {
+    CompressedClassReader<VarSizeStruct> reader(kTestFile, use_mmap);
+    ASSERT_EQ(reader.ReadBatch(20000), vec);
+    TestSeek(1000, reader, vec);
+  }
+  // rewriting without a dictionary removes the stale one
+  SetUp(20000, 64, true);
+  CompressedClassReader<VarSizeStruct> reader(kTestFile);
+  ASSERT_EQ(reader.ReadBatch(20000), vec);
+}
+
+TEST_F(IOTestVarSize, SharedIndex) {
+  SetUp(100000, 64, true);
+  {
+    CompressedClassReader<VarSizeStruct> reader1(kTestFile), reader2(kTestFile, true);
+    ASSERT_EQ(io_internal::GetBlockIndex(kTestIndexFile), io_internal::GetBlockIndex(kTestIndexFile));
+    TestSeek(1000, reader1, vec);
+    TestSeek(1000, reader2, vec);
+  }
+  // rewritten file must not use the stale index
+  SetUp(50000, 100, true, 100);
+  CompressedClassReader<VarSizeStruct> reader(kTestFile);
+  ASSERT_EQ(reader.ItemsPerIndex(), 100);
+  ASSERT_EQ(reader.ReadBatch(50000), vec);
+  TestSeek(1000, reader, vec);
+}
+
+TEST_F(IOTestVarSize, SeekCompressedDirectIO) {
+  SetUp(100000, 64, true);
+  BS::thread_pool pool(2);
+  CompressedClassReader<VarSizeStruct> reader(kTestFile);
+  reader.SetDirectIO(pool, 4);
+  ASSERT_EQ(reader.ReadBatch(100000), vec);
+  ASSERT_EQ(0, reader.ReadBatch(1).size());
+  TestSeek(1000, reader, vec);
+}
+
+TEST_F(IOTestVarSize, SeekCompressedBlockCache) {
+  SetUp(100000, 64, true);
+  BlockCache cache(1 << 20, 4);
+  CompressedClassReader<VarSizeStruct> reader1(kTestFile, true), reader2(kTestFile, true);
+  reader1.SetBlockCache(cache);
+  reader2.SetBlockCache(cache);
+  ASSERT_EQ(reader1.ReadBatch(100000), vec);
+  TestSeek(1000, reader1, vec);
+  TestSeek(1000, reader2, vec);
+  auto stats = cache.GetStats();
+  ASSERT_GT(stats.hits, 0);
+  ASSERT_GT(stats.misses, 0);
+}
+
+TEST(BlockCacheTest, Eviction) {
+  BlockCache cache(4096, 1);
+  auto file = std::make_shared<int>(0);
+  size_t loads = 0;
+  auto Load = [&]() { loads++; return std::vector<uint8_t>(1024); };
+  for (size_t i = 0; i < 4; i++) cache.Get(file, i, Load);
+  cache.Get(file, 0, Load); // 0 becomes most recently used
+  cache.Get(file, 4, Load); // evicts 1
+  ASSERT_EQ(loads, 5);
+  cache.Get(file, 0, Load);
+  ASSERT_EQ(loads, 5);
+  cache.Get(file, 1, Load);
+  ASSERT_EQ(loads, 6);
+  auto stats = cache.GetStats();
+  ASSERT_EQ(stats.hits, 2);
+  ASSERT_EQ(stats.misses, 6);
+}
+
+TEST(ChecksumTest, XXHash64) {
+  auto Hash = [](const std::string& str, uint64_t seed = 0) {
+    return XXHash64(reinterpret_cast<const uint8_t*>(str.data()), str.size(), seed);
+  };
+  ASSERT_EQ(Hash(""), 0xef46db3751d8e999);
+  ASSERT_EQ(Hash("a"), 0xd24ec4f1a98c6e5b);
+  ASSERT_EQ(Hash("abc"), 0x44bc2cf5ad770999);
+  ASSERT_EQ(Hash("Nobody inspects the spammish repetition"), 0xfbcea83c8a378bf1);
+}
+
+TEST_F(IOTestVarSize, BlockChecksum) {
+  SetUp(10000, 64, true);
+  size_t corrupt_block = 5;
+  {
+    io_internal::BlockIndex index(kTestIndexFile);
+    ASSERT_TRUE(index.HasChecksums());
+    ASSERT_EQ(index.ItemsPerIndex(), 64);
+    ASSERT_EQ(index.NumBlocks(), (10000 + 63) / 64);
+    auto [start, orig, end] = index.Block(corrupt_block);
+    std::fstream f(kTestFile, std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+    f.seekg((start + end) / 2);
+    char c = f.get();
+    f.seekp((start + end) / 2);
+    f.put(c ^ 1);
+  }
+  for (bool use_mmap : {false, true}) {
+    CompressedClassReader<VarSizeStruct> reader(kTestFile, use_mmap);
+    std::vector<VarSizeStruct> head(vec.begin(), vec.begin() + corrupt_block * 64);
+    ASSERT_EQ(reader.ReadBatch(corrupt_block * 64), head);
+    ASSERT_THROW(reader.ReadOne(), std::runtime_error);
+    reader.Seek((corrupt_block + 1) * 64);
+    ASSERT_EQ(reader.ReadOne(), vec[(corrupt_block + 1) * 64]);
+  }
+}
+
+TEST_F(IOTestVarSize, ParallelScan) {
+  SetUp(100000, 64, true);
+  for (bool ordered : {false, true}) {
+    std::mutex mtx;
+    std::vector<size_t> starts;
+    std::vector<VarSizeStruct> read(vec.size());
+    ScanOptions opts{.io_threads = 4, .workers = 2, .ordered = ordered, .max_batches = 3};
+    ParallelScan<VarSizeStruct>(kTestFile, 1000, 99000, 100, [&](size_t start, std::vector<VarSizeStruct>& items) {
+      std::lock_guard lck(mtx);
+      starts.push_back(start);
+      std::copy(items.begin(), items.end(), read.begin() + start);
+    }, opts);
+    ASSERT_TRUE(std::equal(vec.begin() + 1000, vec.begin() + 99000, read.begin() + 1000));
+    if (ordered) {
+      ASSERT_TRUE(std::is_sorted(starts.begin(), starts.end()));
+    }
+  }
+}
+
+TEST(ParallelScanTest, Chunks) {
+  // chunks start at multiples of align, batches do not cross them
+  std::vector<std::pair<size_t, size_t>> batches;
+  ParallelScanChunks(5, 1000, 64, 30, [](size_t chunk_begin) {
+    return [pos=chunk_begin](size_t num) mutable {
+      pos += num;
+      return std::make_pair(pos - num, num);
+    };
+  }, [&](size_t start, std::pair<size_t, size_t>&& batch) {
+    ASSERT_EQ(start, batch.first);
+    batches.push_back(batch);
+  }, ScanOptions{.io_threads = 3, .ordered = true});
+  size_t pos = 5;
+  for (auto& [start, num] : batches) {
+    ASSERT_EQ(start, pos);
+    ASSERT_LE(num, 30);
+    ASSERT_EQ(start / 64, (start + num - 1) / 64);
+    pos += num;
+  }
+  ASSERT_EQ(pos, 1000);
+  auto Throw = [](size_t start, size_t&&) {
+    if (start >= 500) throw std::runtime_error("test");
+  };
+  auto MakeReader = [](size_t) { return [](size_t num) { return num; }; };
+  for (bool ordered : {false, true}) {
+    ASSERT_THROW(ParallelScanChunks(0, 1000, 64, 10, MakeReader, Throw,
+                                    ScanOptions{.io_threads = 4, .workers = 2, .ordered = ordered}),
+                 std::runtime_error);
+  }
+}
+
+TEST_F(IOTestVarSize, HeaderTypeMismatch) {
+  SetUp(1000, 64, true);
+  ASSERT_THROW(CompressedClassReader<ConstSizeStruct>{kTestFile}, std::runtime_error);
+  CompressedClassReader<VarSizeStruct> reader(kTestFile, true);
+  ASSERT_EQ(reader.ReadBatch(1000), vec);
+}
+
 TEST_F(IOTestVarSize, SizeError) {
   EXPECT_THROW({
     SetUp(1000, 256, false, 1024);
@@ -267,4 +550,98 @@ TEST_F(IOHashTest, HashRW) {
   }
 }
 
+TEST_F(IOHashTest, PerfectHashRW) {
+  for (size_t len : {0, 1, 100000}) {
+    SetUp(len);
+    std::vector<VarSizeStruct> keys;
+    std::unordered_map<VarSizeStruct, uint32_t> mp;
+    for (auto& i : vec) {
+      mp[i.first] = keys.size();
+      keys.push_back(i.first);
+    }
+    WritePerfectHashMap(kTestFile, keys);
+    PerfectHashMapReader<VarSizeStruct> reader(kTestFile);
+    ASSERT_EQ(reader.size(), len);
+    for (size_t i = 0; i < keys.size(); i++) ASSERT_EQ(reader[keys[i]], i);
+    for (size_t i = 0; i < 10000; i++) {
+      VarSizeStruct key(gen, 5, 20, false);
+      if (!mp.count(key)) {
+        ASSERT_FALSE(reader[key].has_value());
+      }
+    }
+  }
+}
+
+TEST_F(IOHashTest, XorFilter) {
+  for (size_t len : {0, 1, 100000}) {
+    SetUp(len);
+    std::vector<VarSizeStruct> keys;
+    std::unordered_set<VarSizeStruct> st;
+    for (auto& i : vec) {
+      keys.push_back(i.first);
+      st.insert(i.first);
+    }
+    XorFilter<VarSizeStruct>::Build(keys).Write(kTestFile);
+    XorFilter<VarSizeStruct> filter(kTestFile);
+    ASSERT_EQ(filter.size(), len);
+    for (auto& i : keys) ASSERT_TRUE(filter.MayContain(i));
+    size_t absent = 0, positives = 0;
+    for (size_t i = 0; i < 100000; i++) {
+      VarSizeStruct key(gen, 5, 20, false);
+      if (st.count(key)) continue;
+      absent++;
+      positives += filter.MayContain(key);
+    }
+    ASSERT_LT(positives, absent / 100);
+  }
+}
+
+TEST_F(IOTest, SortedBoardIndex) {
+  auto RandomBoard = [&]() {
+    CompactBoard ret;
+    // mostly filled rows so that the cell counts collide
+    for (auto& i : ret) i = gen() | gen() | (gen() & (gen() % 2 ? 0xff : 0));
+    return ret;
+  };
+  for (size_t len : {0, 1, (int)SortedBoardIndex::kStride, 10000}) {
+    std::vector<CompactBoard> boards;
+    for (size_t i = 0; i < len; i++) boards.push_back(RandomBoard());
+    std::sort(boards.begin(), boards.end(), [](const CompactBoard& a, const CompactBoard& b){
+      return a.Count() == b.Count() ? a < b : a.Count() < b.Count();
+    });
+    boards.resize(std::unique(boards.begin(), boards.end()) - boards.begin());
+    {
+      ClassWriter<CompactBoard> writer(kTestFile);
+      writer.Write(boards);
+    }
+    std::filesystem::path sample_file = kTestFile + ".sample";
+    for (int with_samples : {0, 1, 2}) {
+      std::filesystem::remove(sample_file);
+      if (with_samples == 1) SortedBoardIndex::WriteSamples(sample_file, kTestFile, boards);
+      if (with_samples == 2) {
+        // samples of an older board file of the same size are not used
+        {
+          ClassWriter<CompactBoard> writer(sample_file);
+          writer.SetSource(kTestFile, kTestFile);
+          writer.Write(RandomBoard(), (boards.size() + SortedBoardIndex::kStride - 1) / SortedBoardIndex::kStride);
+        }
+        auto mtime = std::filesystem::last_write_time(kTestFile);
+        std::filesystem::last_write_time(kTestFile, mtime + std::chrono::seconds(1));
+      }
+      SortedBoardIndex index(kTestFile, sample_file);
+      ASSERT_EQ(index.size(), boards.size());
+      for (size_t i = 0; i < boards.size(); i++) ASSERT_EQ(index[boards[i]], i);
+      for (size_t i = 0; i < 1000; i++) {
+        auto board = RandomBoard();
+        if (!std::binary_search(boards.begin(), boards.end(), board, [](const CompactBoard& a, const CompactBoard& b){
+              return a.Count() == b.Count() ? a < b : a.Count() < b.Count();
+            })) {
+          ASSERT_FALSE(index[board].has_value());
+        }
+      }
+    }
+    std::filesystem::remove(sample_file);
+  }
+}
+
 } // namespace
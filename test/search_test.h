@@ -49,6 +49,24 @@ void TestSearch(const Board& b) {
   });
 }
 
+template <Level level, int adj_delay, class Taps>
+void TestSearchBatch(const std::vector<Board>& boards) {
+  For<7>([&](auto i_obj) {
+    constexpr int piece = i_obj.value;
+    constexpr int rot = Board::NumRotations(piece);
+    std::vector<std::array<Board, rot>> maps;
+    for (auto& b : boards) maps.push_back(b.PieceMap<piece>());
+    std::vector<PossibleMoves> batch(maps.size());
+    MoveSearchBatch<level, rot, adj_delay, Taps>(maps.data(), maps.size(), batch.data());
+    for (size_t i = 0; i < maps.size(); i++) {
+      auto single = MoveSearch<level, rot, adj_delay, Taps>(maps[i]);
+      // same order as well as the same moves
+      EXPECT_EQ(single.non_adj, batch[i].non_adj) << boards[i].ToString() << piece;
+      EXPECT_EQ(single.adj, batch[i].adj) << boards[i].ToString() << piece;
+    }
+  });
+}
+
 template <Level level>
 void TestSearchPosition(const TestSearchBoard& b) {
   PossibleMoves moves;
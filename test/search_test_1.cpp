@@ -12,4 +12,14 @@ TEST_F(SearchTest, Test30Hz) {
   }
 }
 
+TEST_F(SearchTest, Test30HzBatch) {
+  SetUp();
+  std::vector<Board> boards(kTestBoards.begin(), kTestBoards.end());
+  TestSearchBatch<kLevel18, 18, Tap30Hz>(boards);
+  TestSearchBatch<kLevel19, 18, Tap30Hz>(boards);
+  TestSearchBatch<kLevel29, 18, Tap30Hz>(boards);
+  TestSearchBatch<kLevel39, 18, Tap30Hz>(boards);
+  TestSearchBatch<kLevel18, 0, Tap30Hz>(boards);
+}
+
 } // namespace